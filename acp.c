@@ -53,6 +53,8 @@ int acp_init(acp_t *s, vid_t *vid)
 	s->psync_width = round(vid->pixel_rate * psync_width);
 	s->pagc_width  = round(vid->pixel_rate * 2.7e-6);
 	
+	s->agc = -1;
+	
 	/* Left position of each pulse */
 	for(i = 0; i < 6; i++)
 	{
@@ -85,9 +87,15 @@ int acp_render_line(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 		if(i < 0) i = 0;
 		else if(i > 255) i = 255;
 		
-		i = s->yiq_level_lookup[i << 16 | i << 8 | i].y;
-		
-		a->pagc_level = s->sync_level + round((i - s->sync_level) * 1.10);
+		/* The level is clipped for most of the cycle */
+		if(i != a->agc)
+		{
+			a->agc = i;
+			
+			i = s->yiq_level_lookup[i << 16 | i << 8 | i].y;
+			
+			a->pagc_level = s->sync_level + round((i - s->sync_level) * 1.10);
+		}
 	}
 	
 	i = 0;
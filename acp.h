@@ -31,6 +31,9 @@ typedef struct {
 	int psync_width;
 	int pagc_width;
 	
+	/* The sawtooth value pagc_level was calculated from */
+	int agc;
+	
 } acp_t;
 
 extern int acp_init(acp_t *s, vid_t *vid);
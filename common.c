@@ -78,3 +78,23 @@ double rc_window(double t, double left, double width, double rise)
 	return(r);
 }
 
+/* The wall clock used for on-screen clocks, teletext and MAC dates
+ * and PRNG seeds. It can be frozen to make the output reproducible */
+static int _wall_time_set = 0;
+static time_t _wall_time_fixed = 0;
+
+void set_wall_time(time_t t)
+{
+	_wall_time_fixed = t;
+	_wall_time_set = 1;
+}
+
+time_t wall_time(void)
+{
+	if(!_wall_time_set)
+	{
+		return(time(NULL));
+	}
+	
+	return(_wall_time_fixed);
+}
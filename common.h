@@ -19,6 +19,7 @@
 #define _COMMON_H
 
 #include <stdint.h>
+#include <time.h>
 
 typedef struct {
 	int16_t i;
@@ -80,5 +81,8 @@ extern cint16_t *sin_cint16(unsigned int length, unsigned int cycles, double lev
 
 extern double rc_window(double t, double left, double width, double rise);
 
+extern void set_wall_time(time_t t);
+extern time_t wall_time(void);
+
 #endif
 
@@ -94,21 +94,74 @@ static void _prn(uint8_t prn[DANCE_FRAME_BYTES])
 	}
 }
 
+/* Read up to 64 bits from buffer MSB first */
+static uint64_t _rbits_read(const uint8_t *data, size_t offset, size_t nbits)
+{
+	uint64_t bits = 0;
+	size_t n;
+	
+	data += offset >> 3;
+	offset &= 7;
+	
+	/* Read up to 8 whole bytes, left aligned */
+	for(n = 0; n < 64 && n < offset + nbits; n += 8)
+	{
+		bits |= (uint64_t) *(data++) << (56 - n);
+	}
+	
+	bits <<= offset;
+	
+	/* The last few bits may be in a 9th byte */
+	if(offset + nbits > 64)
+	{
+		bits |= *data >> (8 - offset);
+	}
+	
+	return(bits >> (64 - nbits));
+}
+
+static void _transpose64(uint64_t a[64])
+{
+	uint64_t m, t;
+	int j, k;
+	
+	/* Transpose a 64x64 bit matrix, row 0 / bit 63 in the top left */
+	for(j = 32, m = 0x00000000FFFFFFFFULL; j != 0; j >>= 1, m ^= m << j)
+	{
+		for(k = 0; k < 64; k = ((k | j) + 1) & ~j)
+		{
+			t = (a[k] ^ (a[k | j] >> j)) & m;
+			a[k] ^= t;
+			a[k | j] ^= t << j;
+		}
+	}
+}
+
 static void _interleave(uint8_t d[DANCE_FRAME_BYTES])
 {
-	uint8_t tmp[DANCE_FRAME_BYTES - 4];
-	int x, y;
+	uint64_t m[64];
+	int x;
 	
-	memset(tmp, 0, DANCE_FRAME_BYTES - 4);
+	/* The interleave writes out bit n of each of the 32 63-bit
+	 * blocks in turn, which is a transpose of the 32x63 block */
 	d += 4;
 	
-	for(x = y = 0; x < DANCE_FRAME_BITS - 32; x++)
+	for(x = 0; x < 32; x++)
 	{
-		if((d[y >> 3] >> (7 - (y & 7))) & 1) tmp[x >> 3] |= 1 << (7 - (x & 7));
-		if((y += 63) >= 2016) y -= 2015;
+		m[x] = _rbits_read(d, x * 63, 63) << 1;
 	}
 	
-	memcpy(d, tmp, DANCE_FRAME_BYTES - 4);
+	memset(&m[32], 0, sizeof(uint64_t) * 32);
+	
+	_transpose64(m);
+	
+	for(x = 0; x < 63; x++)
+	{
+		d[x * 4 + 0] = m[x] >> 56;
+		d[x * 4 + 1] = m[x] >> 48;
+		d[x * 4 + 2] = m[x] >> 40;
+		d[x * 4 + 3] = m[x] >> 32;
+	}
 }
 
 static const _comp_range_t *_find_range(const int16_t *pcm, int len, int step)
@@ -131,85 +184,99 @@ static const _comp_range_t *_find_range(const int16_t *pcm, int len, int step)
 
 static void _pre_emphasis(_dance_fir_t *fir, int16_t *dst, const int16_t *src, int step, int len)
 {
+	int16_t buf[DANCE_50_10_US_NTAPS - 1 + DANCE_AUDIO_LEN];
 	int32_t l;
 	int x, xi;
+	int n = fir->ntaps - 1;
+	
+	/* Join the history and the new samples into one block */
+	memcpy(buf, fir->hist, sizeof(int16_t) * n);
+	
+	for(x = 0; x < len; x++, src += step)
+	{
+		buf[n + x] = src ? *src : 0;
+	}
 	
 	/* Apply pre-emphasis */
 	for(x = 0; x < len; x++)
 	{
-		fir->buf[fir->p] = src ? *src : 0;
-		if(++fir->p == fir->ntaps) fir->p = 0;
-		
-		for(l = xi = 0; xi < fir->ntaps; xi++)
+		for(l = xi = 0; xi <= n; xi++)
 		{
-			l += (int32_t) fir->buf[fir->p] * fir->taps[xi];
-			if(++fir->p == fir->ntaps) fir->p = 0;
+			l += (int32_t) buf[x + xi] * fir->taps[xi];
 		}
 		
-		*(dst++) = l >> 15;
-		src += step;
+		dst[x] = l >> 15;
 	}
+	
+	memcpy(fir->hist, &buf[len], sizeof(int16_t) * n);
 }
 
 void dance_encode_init(dance_enc_t *s)
 {
+	int i, b;
+	uint8_t code;
+	
 	memset(s, 0, sizeof(dance_enc_t));
 	
 	s->mode_12 = DANCE_MODE_STEREO;
 	s->mode_34 = DANCE_MODE_NONE;
 	
 	_prn(s->prn);
-}
-
-/* Pack bits into buffer LSB first */
-static size_t _bits(uint8_t *data, size_t offset, uint64_t bits, size_t nbits)
-{
-	uint8_t b;
 	
-	for(; nbits; nbits--, offset++, bits >>= 1)
+	/* BCH (63,56) lookup. The register is stored bit reversed, so
+	 * it can be combined directly with the next 8 bits of input */
+	for(i = 0; i < 0x100; i++)
 	{
-		b = 1 << (7 - (offset & 7));
-		if(bits & 1) data[offset >> 3] |= b;
-		else data[offset >> 3] &= ~b;
+		for(code = 0, b = 7; b >= 0; b--)
+		{
+			if((((i >> b) ^ code) & 1) == 0) code >>= 1;
+			else code = (code >> 1) ^ 0x51;
+		}
+		
+		for(s->bch[i] = 0, b = 0; b < 8; b++)
+		{
+			s->bch[i] |= ((code >> b) & 1) << (7 - b);
+		}
 	}
-	
-	return(offset);
 }
 
-/* Pack bits into buffer MSB first */
+/* Pack up to 64 bits into buffer MSB first */
 static size_t _rbits(uint8_t *data, size_t offset, uint64_t bits, size_t nbits)
 {
-	uint64_t m = (uint64_t) 1 << (nbits - 1);
-	uint8_t b;
+	uint8_t *d = &data[offset >> 3];
+	int o = offset & 7;
+	int n;
+	uint8_t m;
 	
-	for(; nbits; nbits--, offset++, bits <<= 1)
+	offset += nbits;
+	
+	/* Write up to a byte at a time */
+	for(; nbits; nbits -= n, o = 0, d++)
 	{
-		b = 1 << (7 - (offset & 7));
-		if(bits & m) data[offset >> 3] |= b;
-		else data[offset >> 3] &= ~b;
+		n = 8 - o;
+		if(n > nbits) n = nbits;
+		
+		m = (0xFF >> o) & (0xFF << (8 - o - n));
+		*d = (*d & ~m) | ((bits >> (nbits - n)) << (8 - o - n) & m);
 	}
 	
 	return(offset);
 }
 
 /* BCH (63,56) */
-static size_t _bch_encode(uint8_t *data, size_t offset)
+static size_t _bch_encode(const uint8_t *bch, uint8_t *data, size_t offset)
 {
-	uint16_t code = 0x0000;
-	size_t i;
-	int b;
+	uint64_t d = _rbits_read(data, offset, 56);
+	uint8_t code = 0x00;
+	int i;
 	
-	for(i = offset; i < offset + 56; i++)
+	for(i = 48; i >= 0; i -= 8)
 	{
-		b = (data[i >> 3] >> (7 - (i & 7))) & 1;
-		b = (b ^ code) & 1;
-		
-		code >>= 1;
-		
-		if(b) code ^= 0x51;
+		code = bch[(uint8_t) (d >> i) ^ code];
 	}
 	
-	return(_bits(data, i, code, 63 - 56));
+	/* The bit reversed code is transmitted LSB first */
+	return(_rbits(data, offset + 56, code >> 1, 63 - 56));
 }
 
 void dance_encode_frame_a(
@@ -264,7 +331,7 @@ void dance_encode_frame_a(
 		x = _rbits(&f2[4], x, 0, 15);
 		
 		/* Apply error correction codes */
-		_bch_encode(&f1[4], i * 63);
+		_bch_encode(s->bch, &f1[4], i * 63);
 	}
 	
 	/* Apply interleave */
@@ -334,7 +401,7 @@ void dance_encode_frame_b(
 		x = _rbits(&f2[4], x, 0, 7);
 		
 		/* Apply error correction codes */
-		_bch_encode(&f1[4], i * 63);
+		_bch_encode(s->bch, &f1[4], i * 63);
 	}
 	
 	/* Apply interleave */
@@ -387,7 +454,8 @@ int dance_mod_init(dance_mod_t *s, uint8_t mode, unsigned int sample_rate, unsig
 	double sps;
 	double t;
 	double r;
-	int x, n;
+	int16_t tap;
+	int x, n, i;
 	
 	memset(s, 0, sizeof(dance_mod_t));
 	
@@ -397,13 +465,13 @@ int dance_mod_init(dance_mod_t *s, uint8_t mode, unsigned int sample_rate, unsig
 	/* Calculate the number of taps needed to cover 5 symbols, rounded up to odd number */
 	s->ntaps = ((unsigned int) (sps * 5) + 1) | 1;
 	
-	s->taps = malloc(sizeof(int16_t) * s->ntaps);
-	if(!s->taps)
+	s->pulses = malloc(sizeof(cint16_t) * s->ntaps * 4);
+	if(!s->pulses)
 	{
 		return(-1);
 	}
 	
-	/* Generate the filter taps */
+	/* Generate the filter taps, and the pulse for each symbol */
 	n = s->ntaps / 2;
 	for(x = -n; x <= n; x++)
 	{
@@ -412,7 +480,13 @@ int dance_mod_init(dance_mod_t *s, uint8_t mode, unsigned int sample_rate, unsig
 		r  = _rrc(t, beta, 1.0) * _hamming((double) x / n);
 		r *= M_SQRT1_2 * INT16_MAX * level;
 		
-		s->taps[x + n] = lround(r);
+		tap = lround(r);
+		
+		for(i = 0; i < 4; i++)
+		{
+			s->pulses[i * s->ntaps + x + n].i = (i & 1 ? tap : -tap);
+			s->pulses[i * s->ntaps + x + n].q = (i & 2 ? tap : -tap);
+		}
 	}
 	
 	/* Allocate memory for the baseband buffer */
@@ -457,7 +531,7 @@ int dance_mod_free(dance_mod_t *s)
 {
 	free(s->cc_start);
 	free(s->bb_start);
-	free(s->taps);
+	free(s->pulses);
 	
 	return(0);
 }
@@ -470,25 +544,39 @@ void dance_mod_input(dance_mod_t *s, const int16_t *audio)
 int dance_mod_output(dance_mod_t *s, int16_t *iq, size_t samples)
 {
 	cint16_t *ciq = (cint16_t *) iq;
-	int x, i;
-	int16_t r;
+	const cint16_t *p;
+	int x, i, n;
 	
 	for(x = 0; x < samples;)
 	{
-		/* Output and clear the buffer */
-		for(; x < samples && s->bb_len; x++, s->bb_len--)
+		/* Output and clear the buffer, in runs that do not
+		 * wrap either the baseband or the carrier buffers */
+		while(x < samples && s->bb_len)
 		{
-			cint16_mula(ciq++, s->bb, s->cc);
+			n = samples - x;
+			if(n > s->bb_len) n = s->bb_len;
+			if(n > s->bb_end - s->bb) n = s->bb_end - s->bb;
+			if(n > s->cc_end - s->cc) n = s->cc_end - s->cc;
+			
+			for(i = 0; i < n; i++)
+			{
+				cint16_mula(&ciq[i], &s->bb[i], &s->cc[i]);
+			}
 			
-			s->bb->i = 0;
-			s->bb->q = 0;
+			memset(s->bb, 0, sizeof(cint16_t) * n);
 			
-			if(++s->bb == s->bb_end)
+			ciq += n;
+			x += n;
+			s->bb_len -= n;
+			
+			s->bb += n;
+			if(s->bb == s->bb_end)
 			{
 				s->bb = s->bb_start;
 			}
 			
-			if(++s->cc == s->cc_end)
+			s->cc += n;
+			if(s->cc == s->cc_end)
 			{
 				s->cc = s->cc_start;
 			}
@@ -516,17 +604,20 @@ int dance_mod_output(dance_mod_t *s, int16_t *iq, size_t samples)
 		s->dsym &= 0x03;
 		s->frame_bit += 2;
 		
-		/* Encode the symbol */
-		for(i = 0; i < s->ntaps; i++)
+		/* Add the symbol's pulse to the baseband buffer */
+		p = &s->pulses[_syms[s->dsym] * s->ntaps];
+		n = s->bb_end - s->bb;
+		
+		for(i = 0; i < n; i++)
 		{
-			r = s->taps[i];
-			s->bb->i += (_syms[s->dsym] & 1 ? r : -r);
-			s->bb->q += (_syms[s->dsym] & 2 ? r : -r);
-			
-			if(++s->bb == s->bb_end)
-			{
-				s->bb = s->bb_start;
-			}
+			s->bb[i].i += p[i].i;
+			s->bb[i].q += p[i].q;
+		}
+		
+		for(i = 0; i < s->ntaps - n; i++)
+		{
+			s->bb_start[i].i += p[n + i].i;
+			s->bb_start[i].q += p[n + i].q;
 		}
 		
 		/* Calculate length of the next block */
@@ -542,4 +633,3 @@ int dance_mod_output(dance_mod_t *s, int16_t *iq, size_t samples)
 	
 	return(0);
 }
-
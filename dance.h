@@ -54,8 +54,7 @@
 #define DANCE_50_10_US_NTAPS   DANCE_A_50_10_US_NTAPS
 
 typedef struct {
-	int p;
-	int16_t buf[DANCE_50_10_US_NTAPS];
+	int16_t hist[DANCE_50_10_US_NTAPS - 1];
 	const int16_t *taps;
 	int ntaps;
 } _dance_fir_t;
@@ -67,6 +66,7 @@ typedef struct {
 	unsigned int frame;
 	uint8_t prn[DANCE_FRAME_BYTES];
 	uint8_t frames[2][DANCE_FRAME_BYTES];
+	uint8_t bch[0x100];
 	
 	/* FIR filters */
 	const int16_t *fir_taps;
@@ -82,8 +82,7 @@ typedef struct {
 	int16_t audio[DANCE_AUDIO_LEN * 2];
 	
 	int ntaps;
-	int16_t *taps;
-	int16_t *hist;
+	cint16_t *pulses; /* Shaped pulse for each symbol */
 	
 	int dsym; /* Differential symbol */
 	
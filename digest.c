@@ -0,0 +1,257 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* The digest sink replaces the RF output with a text file of CRC32
+ * checksums, one record per block of lines. Each record lists the CRC
+ * of the lines leaving every stage of the video pipeline followed by
+ * the CRC of the output samples, e.g.
+ * 
+ *   0 1-25 raster=1a2b3c4d ... output=1a2b3c4d out=1a2b3c4d
+ * 
+ * In check mode the records are compared against a previously recorded
+ * file and the first block and stage that differ are reported. Use with
+ * --fixed-time and --frames for a repeatable run.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <zlib.h>
+#include "hacktv.h"
+#include "digest.h"
+
+typedef struct {
+	FILE *f;
+	int check;
+	vid_t *vid;
+	
+	/* Line counter and CRC of the current block */
+	int64_t line;
+	int64_t first;
+	uint32_t crc;
+	
+	int records;
+	int failed;
+	
+	char record[4096];
+	char golden[4096];
+	
+} rf_digest_t;
+
+static const char *_token(const char *s, int *len)
+{
+	while(*s == ' ') s++;
+	for(*len = 0; s[*len] != '\0' && s[*len] != ' ' && s[*len] != '\n'; (*len)++);
+	return(s);
+}
+
+static void _report(rf_digest_t *rf, int64_t first)
+{
+	const char *a = rf->record;
+	const char *b = rf->golden;
+	int la, lb, i;
+	
+	/* Skip the frame and line range, then find the first stage to differ */
+	for(i = 0; ; i++, a += la, b += lb)
+	{
+		a = _token(a, &la);
+		b = _token(b, &lb);
+		
+		if(la == 0 || lb == 0) break;
+		if(i >= 2 && (la != lb || strncmp(a, b, la) != 0)) break;
+	}
+	
+	fprintf(stderr, "Digest mismatch at frame %" PRId64 " lines %" PRId64 "-%" PRId64,
+		first / rf->vid->conf.lines,
+		first % rf->vid->conf.lines + 1,
+		(rf->line - 1) % rf->vid->conf.lines + 1
+	);
+	
+	if(la > 0)
+	{
+		fprintf(stderr, ", first in stage '%.*s'", (int) (strchr(a, '=') ? strchr(a, '=') - a : la), a);
+	}
+	
+	fprintf(stderr, "\n");
+	fprintf(stderr, "  Expected: %s", rf->golden);
+	fprintf(stderr, "  Got:      %s", rf->record);
+}
+
+static int _flush(rf_digest_t *rf)
+{
+	vid_t *vid = rf->vid;
+	int64_t first = rf->first;
+	size_t l;
+	int i;
+	
+	if(rf->line == rf->first)
+	{
+		return(HACKTV_OK);
+	}
+	
+	l = snprintf(rf->record, sizeof(rf->record), "%" PRId64 " %" PRId64 "-%" PRId64,
+		rf->first / vid->conf.lines,
+		rf->first % vid->conf.lines + 1,
+		(rf->line - 1) % vid->conf.lines + 1
+	);
+	
+	for(i = 0; i < vid->nprocesses && l < sizeof(rf->record); i++)
+	{
+		l += snprintf(rf->record + l, sizeof(rf->record) - l, " %s=%08" PRIx32, vid->processes[i].name, vid->processes[i].crc);
+		vid->processes[i].crc = 0;
+	}
+	
+	if(l < sizeof(rf->record))
+	{
+		snprintf(rf->record + l, sizeof(rf->record) - l, " out=%08" PRIx32 "\n", rf->crc);
+	}
+	
+	rf->first = rf->line;
+	rf->crc = 0;
+	rf->records++;
+	
+	if(!rf->check)
+	{
+		fputs(rf->record, rf->f);
+		return(HACKTV_OK);
+	}
+	
+	if(fgets(rf->golden, sizeof(rf->golden), rf->f) == NULL)
+	{
+		fprintf(stderr, "Digest mismatch: the golden digest ends after %d records\n", rf->records - 1);
+		rf->failed = 1;
+		return(HACKTV_ERROR);
+	}
+	
+	if(strcmp(rf->record, rf->golden) != 0)
+	{
+		_report(rf, first);
+		rf->failed = 1;
+		return(HACKTV_ERROR);
+	}
+	
+	return(HACKTV_OK);
+}
+
+static int _rf_digest_write(void *private, const int16_t *iq_data, size_t samples)
+{
+	rf_digest_t *rf = private;
+	int64_t l;
+	
+	if(rf->failed)
+	{
+		return(HACKTV_ERROR);
+	}
+	
+	rf->crc = crc32(rf->crc, (const Bytef *) iq_data, sizeof(int16_t) * 2 * samples);
+	
+	/* Each write is one line. Blocks end every
+	 * DIGEST_BLOCK_LINES lines and at the end of each frame */
+	l = ++rf->line % rf->vid->conf.lines;
+	
+	if(l % DIGEST_BLOCK_LINES == 0 || l == 0)
+	{
+		return(_flush(rf));
+	}
+	
+	return(HACKTV_OK);
+}
+
+static int _rf_digest_close(void *private)
+{
+	rf_digest_t *rf = private;
+	int r = HACKTV_OK;
+	
+	if(rf->f)
+	{
+		if(!rf->failed)
+		{
+			_flush(rf);
+		}
+		
+		if(rf->check && !rf->failed && fgets(rf->golden, sizeof(rf->golden), rf->f) != NULL)
+		{
+			fprintf(stderr, "Digest mismatch: the golden digest has more than %d records\n", rf->records);
+			rf->failed = 1;
+		}
+		
+		if(rf->check && !rf->failed)
+		{
+			fprintf(stderr, "Digest matched %d records\n", rf->records);
+		}
+		
+		if(rf->f != stdout) fclose(rf->f);
+	}
+	
+	if(rf->failed)
+	{
+		r = HACKTV_ERROR;
+	}
+	
+	rf->vid->stage_crc = 0;
+	free(rf);
+	
+	return(r);
+}
+
+int rf_digest_open(hacktv_t *s, const char *filename, int check)
+{
+	rf_digest_t *rf = calloc(1, sizeof(rf_digest_t));
+	
+	if(!rf)
+	{
+		perror("calloc");
+		return(HACKTV_ERROR);
+	}
+	
+	rf->check = check;
+	rf->vid = &s->vid;
+	
+	if(filename == NULL)
+	{
+		fprintf(stderr, "No digest filename provided.\n");
+		_rf_digest_close(rf);
+		return(HACKTV_ERROR);
+	}
+	else if(strcmp(filename, "-") == 0 && !check)
+	{
+		rf->f = stdout;
+	}
+	else
+	{
+		rf->f = fopen(filename, check ? "r" : "w");
+		
+		if(!rf->f)
+		{
+			perror(filename);
+			_rf_digest_close(rf);
+			return(HACKTV_ERROR);
+		}
+	}
+	
+	/* Enable the per-stage checksums */
+	s->vid.stage_crc = 1;
+	
+	s->rf_private = rf;
+	s->rf_write = _rf_digest_write;
+	s->rf_close = _rf_digest_close;
+	
+	return(HACKTV_OK);
+}
+
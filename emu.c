@@ -0,0 +1,232 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* An emulated HackRF. A thread takes one transfer from the buffer ring
+ * each time the device would ask for one, the same way as the USB
+ * callback in hackrf.c. Random jitter and regular stalls can be added
+ * to the thread's wake up times to test how the buffering copes. */
+
+#ifndef WIN32
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
+#include "hacktv.h"
+#include "rfbuffer.h"
+#include "emu.h"
+#include "rt.h"
+
+/* Bytes per transfer, as used by libhackrf */
+#define EMU_TRANSFER 262144
+
+typedef struct {
+	
+	rf_buffers_t buffers;
+	
+	/* Consumer thread, started once the buffers are prefilled */
+	pthread_t thread;
+	int started;
+	volatile int abort;
+	uint8_t *transfer;
+	
+	/* Timing */
+	int64_t period;
+	int64_t jitter;
+	int64_t stall;
+	int64_t stall_every;
+	unsigned int seed;
+	
+	/* Counters */
+	uint64_t transfers;
+	uint64_t missed;
+	uint64_t stalls;
+	
+} emu_t;
+
+static int64_t _now(void)
+{
+	struct timespec t;
+	
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	
+	return((int64_t) t.tv_sec * 1000000000LL + t.tv_nsec);
+}
+
+static void _sleep_until(int64_t ns)
+{
+	struct timespec t;
+	
+	t.tv_sec = ns / 1000000000LL;
+	t.tv_nsec = ns % 1000000000LL;
+	
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) != 0);
+}
+
+static void *_emu_thread(void *arg)
+{
+	emu_t *rf = arg;
+	int64_t next, stall, wake, late;
+	
+	rt_thread(RT_SINK);
+	
+	next = _now();
+	stall = next + rf->stall_every;
+	
+	while(!rf->abort)
+	{
+		next += rf->period;
+		wake = next;
+		
+		if(rf->jitter > 0)
+		{
+			wake += (int64_t) ((double) rand_r(&rf->seed) / RAND_MAX * rf->jitter);
+		}
+		
+		if(rf->stall > 0 && next >= stall)
+		{
+			wake += rf->stall;
+			stall += rf->stall_every;
+			rf->stalls++;
+		}
+		
+		_sleep_until(wake);
+		
+		/* Transfers the device had to send while we were away are
+		 * lost, it does not wait for the host to catch up */
+		late = _now() - next;
+		if(late > rf->period)
+		{
+			rf->missed += late / rf->period;
+			next += late / rf->period * rf->period;
+		}
+		
+		rf_buffers_fill(&rf->buffers, rf->transfer, EMU_TRANSFER);
+		rf->transfers++;
+	}
+	
+	return(NULL);
+}
+
+static int _rf_start(emu_t *rf)
+{
+	if(pthread_create(&rf->thread, NULL, &_emu_thread, rf) != 0)
+	{
+		perror("pthread_create");
+		return(HACKTV_ERROR);
+	}
+	
+	rf->started = 1;
+	
+	return(HACKTV_OK);
+}
+
+static int _rf_write(void *private, const int16_t *iq_data, size_t samples)
+{
+	emu_t *rf = private;
+	
+	rf_buffers_write_iq(&rf->buffers, iq_data, samples);
+	
+	if(!rf->started && rf_buffers_ready(&rf->buffers))
+	{
+		return(_rf_start(rf));
+	}
+	
+	return(HACKTV_OK);
+}
+
+static int _rf_close(void *private)
+{
+	emu_t *rf = private;
+	int r = HACKTV_OK;
+	
+	/* Output shorter than the prefill still has to be sent */
+	if(!rf->started && rf->buffers.written > 0)
+	{
+		r = _rf_start(rf);
+	}
+	
+	if(rf->started)
+	{
+		r = rf_buffers_drain(&rf->buffers);
+		
+		rf->abort = 1;
+		pthread_join(rf->thread, NULL);
+	}
+	
+	rf_buffers_report(&rf->buffers, "emu");
+	fprintf(stderr, "emu: %" PRIu64 " transfers, %" PRIu64 " missed, %" PRIu64 " stalls\n",
+		rf->transfers, rf->missed, rf->stalls);
+	
+	rf_buffers_free(&rf->buffers);
+	free(rf->transfer);
+	free(rf);
+	
+	return(r);
+}
+
+int rf_emu_open(hacktv_t *s, int jitter_us, int stall_ms, float stall_every)
+{
+	emu_t *rf;
+	int r;
+	
+	if(stall_ms > 0 && stall_every <= 0)
+	{
+		fprintf(stderr, "The stall interval must be greater than zero.\n");
+		return(HACKTV_ERROR);
+	}
+	
+	rf = calloc(1, sizeof(emu_t));
+	if(!rf)
+	{
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	rf->transfer = malloc(EMU_TRANSFER);
+	if(!rf->transfer)
+	{
+		free(rf);
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	/* Buffering is set up the same way as the HackRF sink */
+	r = rf_buffers_open(&rf->buffers, s);
+	if(r != HACKTV_OK)
+	{
+		free(rf->transfer);
+		free(rf);
+		return(r);
+	}
+	
+	rf->period = (int64_t) EMU_TRANSFER / 2 * 1000000000LL / s->vid.sample_rate;
+	rf->jitter = (int64_t) jitter_us * 1000;
+	rf->stall = (int64_t) stall_ms * 1000000;
+	rf->stall_every = (int64_t) (stall_every * 1e9);
+	rf->seed = 1;
+	
+	/* Register the callback functions */
+	s->rf_private = rf;
+	s->rf_write = _rf_write;
+	s->rf_close = _rf_close;
+	
+	return(HACKTV_OK);
+}
+
+#endif
+
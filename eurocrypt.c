@@ -760,7 +760,7 @@ char *_get_sub_date(int b, const char *date)
 	
 	dtm = malloc(sizeof(char) * 24);
 	
-	time_t t = time(NULL);
+	time_t t = wall_time();
 	struct tm tm = *localtime(&t);
 	
 	m = tm.tm_mon + 1;
@@ -1488,7 +1488,7 @@ static uint8_t _update_emmgs_packet(eurocrypt_t *e, int t)
 	return(x / ECM_PAYLOAD_BYTES);
 }
 
-static uint64_t _update_cw(eurocrypt_t *e, int t)
+static uint64_t _update_cw(eurocrypt_t *e, int t, unsigned int *seed)
 {
 	uint64_t cw;
 	int i, r;
@@ -1504,7 +1504,7 @@ static uint64_t _update_cw(eurocrypt_t *e, int t)
 	
 	for(i = 0; i < 8; i++)
 	{
-		e->cw[t][i] = e->ecw[t][i] = rand() & 0xFF;
+		e->cw[t][i] = e->ecw[t][i] = rand_r(seed) & 0xFF;
 	}
 
 	/* EC-S uses a home-brew encryption */
@@ -1531,7 +1531,7 @@ void eurocrypt_next_frame(vid_t *vid, int frame)
 		int t = (frame >> 8) & 1;
 		
 		/* Fetch and update next CW */
-		vid->mac.cw = _update_cw(e, t);
+		vid->mac.cw = _update_cw(e, t, &vid->rand_seed);
 		
 		/* Update the ECM packet */
 		if(e->mode->packet_type == EC_S)
@@ -1774,8 +1774,8 @@ int eurocrypt_init(vid_t *vid, const char *mode)
 	e->emm_addr = 347;
 	
 	/* Generate initial even and odd encrypted CWs */
-	_update_cw(e, 0);
-	_update_cw(e, 1);
+	_update_cw(e, 0, &vid->rand_seed);
+	_update_cw(e, 1, &vid->rand_seed);
 	
 	/* Generate initial packet */
 	if(e->mode->packet_type == EC_S)
@@ -55,6 +55,8 @@
 #include <libavfilter/buffersrc.h>
 #include "hacktv.h"
 #include "keyboard.h"
+#include "rt.h"
+#include "hugepage.h"
 #ifdef WIN32
 #include <conio.h>
 #endif
@@ -62,17 +64,23 @@
 /* Maximum length of the packet queue */
 /* Taken from ffplay.c */
 #define MAX_QUEUE_SIZE (15 * 1024 * 1024)
+
+/* Maximum number of packets in the packet queue */
+#define MAX_QUEUE_LENGTH 1024
+
+/* Length of the resampled audio ring in stereo samples, a power of two */
+#define AUDIO_RING_LENGTH 8192
+
+/* Largest drift correction, in percent of the audio rate */
+#define AUDIO_MAX_CORRECTION 1
+
+/* Most pipelines that can share one decoder */
+#define MAX_SUBSCRIBERS 8
+
 #define AVSEEK_FWD 60
 #define AVSEEK_RWD -60
 #define AVSEEK_SEEKING 1
 
-typedef struct __packet_queue_item_t {
-	
-	AVPacket pkt;
-	struct __packet_queue_item_t *next;
-	
-} _packet_queue_item_t;
-
 typedef struct {
 	
 	int length;	/* Number of packets */
@@ -80,12 +88,43 @@ typedef struct {
 	int eof;        /* End of stream / file flag */
 	int abort;      /* Abort flag */
 	
-	/* Pointers to the first and last packets in the queue */
-	_packet_queue_item_t *first;
-	_packet_queue_item_t *last;
+	/* Ring of packet references, MAX_QUEUE_LENGTH long */
+	AVPacket *pkts;
+	int first;
+	
+	/* Thread locking and signaling. The conditions are only
+	 * signalled when the other side is known to be waiting */
+	pthread_mutex_t mutex;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	int readers;
+	int writers;
 	
 } _packet_queue_t;
 
+typedef struct {
+	
+	/* Ring of stereo samples with a single producer and one reader
+	 * per subscriber. The indices only ever increase and are masked
+	 * on use. head is only written by the resampler, and each tail
+	 * only by its line generator. The producer waits for the slowest */
+	int16_t *data;
+	uint32_t head;
+	uint32_t tail[MAX_SUBSCRIBERS];
+	uint32_t pending[MAX_SUBSCRIBERS];	/* Samples handed to the reader, not yet released */
+	int left[MAX_SUBSCRIBERS];		/* The reader has closed */
+	int readers;
+	
+	int eof;
+	int abort;
+	
+	/* Slow path for an empty or full ring */
+	int waiting;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	
+} _audio_ring_t;
+
 typedef struct {
 	
 	int ready;	/* Frame ready flag */
@@ -101,8 +140,25 @@ typedef struct {
 	
 } _frame_dbuffer_t;
 
+typedef struct _av_ffmpeg_t av_ffmpeg_t;
+
 typedef struct {
 	
+	/* One pipeline fed by the decoder. The frames in its buffer
+	 * are references to the output frames shared by all of them */
+	av_ffmpeg_t *av;
+	vid_t *s;
+	int index;
+	
+	_frame_dbuffer_t out_video_buffer;
+	vid_yiq_frame_t yiq_frame;
+	int video_eof;
+	int audio_eof;
+	
+} _av_subscriber_t;
+
+struct _av_ffmpeg_t {
+	
 	/* Seek stuff */
 	int width;
 	int height;
@@ -112,7 +168,11 @@ typedef struct {
 	uint8_t paused;
 	time_t last_paused;
 	
+	/* Overlays. These belong to the input rather than the video
+	 * state, as the input may be opened while another is playing */
 	av_font_t *font[10];
+	image_t logo;
+	image_t media_icons[2];
 	
 	AVFormatContext *format_ctx;
 	
@@ -123,11 +183,21 @@ typedef struct {
 	AVStream *video_stream;
 	AVCodecContext *video_codec_ctx;
 	_frame_dbuffer_t in_video_buffer;
-	int video_eof;
 	
-	/* Video scaling */
+	/* Video scaling. Output frames come from a pool, and are
+	 * recycled once every subscriber has moved past them */
 	struct SwsContext *sws_ctx;
-	_frame_dbuffer_t out_video_buffer;
+	int sws_flags;
+	enum AVPixelFormat out_pix_fmt;
+	AVBufferPool *out_pool;
+	AVFrame *out_frame;
+	
+	/* Planar YIQ output. The scaler produces full range YCbCr into
+	 * yuv_data, which is converted to signal levels in the output
+	 * frames. Only used when nothing needs to be drawn over the video */
+	int yiq;
+	uint8_t *yuv_data[4];
+	int yuv_linesize[4];
 	
 	/* Audio decoder */
 	AVRational audio_time_base;
@@ -136,12 +206,12 @@ typedef struct {
 	AVStream *audio_stream;
 	AVCodecContext *audio_codec_ctx;
 	_frame_dbuffer_t in_audio_buffer;
-	int audio_eof;
 	
 	/* Audio resampler */
 	struct SwrContext *swr_ctx;
-	_frame_dbuffer_t out_audio_buffer;
-	int out_frame_size;
+	_audio_ring_t audio_ring;
+	int64_t audio_out_samples;
+	double audio_drift;
 	int allowed_error;
 	
 	/* Subtitle decoder */
@@ -156,11 +226,7 @@ typedef struct {
 	pthread_t audio_decode_thread;
 	pthread_t audio_scaler_thread;
 	volatile int thread_abort;
-	int input_stall;
-	
-	/* Thread locking and signaling for input queues */
-	pthread_mutex_t mutex;
-	pthread_cond_t cond;
+	volatile int input_stall;
 	
 	/* Video filter buffers */
 	AVFilterContext *vbuffersink_ctx;
@@ -171,7 +237,13 @@ typedef struct {
 	AVFilterContext *abuffersrc_ctx;
 	AVRational sar, dar;
 	
-} av_ffmpeg_t;
+	/* The pipelines sharing this decoder. The first one's
+	 * settings are used for decoding and scaling */
+	_av_subscriber_t sub[MAX_SUBSCRIBERS];
+	int subscribers;
+	int open_subscribers;
+	
+};
 
 static void _print_ffmpeg_error(int r)
 {
@@ -207,52 +279,85 @@ static int _packet_queue_init(av_ffmpeg_t *av, _packet_queue_t *q)
 	q->size = 0;
 	q->eof = 0;
 	q->abort = 0;
+	q->first = 0;
+	q->readers = 0;
+	q->writers = 0;
+	
+	q->pkts = calloc(MAX_QUEUE_LENGTH, sizeof(AVPacket));
+	if(!q->pkts)
+	{
+		return(-1);
+	}
+	
+	pthread_mutex_init(&q->mutex, NULL);
+	pthread_cond_init(&q->not_empty, NULL);
+	pthread_cond_init(&q->not_full, NULL);
 	
 	return(0);
 }
 
 static int _packet_queue_flush(av_ffmpeg_t *av, _packet_queue_t *q)
 {
-	_packet_queue_item_t *p;
+	pthread_mutex_lock(&q->mutex);
 	
-	pthread_mutex_lock(&av->mutex);
-	
-	while(q->length--)
+	for(; q->length; q->length--)
 	{
-		/* Pop the first item off the list */
-		p = q->first;
-		q->first = p->next;
-		
-		av_packet_unref(&p->pkt);
-		free(p);
+		/* Pop the first packet off the ring */
+		av_packet_unref(&q->pkts[q->first]);
+		q->first = (q->first + 1) % MAX_QUEUE_LENGTH;
 	}
 	
-	pthread_cond_signal(&av->cond);
-	pthread_mutex_unlock(&av->mutex);
+	q->size = 0;
+	
+	pthread_cond_broadcast(&q->not_full);
+	pthread_mutex_unlock(&q->mutex);
 	
 	return(0);
 }
 
 static void _packet_queue_free(av_ffmpeg_t *av, _packet_queue_t *q)
 {
+	if(q->pkts == NULL)
+	{
+		return;
+	}
+	
 	_packet_queue_flush(av, q);
+	
+	pthread_cond_destroy(&q->not_full);
+	pthread_cond_destroy(&q->not_empty);
+	pthread_mutex_destroy(&q->mutex);
+	
+	free(q->pkts);
+	q->pkts = NULL;
+}
+
+static void _packet_queue_wake(_packet_queue_t *q)
+{
+	pthread_mutex_lock(&q->mutex);
+	pthread_cond_broadcast(&q->not_empty);
+	pthread_cond_broadcast(&q->not_full);
+	pthread_mutex_unlock(&q->mutex);
 }
 
 static void _packet_queue_abort(av_ffmpeg_t *av, _packet_queue_t *q)
 {
-	pthread_mutex_lock(&av->mutex);
-	
+	pthread_mutex_lock(&q->mutex);
 	q->abort = 1;
+	pthread_mutex_unlock(&q->mutex);
 	
-	pthread_cond_signal(&av->cond);
-	pthread_mutex_unlock(&av->mutex);
+	_packet_queue_wake(q);
+}
+
+static int _packet_queue_full(_packet_queue_t *q, AVPacket *pkt)
+{
+	return(q->length == MAX_QUEUE_LENGTH ||
+	       q->size + pkt->size + sizeof(AVPacket) > MAX_QUEUE_SIZE);
 }
 
 static int _packet_queue_write(av_ffmpeg_t *av, _packet_queue_t *q, AVPacket *pkt)
 {
-	_packet_queue_item_t *p;
-	
-	pthread_mutex_lock(&av->mutex);
+	pthread_mutex_lock(&q->mutex);
 	
 	/* A NULL packet signals the end of the stream / file */
 	if(pkt == NULL)
@@ -262,86 +367,90 @@ static int _packet_queue_write(av_ffmpeg_t *av, _packet_queue_t *q, AVPacket *pk
 	else
 	{
 		/* Limit the size of the queue */
-		while(q->abort == 0 && q->size + pkt->size + sizeof(_packet_queue_item_t) > MAX_QUEUE_SIZE)
+		if(q->abort == 0 && _packet_queue_full(q, pkt))
 		{
+			/* Let the decoder waiting on the other stream know it
+			 * won't get any more packets until this one drains */
 			av->input_stall = 1;
-			pthread_cond_signal(&av->cond);
-			pthread_cond_wait(&av->cond, &av->mutex);
+			
+			pthread_mutex_unlock(&q->mutex);
+			if(q != &av->video_queue) _packet_queue_wake(&av->video_queue);
+			if(q != &av->audio_queue) _packet_queue_wake(&av->audio_queue);
+			pthread_mutex_lock(&q->mutex);
+			
+			while(q->abort == 0 && _packet_queue_full(q, pkt))
+			{
+				q->writers++;
+				pthread_cond_wait(&q->not_full, &q->mutex);
+				q->writers--;
+			}
+			
+			av->input_stall = 0;
 		}
 		
-		av->input_stall = 0;
-		
 		if(q->abort == 1)
 		{
 			/* Abort was called while waiting for the queue size to drop */
 			av_packet_unref(pkt);
-			
-			pthread_cond_signal(&av->cond);
-			pthread_mutex_unlock(&av->mutex);
+			pthread_mutex_unlock(&q->mutex);
 			
 			return(-2);
 		}
 		
-		/* Allocate memory for queue item and copy packet */
-		p = malloc(sizeof(_packet_queue_item_t));
-		p->pkt = *pkt;
-		p->next = NULL;
-		
-		/* Add the item to the end of the queue */
-		if(q->length == 0)
-		{
-			q->first = p;
-		}
-		else
-		{
-			q->last->next = p;
-		}
-		
-		q->last = p;
+		/* Move the packet reference onto the end of the ring */
+		q->pkts[(q->first + q->length) % MAX_QUEUE_LENGTH] = *pkt;
 		q->length++;
-		q->size += pkt->size + sizeof(_packet_queue_item_t);
+		q->size += pkt->size + sizeof(AVPacket);
+	}
+	
+	if(q->readers)
+	{
+		pthread_cond_signal(&q->not_empty);
 	}
 	
-	pthread_cond_signal(&av->cond);
-	pthread_mutex_unlock(&av->mutex);
+	pthread_mutex_unlock(&q->mutex);
 	
 	return(0);
 }
 
 static int _packet_queue_read(av_ffmpeg_t *av, _packet_queue_t *q, AVPacket *pkt)
 {
-	_packet_queue_item_t *p;
-	
-	pthread_mutex_lock(&av->mutex);
+	pthread_mutex_lock(&q->mutex);
 	
 	while(q->length == 0)
 	{
 		if(av->input_stall)
 		{
-			pthread_mutex_unlock(&av->mutex);
+			pthread_mutex_unlock(&q->mutex);
 			return(0);
 		}
 		
 		if(q->abort == 1 || q->eof == 1)
 		{
-			pthread_mutex_unlock(&av->mutex);
+			pthread_mutex_unlock(&q->mutex);
 			return(q->abort == 1 ? -2 : -1);
 		}
 		
-		pthread_cond_wait(&av->cond, &av->mutex);
+		q->readers++;
+		pthread_cond_wait(&q->not_empty, &q->mutex);
+		q->readers--;
 	}
 	
-	p = q->first;
-	
-	*pkt = p->pkt;
-	q->first = p->next;
+	*pkt = q->pkts[q->first];
+	q->first = (q->first + 1) % MAX_QUEUE_LENGTH;
 	q->length--;
-	q->size -= pkt->size + sizeof(_packet_queue_item_t);
+	q->size -= pkt->size + sizeof(AVPacket);
 	
-	free(p);
+	/* A stalled writer is only woken once the queue has drained
+	 * by half, so it can refill it without waking for every packet */
+	if(q->writers &&
+	   q->length <= MAX_QUEUE_LENGTH / 2 &&
+	   q->size <= MAX_QUEUE_SIZE / 2)
+	{
+		pthread_cond_signal(&q->not_full);
+	}
 	
-	pthread_cond_signal(&av->cond);
-	pthread_mutex_unlock(&av->mutex);
+	pthread_mutex_unlock(&q->mutex);
 	
 	return(0);
 }
@@ -459,6 +568,196 @@ static AVFrame *_frame_dbuffer_flip(_frame_dbuffer_t *d)
 	return(frame);
 }
 
+static int _audio_ring_init(_audio_ring_t *r, int readers)
+{
+	int i;
+	
+	r->data = malloc(sizeof(int16_t) * 2 * AUDIO_RING_LENGTH);
+	if(!r->data)
+	{
+		return(-1);
+	}
+	
+	r->head = 0;
+	r->readers = readers;
+	
+	for(i = 0; i < MAX_SUBSCRIBERS; i++)
+	{
+		r->tail[i] = 0;
+		r->pending[i] = 0;
+		r->left[i] = 0;
+	}
+	
+	r->eof = 0;
+	r->abort = 0;
+	r->waiting = 0;
+	
+	pthread_mutex_init(&r->mutex, NULL);
+	pthread_cond_init(&r->cond, NULL);
+	
+	return(0);
+}
+
+static void _audio_ring_free(_audio_ring_t *r)
+{
+	pthread_cond_destroy(&r->cond);
+	pthread_mutex_destroy(&r->mutex);
+	free(r->data);
+}
+
+static void _audio_ring_wake(_audio_ring_t *r)
+{
+	/* Only take the lock if the other side is asleep */
+	if(__atomic_load_n(&r->waiting, __ATOMIC_SEQ_CST))
+	{
+		pthread_mutex_lock(&r->mutex);
+		pthread_cond_broadcast(&r->cond);
+		pthread_mutex_unlock(&r->mutex);
+	}
+}
+
+static void _audio_ring_sleep(_audio_ring_t *r, uint32_t *index, uint32_t value)
+{
+	/* Wait for the other side to move the index on */
+	pthread_mutex_lock(&r->mutex);
+	__atomic_add_fetch(&r->waiting, 1, __ATOMIC_SEQ_CST);
+	
+	while(__atomic_load_n(index, __ATOMIC_SEQ_CST) == value &&
+	      !__atomic_load_n(&r->abort, __ATOMIC_SEQ_CST) &&
+	      !__atomic_load_n(&r->eof, __ATOMIC_SEQ_CST))
+	{
+		pthread_cond_wait(&r->cond, &r->mutex);
+	}
+	
+	__atomic_sub_fetch(&r->waiting, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&r->mutex);
+}
+
+static void _audio_ring_end(_audio_ring_t *r, int abort)
+{
+	__atomic_store_n(abort ? &r->abort : &r->eof, 1, __ATOMIC_SEQ_CST);
+	
+	pthread_mutex_lock(&r->mutex);
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->mutex);
+}
+
+static void _audio_ring_leave(_audio_ring_t *r, int reader)
+{
+	/* Stop waiting for this reader. Moving its tail on wakes the
+	 * producer if it was waiting on it */
+	__atomic_store_n(&r->left[reader], 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&r->tail[reader], 1, __ATOMIC_SEQ_CST);
+	
+	pthread_mutex_lock(&r->mutex);
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->mutex);
+}
+
+static int _audio_ring_slowest(_audio_ring_t *r, uint32_t *tail)
+{
+	uint32_t t;
+	int i, slowest = -1;
+	
+	/* Find the reader furthest behind the head */
+	for(i = 0; i < r->readers; i++)
+	{
+		if(__atomic_load_n(&r->left[i], __ATOMIC_SEQ_CST)) continue;
+		
+		t = __atomic_load_n(&r->tail[i], __ATOMIC_SEQ_CST);
+		
+		if(slowest < 0 || r->head - t > r->head - *tail)
+		{
+			*tail = t;
+			slowest = i;
+		}
+	}
+	
+	if(slowest < 0)
+	{
+		/* Nobody is reading, the samples are discarded */
+		*tail = r->head;
+	}
+	
+	return(slowest);
+}
+
+static int16_t *_audio_ring_back(_audio_ring_t *r, int *samples)
+{
+	uint32_t head = r->head;
+	uint32_t tail;
+	int slowest;
+	
+	/* Wait for space in the ring */
+	while((slowest = _audio_ring_slowest(r, &tail)) >= 0 && tail + AUDIO_RING_LENGTH == head)
+	{
+		if(__atomic_load_n(&r->abort, __ATOMIC_SEQ_CST))
+		{
+			return(NULL);
+		}
+		
+		_audio_ring_sleep(r, &r->tail[slowest], tail);
+	}
+	
+	/* Return the free space up to the end of the buffer */
+	*samples = tail + AUDIO_RING_LENGTH - head;
+	head &= AUDIO_RING_LENGTH - 1;
+	
+	if(*samples > AUDIO_RING_LENGTH - head)
+	{
+		*samples = AUDIO_RING_LENGTH - head;
+	}
+	
+	return(&r->data[head * 2]);
+}
+
+static void _audio_ring_commit(_audio_ring_t *r, int samples)
+{
+	__atomic_store_n(&r->head, r->head + samples, __ATOMIC_SEQ_CST);
+	_audio_ring_wake(r);
+}
+
+static int16_t *_audio_ring_read(_audio_ring_t *r, int reader, size_t *samples)
+{
+	uint32_t tail = r->tail[reader];
+	uint32_t head;
+	
+	/* Release the samples returned by the last call */
+	if(r->pending[reader])
+	{
+		tail += r->pending[reader];
+		r->pending[reader] = 0;
+		
+		__atomic_store_n(&r->tail[reader], tail, __ATOMIC_SEQ_CST);
+		_audio_ring_wake(r);
+	}
+	
+	/* Wait for samples, or the end of the stream once the ring is empty */
+	while((head = __atomic_load_n(&r->head, __ATOMIC_SEQ_CST)) == tail)
+	{
+		if(__atomic_load_n(&r->abort, __ATOMIC_SEQ_CST) ||
+		   __atomic_load_n(&r->eof, __ATOMIC_SEQ_CST))
+		{
+			return(NULL);
+		}
+		
+		_audio_ring_sleep(r, &r->head, head);
+	}
+	
+	/* Return the samples up to the end of the buffer */
+	r->pending[reader] = head - tail;
+	tail &= AUDIO_RING_LENGTH - 1;
+	
+	if(r->pending[reader] > AUDIO_RING_LENGTH - tail)
+	{
+		r->pending[reader] = AUDIO_RING_LENGTH - tail;
+	}
+	
+	*samples = r->pending[reader];
+	
+	return(&r->data[tail * 2]);
+}
+
 static void *_input_thread(void *arg)
 {
 	av_ffmpeg_t *av = (av_ffmpeg_t *) arg;
@@ -467,6 +766,8 @@ static void *_input_thread(void *arg)
 	
 	//fprintf(stderr, "_input_thread(): Starting\n");
 	
+	rt_thread(RT_DECODER);
+	
 	/* Fetch packets from the source */
 	while(av->thread_abort == 0)
 	{
@@ -599,6 +900,8 @@ static void *_video_decode_thread(void *arg)
 	
 	//fprintf(stderr, "_video_decode_thread(): Starting\n");
 	
+	rt_thread(RT_DECODER);
+	
 	frame = av_frame_alloc();
 	
 	/* Fetch video packets from the queue and decode */
@@ -667,16 +970,132 @@ static void *_video_decode_thread(void *arg)
 	return(NULL);
 }
 
+static int _video_frame_matches(av_ffmpeg_t *av, const AVFrame *frame)
+{
+	/* Test if the decoded frame can be used without scaling */
+	if(frame->width != av->width ||
+	   frame->height != av->height)
+	{
+		return(0);
+	}
+	
+	if(av->yiq)
+	{
+		return(frame->format == AV_PIX_FMT_YUVJ444P ||
+		      (frame->format == AV_PIX_FMT_YUV444P && frame->color_range == AVCOL_RANGE_JPEG));
+	}
+	
+	return(frame->format == AV_PIX_FMT_RGB32 ||
+	       frame->format == AV_PIX_FMT_0RGB32);
+}
+
+static int _video_frame_overlays(av_ffmpeg_t *av)
+{
+	/* Anything drawn over the video needs a private copy of the frame */
+	return(av->logo.logo || av->font[1] || av->s->conf.subtitles);
+}
+
+static void _video_out_buffer_free(void *opaque, uint8_t *data)
+{
+	huge_free(data);
+}
+
+/* The output frames are read a line at a time by the raster,
+ * keep them in huge pages where possible */
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(57, 0, 0)
+static AVBufferRef *_video_out_buffer_alloc(size_t size)
+#else
+static AVBufferRef *_video_out_buffer_alloc(int size)
+#endif
+{
+	AVBufferRef *buf;
+	uint8_t *data;
+	
+	data = huge_alloc(size);
+	if(data == NULL)
+	{
+		return(NULL);
+	}
+	
+	buf = av_buffer_create(data, size, _video_out_buffer_free, NULL, 0);
+	if(buf == NULL)
+	{
+		huge_free(data);
+	}
+	
+	return(buf);
+}
+
+static int _video_out_frame_alloc(av_ffmpeg_t *av, AVFrame *oframe)
+{
+	int linesize = av_image_get_linesize(av->out_pix_fmt, av->width, 0);
+	int planes = av->yiq ? 3 : 1;
+	int i;
+	
+	av_frame_unref(oframe);
+	
+	oframe->buf[0] = av_buffer_pool_get(av->out_pool);
+	if(oframe->buf[0] == NULL)
+	{
+		return(AVERROR(ENOMEM));
+	}
+	
+	oframe->format = av->out_pix_fmt;
+	oframe->width = av->width;
+	oframe->height = av->height;
+	
+	/* The raster expects unpadded lines. YUV444P16 is used
+	 * as a container for the Y, I and Q planes */
+	for(i = 0; i < planes; i++)
+	{
+		oframe->data[i] = oframe->buf[0]->data + i * linesize * av->height;
+		oframe->linesize[i] = linesize;
+	}
+	
+	return(0);
+}
+
+static void _video_publish(av_ffmpeg_t *av, AVFrame *oframe)
+{
+	AVFrame *frame;
+	int i;
+	
+	/* Pass a reference to the new frame to every subscriber, or
+	 * have them repeat the previous one if oframe is NULL. This
+	 * waits for the slowest. Closed subscribers return at once */
+	for(i = 0; i < av->subscribers; i++)
+	{
+		if(oframe != NULL)
+		{
+			frame = _frame_dbuffer_back_buffer(&av->sub[i].out_video_buffer);
+			av_frame_unref(frame);
+			av_frame_ref(frame, oframe);
+		}
+		
+		_frame_dbuffer_ready(&av->sub[i].out_video_buffer, oframe == NULL);
+	}
+	
+	/* Drop the scaler's own reference, so the frame is only
+	 * writable again by a subscriber that has it to itself */
+	if(oframe != NULL)
+	{
+		av_frame_unref(oframe);
+	}
+}
+
 static void *_video_scaler_thread(void *arg)
 {
 	av_ffmpeg_t *av = (av_ffmpeg_t *) arg;
 	AVFrame *frame, *oframe;
 	AVRational ratio;
 	int64_t pts;
+	int i;
 	
 	/* Temp hack */
 	char current_text[256];
 	
+	rt_thread(RT_DECODER);
+	
 	/* Fetch video frames and pass them through the scaler */
 	while((frame = _frame_dbuffer_flip(&av->in_video_buffer)) != NULL)
 	{
@@ -697,23 +1116,90 @@ static void *_video_scaler_thread(void *arg)
 			while(pts > 0)
 			{
 				/* This frame is in the future. Repeat the previous one */
-				_frame_dbuffer_ready(&av->out_video_buffer, 1);
+				_video_publish(av, NULL);
 				av->video_start_time++;
 				pts--;
 			}
 		}
 
-		oframe = _frame_dbuffer_back_buffer(&av->out_video_buffer);
+		oframe = av->out_frame;
 		
-		sws_scale(
-			av->sws_ctx,
-			(uint8_t const * const *) frame->data,
-			frame->linesize,
-			0,
-			av->video_codec_ctx->height,
-			oframe->data,
-			oframe->linesize
-		);
+		if(!av->yiq &&
+		   _video_frame_matches(av, frame) &&
+		   frame->linesize[0] == av->width * sizeof(uint32_t) &&
+		   !_video_frame_overlays(av))
+		{
+			/* The frame is already in the output format and
+			 * nothing is drawn on it, pass it through by reference */
+			av_frame_unref(oframe);
+			av_frame_ref(oframe, frame);
+		}
+		else if(_video_out_frame_alloc(av, oframe) < 0)
+		{
+			/* Out of memory, drop this frame */
+			av_frame_unref(frame);
+			continue;
+		}
+		else if(av->yiq)
+		{
+			const uint8_t * const *data = (const uint8_t * const *) frame->data;
+			const int *linesize = frame->linesize;
+			int y;
+			
+			/* Full range 4:4:4 frames of the right size can be
+			 * converted directly, everything else is scaled first */
+			if(!_video_frame_matches(av, frame))
+			{
+				sws_scale(
+					av->sws_ctx,
+					(uint8_t const * const *) frame->data,
+					frame->linesize,
+					0,
+					av->video_codec_ctx->height,
+					av->yuv_data,
+					av->yuv_linesize
+				);
+				
+				data = (const uint8_t * const *) av->yuv_data;
+				linesize = av->yuv_linesize;
+			}
+			
+			for(y = 0; y < av->height; y++)
+			{
+				vid_yuv_to_yiq(
+					av->s,
+					(int16_t *) (oframe->data[0] + y * oframe->linesize[0]),
+					(int16_t *) (oframe->data[1] + y * oframe->linesize[1]),
+					(int16_t *) (oframe->data[2] + y * oframe->linesize[2]),
+					data[0] + y * linesize[0],
+					data[1] + y * linesize[1],
+					data[2] + y * linesize[2],
+					av->width
+				);
+			}
+		}
+		else if(_video_frame_matches(av, frame))
+		{
+			/* Copy the frame, re-pitching the lines if needed */
+			av_image_copy_plane(
+				oframe->data[0], oframe->linesize[0],
+				frame->data[0], frame->linesize[0],
+				av->width * sizeof(uint32_t),
+				av->height
+			);
+		}
+		else
+		{
+			sws_scale(
+				av->sws_ctx,
+				(uint8_t const * const *) frame->data,
+				frame->linesize,
+				0,
+				av->video_codec_ctx->height,
+				oframe->data,
+				oframe->linesize
+			);
+		}
 		
 		ratio = frame->sample_aspect_ratio;
 		
@@ -733,13 +1219,13 @@ static void *_video_scaler_thread(void *arg)
 		);
 		
 		/* Print logo, if enabled */
-		if(av->s->conf.logo)
+		if(av->logo.logo)
 		{
-			overlay_image((uint32_t *) oframe->data[0], &av->s->vid_logo, av->s->active_width, av->s->conf.active_lines, av->s->vid_logo.position);
+			overlay_image((uint32_t *) oframe->data[0], &av->logo, av->s->active_width, av->s->conf.active_lines, av->logo.position);
 		}
 		
 		/* Overlay timestamp, if enabled */
-		if(av->s->conf.timestamp)
+		if(av->font[1])
 		{
 			char timestr[200];
 			int sec, h, m, s;
@@ -780,20 +1266,23 @@ static void *_video_scaler_thread(void *arg)
 		
 		av_frame_unref(frame);
 		
-		_frame_dbuffer_ready(&av->out_video_buffer, 0);
+		_video_publish(av, oframe);
 		av->video_start_time++;
 	}
 	
-	_frame_dbuffer_abort(&av->out_video_buffer);
+	for(i = 0; i < av->subscribers; i++)
+	{
+		_frame_dbuffer_abort(&av->sub[i].out_video_buffer);
+	}
 	
 	// fprintf(stderr, "_video_scaler_thread(): Ending\n");
 	
 	return(NULL);
 }
 
-static uint32_t *_av_ffmpeg_read_video(void *private, float *ratio)
+static AVFrame *_av_ffmpeg_read_frame(_av_subscriber_t *sub, float *ratio)
 {
-	av_ffmpeg_t *av = private;
+	av_ffmpeg_t *av = sub->av;
 	AVFrame *frame;
 	int nav = 0;
 	
@@ -801,9 +1290,10 @@ static uint32_t *_av_ffmpeg_read_video(void *private, float *ratio)
 	{
 		return(NULL);
 	}
-
-	kb_enable();
-	if(kbhit())
+	
+	/* Only the first pipeline takes keyboard commands */
+	if(sub->index == 0) kb_enable();
+	if(sub->index == 0 && kbhit())
 	{
 		#ifndef WIN32
 		char c = getchar();
@@ -841,7 +1331,7 @@ static uint32_t *_av_ffmpeg_read_video(void *private, float *ratio)
 				break;
 		}
 	}
-	kb_disable();
+	if(sub->index == 0) kb_disable();
 
 	if(nav == AVSEEK_FWD || nav == AVSEEK_RWD)
 	{
@@ -852,26 +1342,26 @@ static uint32_t *_av_ffmpeg_read_video(void *private, float *ratio)
 	
 	if(av->paused) 
 	{
-		frame = av->out_video_buffer.frame[0];
+		frame = sub->out_video_buffer.frame[0];
 		
-		overlay_image((uint32_t *) frame->data[0], &av->s->media_icons[1], av->s->active_width, av->s->conf.active_lines, IMG_POS_MIDDLE);
+		if(frame != NULL && !av->yiq && av_frame_is_writable(frame)) overlay_image((uint32_t *) frame->data[0], &av->media_icons[1], av->width, av->height, IMG_POS_MIDDLE);
 		av->last_paused = time(0);
 	}
 	else
 	{
-		frame = _frame_dbuffer_flip(&av->out_video_buffer);
+		frame = _frame_dbuffer_flip(&sub->out_video_buffer);
 
 		/* Show 'play' icon for 5 seconds after resuming play */
-		if(time(0) - av->last_paused < 5)
+		if(frame != NULL && !av->yiq && av_frame_is_writable(frame) && time(0) - av->last_paused < 5)
 		{
-			overlay_image((uint32_t *) frame->data[0], &av->s->media_icons[0], av->s->active_width, av->s->conf.active_lines, IMG_POS_MIDDLE);
+			overlay_image((uint32_t *) frame->data[0], &av->media_icons[0], av->width, av->height, IMG_POS_MIDDLE);
 		}
 	}
 
 	if(!frame)
 	{
 		/* EOF or abort */
-		av->video_eof = 1;
+		sub->video_eof = 1;
 		return(NULL);
 	}
 	
@@ -898,15 +1388,46 @@ static uint32_t *_av_ffmpeg_read_video(void *private, float *ratio)
 		
 	}
 	
+	return(frame);
+}
+
+static uint32_t *_av_ffmpeg_read_video(void *private, float *ratio)
+{
+	_av_subscriber_t *sub = private;
+	av_ffmpeg_t *av = sub->av;
+	AVFrame *frame = _av_ffmpeg_read_frame(sub, ratio);
+	
+	if(!frame)
+	{
+		return(NULL);
+	}
+	
 	/* Print logo, if enabled */
-	if(av->s->conf.logo)
+	if(av->logo.logo)
 	{
-		overlay_image((uint32_t *) frame->data[0], &av->s->vid_logo, av->s->active_width, av->s->conf.active_lines, av->s->vid_logo.position);
+		overlay_image((uint32_t *) frame->data[0], &av->logo, sub->s->active_width, sub->s->conf.active_lines, av->logo.position);
 	}
 	
 	return ((uint32_t *) frame->data[0]);
 }
 
+static const vid_yiq_frame_t *_av_ffmpeg_read_yiq(void *private, float *ratio)
+{
+	_av_subscriber_t *sub = private;
+	AVFrame *frame = _av_ffmpeg_read_frame(sub, ratio);
+	
+	if(!frame)
+	{
+		return(NULL);
+	}
+	
+	sub->yiq_frame.y = (const int16_t *) frame->data[0];
+	sub->yiq_frame.i = (const int16_t *) frame->data[1];
+	sub->yiq_frame.q = (const int16_t *) frame->data[2];
+	
+	return(&sub->yiq_frame);
+}
+
 static void *_audio_decode_thread(void *arg)
 {
 	/* TODO: This function is virtually identical to _video_decode_thread(),
@@ -918,6 +1439,8 @@ static void *_audio_decode_thread(void *arg)
 	
 	//fprintf(stderr, "_audio_decode_thread(): Starting\n");
 	
+	rt_thread(RT_DECODER);
+	
 	frame = av_frame_alloc();
 	
 	/* Fetch audio packets from the queue and decode */
@@ -979,16 +1502,87 @@ static void *_audio_decode_thread(void *arg)
 	return(NULL);
 }
 
+static int64_t _audio_position(av_ffmpeg_t *av)
+{
+	/* The input sample due next from the resampler, going by the
+	 * number of samples output so far and those still buffered */
+	return(
+		av->audio_start_time +
+		av_rescale(av->audio_out_samples, av->audio_time_base.den, HACKTV_AUDIO_SAMPLE_RATE) +
+		swr_get_delay(av->swr_ctx, av->audio_time_base.den)
+	);
+}
+
+static void _audio_compensate(av_ffmpeg_t *av, int64_t pts, int nb_samples)
+{
+	int64_t delta;
+	int64_t limit = (int64_t) nb_samples * AUDIO_MAX_CORRECTION / 100;
+	int deadband = av->audio_time_base.den / 1000;
+	
+	/* Smooth out the jitter in the timestamps */
+	av->audio_drift = av->audio_drift * 0.95 + pts * 0.05;
+	
+	/* Ignore anything under 1ms */
+	delta = llround(av->audio_drift);
+	if(delta > -deadband && delta < deadband) delta = 0;
+	
+	if(delta < -limit) delta = -limit;
+	else if(delta > limit) delta = limit;
+	
+	/* Stretch or squeeze the resampled audio over the length of this frame */
+	swr_set_compensation(
+		av->swr_ctx,
+		av_rescale(delta, HACKTV_AUDIO_SAMPLE_RATE, av->audio_time_base.den),
+		av_rescale(nb_samples, HACKTV_AUDIO_SAMPLE_RATE, av->audio_time_base.den)
+	);
+}
+
+static void _audio_discontinuity(av_ffmpeg_t *av)
+{
+	/* The drift measured before a gap or a jump in the timestamps
+	 * says nothing about the audio after it. Start again from zero */
+	av->audio_drift = 0;
+	swr_set_compensation(av->swr_ctx, 0, 0);
+}
+
+static void _audio_resample(av_ffmpeg_t *av, const uint8_t **data, int count)
+{
+	int16_t *out;
+	int r, n;
+	
+	/* Resample straight into the ring. The input is passed again with
+	 * a zero count to drain the resampler. A NULL input flushes it */
+	while((out = _audio_ring_back(&av->audio_ring, &n)) != NULL)
+	{
+		r = swr_convert(
+			av->swr_ctx,
+			(uint8_t **) &out,
+			n,
+			data,
+			count
+		);
+		if(r < 0) break;
+		
+		_audio_ring_commit(&av->audio_ring, r);
+		av->audio_out_samples += r;
+		count = 0;
+		
+		if(r < n) break;
+	}
+}
+
 static void *_audio_scaler_thread(void *arg)
 {
 	av_ffmpeg_t *av = (av_ffmpeg_t *) arg;
-	AVFrame *frame, *oframe;
+	AVFrame *frame;
 	int64_t pts, next_pts;
 	uint8_t const *data[AV_NUM_DATA_POINTERS];
-	int r, count, drop;
+	int count, drop;
 	
 	//fprintf(stderr, "_audio_scaler_thread(): Starting\n");
 	
+	rt_thread(RT_DECODER);
+	
 	/* Fetch audio frames and pass them through the resampler */
 	while((frame = _frame_dbuffer_flip(&av->in_audio_buffer)) != NULL)
 	{
@@ -998,12 +1592,13 @@ static void *_audio_scaler_thread(void *arg)
 		if(pts != AV_NOPTS_VALUE)
 		{
 			pts      = av_rescale_q(pts, av->audio_stream->time_base, av->audio_time_base);
-			pts     -= av->audio_start_time;
+			pts     -= _audio_position(av);
 			next_pts = pts + frame->nb_samples;
 			
 			if(next_pts <= 0)
 			{
 				/* This frame is in the past. Skip it */
+				_audio_discontinuity(av);
 				av_frame_unref(frame);
 				continue;
 			}
@@ -1011,14 +1606,21 @@ static void *_audio_scaler_thread(void *arg)
 			if(pts < -av->allowed_error)
 			{
 				/* Trim this frame */
+				_audio_discontinuity(av);
 				drop = -pts;
 				//swr_drop_input(av->swr_ctx, -pts); /* It would be nice if this existed */
 			}
 			else if(pts > av->allowed_error)
 			{
 				/* This frame is in the future. Send silence to fill the gap */
-				r = swr_inject_silence(av->swr_ctx, pts);
-				av->audio_start_time += pts;
+				_audio_discontinuity(av);
+				swr_inject_silence(av->swr_ctx, pts);
+			}
+			else
+			{
+				/* Small errors are drift between the source and the
+				 * RF sample clock, corrected by resampling */
+				_audio_compensate(av, pts, frame->nb_samples);
 			}
 		}
 		
@@ -1043,31 +1645,15 @@ static void *_audio_scaler_thread(void *arg)
 		);
 #endif
 		
-		do
-		{
-			oframe = _frame_dbuffer_back_buffer(&av->out_audio_buffer);
-			r = swr_convert(
-				av->swr_ctx,
-				oframe->data,
-				av->out_frame_size,
-				count ? data : NULL,
-				count
-			);
-			if(r == 0) break;
-			
-			oframe->nb_samples = r;
-			
-			_frame_dbuffer_ready(&av->out_audio_buffer, 0);
-			
-			av->audio_start_time += count;
-			count = 0;
-		}
-		while(r > 0);
+		_audio_resample(av, data, count);
 		
 		av_frame_unref(frame);
 	}
 	
-	_frame_dbuffer_abort(&av->out_audio_buffer);
+	/* Flush the samples still held in the resampler's filter */
+	_audio_resample(av, NULL, 0);
+	
+	_audio_ring_end(&av->audio_ring, 0);
 	
 	//fprintf(stderr, "_audio_scaler_thread(): Ending\n");
 	
@@ -1076,33 +1662,33 @@ static void *_audio_scaler_thread(void *arg)
 
 static int16_t *_av_ffmpeg_read_audio(void *private, size_t *samples)
 {
-	av_ffmpeg_t *av = private;
-	AVFrame *frame;
+	_av_subscriber_t *sub = private;
+	av_ffmpeg_t *av = sub->av;
+	int16_t *data;
 	
 	if(av->audio_stream == NULL || av->paused)
 	{
 		return(NULL);
 	}
 	
-	frame = _frame_dbuffer_flip(&av->out_audio_buffer);
-	if(!frame)
+	data = _audio_ring_read(&av->audio_ring, sub->index, samples);
+	if(!data)
 	{
 		/* EOF or abort */
-		av->audio_eof = 1;
+		sub->audio_eof = 1;
 		return(NULL);
 	}
 	
-	*samples = frame->nb_samples;
-	
-	return((int16_t *) frame->data[0]);
+	return(data);
 }
 
 static int _av_ffmpeg_eof(void *private)
 {
-	av_ffmpeg_t *av = private;
+	_av_subscriber_t *sub = private;
+	av_ffmpeg_t *av = sub->av;
 	
-	if((av->video_stream && !av->video_eof) ||
-	   (av->audio_stream && !av->audio_eof))
+	if((av->video_stream && !sub->video_eof) ||
+	   (av->audio_stream && !sub->audio_eof))
 	{
 		return(0);
 	}
@@ -1112,7 +1698,26 @@ static int _av_ffmpeg_eof(void *private)
 
 static int _av_ffmpeg_close(void *private)
 {
-	av_ffmpeg_t *av = private;
+	_av_subscriber_t *sub = private;
+	av_ffmpeg_t *av = sub->av;
+	int i;
+	
+	/* Let any other pipelines carry on without this one. The
+	 * decoder is only stopped once the last of them has closed */
+	if(av->video_stream != NULL)
+	{
+		_frame_dbuffer_abort(&sub->out_video_buffer);
+	}
+	
+	if(av->audio_stream != NULL)
+	{
+		_audio_ring_leave(&av->audio_ring, sub->index);
+	}
+	
+	if(__atomic_sub_fetch(&av->open_subscribers, 1, __ATOMIC_SEQ_CST) > 0)
+	{
+		return(HACKTV_OK);
+	}
 	
 	av->thread_abort = 1;
 	_packet_queue_abort(av, &av->video_queue);
@@ -1123,17 +1728,24 @@ static int _av_ffmpeg_close(void *private)
 	if(av->video_stream != NULL)
 	{
 		_frame_dbuffer_abort(&av->in_video_buffer);
-		_frame_dbuffer_abort(&av->out_video_buffer);
 		
 		pthread_join(av->video_decode_thread, NULL);
 		pthread_join(av->video_scaler_thread, NULL);
 		
-		_packet_queue_free(av, &av->video_queue);
 		_frame_dbuffer_free(&av->in_video_buffer);
 		
-		av_freep(&av->out_video_buffer.frame[0]->data[0]);
-		av_freep(&av->out_video_buffer.frame[1]->data[0]);
-		_frame_dbuffer_free(&av->out_video_buffer);
+		for(i = 0; i < av->subscribers; i++)
+		{
+			_frame_dbuffer_free(&av->sub[i].out_video_buffer);
+		}
+		
+		av_frame_free(&av->out_frame);
+		av_buffer_pool_uninit(&av->out_pool);
+		
+		if(av->yiq)
+		{
+			av_freep(&av->yuv_data[0]);
+		}
 		
 		avcodec_free_context(&av->video_codec_ctx);
 		sws_freeContext(av->sws_ctx);
@@ -1142,17 +1754,14 @@ static int _av_ffmpeg_close(void *private)
 	if(av->audio_stream != NULL)
 	{
 		_frame_dbuffer_abort(&av->in_audio_buffer);
-		_frame_dbuffer_abort(&av->out_audio_buffer);
+		_audio_ring_end(&av->audio_ring, 1);
 		
 		pthread_join(av->audio_decode_thread, NULL);
 		pthread_join(av->audio_scaler_thread, NULL);
 		
-		_packet_queue_free(av, &av->audio_queue);
 		_frame_dbuffer_free(&av->in_audio_buffer);
 		
-		//av_freep(&av->out_audio_buffer.frame[0]->data[0]);
-		//av_freep(&av->out_audio_buffer.frame[1]->data[0]);
-		_frame_dbuffer_free(&av->out_audio_buffer);
+		_audio_ring_free(&av->audio_ring);
 		
 		avcodec_free_context(&av->audio_codec_ctx);
 		swr_free(&av->swr_ctx);
@@ -1160,16 +1769,39 @@ static int _av_ffmpeg_close(void *private)
 	
 	avformat_close_input(&av->format_ctx);
 	
-	pthread_cond_destroy(&av->cond);
-	pthread_mutex_destroy(&av->mutex);
+	_packet_queue_free(av, &av->video_queue);
+	_packet_queue_free(av, &av->audio_queue);
+	
+	for(i = 0; i < 10; i++)
+	{
+		font_free(av->font[i]);
+	}
+	
+	free_png(&av->logo);
+	free_png(&av->media_icons[0]);
+	free_png(&av->media_icons[1]);
 	
 	free(av);
 	
 	return(HACKTV_OK);
 }
 
-int av_ffmpeg_open(vid_t *s, char *input_url, char *format, char *options)
+int av_ffmpeg_parse_scaler(const char *name)
+{
+	if(name == NULL) return(SWS_BICUBIC);
+	else if(strcmp(name, "bicubic") == 0) return(SWS_BICUBIC);
+	else if(strcmp(name, "bilinear") == 0) return(SWS_BILINEAR);
+	else if(strcmp(name, "fast-bilinear") == 0) return(SWS_FAST_BILINEAR);
+	else if(strcmp(name, "area") == 0) return(SWS_AREA);
+	else if(strcmp(name, "point") == 0) return(SWS_POINT);
+	else if(strcmp(name, "lanczos") == 0) return(SWS_LANCZOS);
+	
+	return(-1);
+}
+
+static int _av_ffmpeg_open(vid_t **vids, vid_av_source_t *srcs, int n, char *input_url, char *format, char *options, char *scaler)
 {
+	vid_t *s = vids[0];
 	av_ffmpeg_t *av;
 	const AVInputFormat *fmt = NULL;
 	AVDictionary *opts = NULL;
@@ -1184,6 +1816,12 @@ int av_ffmpeg_open(vid_t *s, char *input_url, char *format, char *options)
 	/* Default ratio */
 	float source_ratio = 4.0 / 3.0;
 	
+	if(av_ffmpeg_parse_scaler(scaler) < 0)
+	{
+		fprintf(stderr, "Unrecognised scaler '%s'.\n", scaler);
+		return(HACKTV_ERROR);
+	}
+	
 	av = calloc(1, sizeof(av_ffmpeg_t));
 	if(!av)
 	{
@@ -1191,6 +1829,7 @@ int av_ffmpeg_open(vid_t *s, char *input_url, char *format, char *options)
 	}
 
 	av->paused = 0;
+	av->sws_flags = av_ffmpeg_parse_scaler(scaler);
 	av->width = s->active_width;
 	av->height = s->conf.active_lines;
 	
@@ -1415,6 +2054,22 @@ int av_ffmpeg_open(vid_t *s, char *input_url, char *format, char *options)
 		
 		/* Video filter ends here */
 		
+		/* Deliver planar YIQ frames if nothing is drawn over the video,
+		 * skipping the conversion to RGB and back. Pipelines can only
+		 * share them if their signal levels match */
+		av->yiq = vid_yiq_frames(s) && !s->conf.logo && !s->conf.timestamp && !s->conf.subtitles;
+		
+		for(i = 1; i < n; i++)
+		{
+			if(!vid_yiq_frames(vids[i]) ||
+			   memcmp(vids[i]->yuv_level_lookup, s->yuv_level_lookup, sizeof(s->yuv_level_lookup)) != 0)
+			{
+				av->yiq = 0;
+			}
+		}
+		
+		av->out_pix_fmt = av->yiq ? AV_PIX_FMT_YUV444P16 : AV_PIX_FMT_RGB32;
+		
 		/* Initialise SWS context for software scaling */
 		av->sws_ctx = sws_getContext(
 			av->video_codec_ctx->width,
@@ -1422,8 +2077,8 @@ int av_ffmpeg_open(vid_t *s, char *input_url, char *format, char *options)
 			av->video_codec_ctx->pix_fmt,
 			s->active_width,
 			s->conf.active_lines,
-			AV_PIX_FMT_RGB32,
-			SWS_BICUBIC,
+			av->yiq ? AV_PIX_FMT_YUV444P : AV_PIX_FMT_RGB32,
+			av->sws_flags,
 			NULL,
 			NULL,
 			NULL
@@ -1434,7 +2089,16 @@ int av_ffmpeg_open(vid_t *s, char *input_url, char *format, char *options)
 			return(HACKTV_OUT_OF_MEMORY);
 		}
 		
-		av->video_eof = 0;
+		if(av->yiq)
+		{
+			int *inv_table, *table;
+			int src_range, dst_range;
+			int brightness, contrast, saturation;
+			
+			/* The level lookup tables expect full range YCbCr */
+			sws_getColorspaceDetails(av->sws_ctx, &inv_table, &src_range, &table, &dst_range, &brightness, &contrast, &saturation);
+			sws_setColorspaceDetails(av->sws_ctx, inv_table, src_range, table, 1, brightness, contrast, saturation);
+		}
 	}
 	else
 	{
@@ -1589,13 +2253,14 @@ int av_ffmpeg_open(vid_t *s, char *input_url, char *format, char *options)
 		av_opt_set_int(av->swr_ctx, "out_sample_rate",       HACKTV_AUDIO_SAMPLE_RATE, 0);
 		av_opt_set_sample_fmt(av->swr_ctx, "out_sample_fmt", AV_SAMPLE_FMT_S16, 0);
 		
+		/* Always resample, so drift compensation can be enabled without reinitialising */
+		av_opt_set_int(av->swr_ctx, "flags", SWR_FLAG_RESAMPLE, 0);
+		
 		if(swr_init(av->swr_ctx) < 0)
 		{
 			fprintf(stderr, "Failed to initialise the resampling context\n");
 			return(HACKTV_ERROR);
 		}
-		
-		av->audio_eof = 0;
 	}
 	else
 	{
@@ -1640,12 +2305,11 @@ int av_ffmpeg_open(vid_t *s, char *input_url, char *format, char *options)
 		if(s->conf.subtitles || s->conf.txsubtitles) subs_init_ffmpeg(s);
 		
 		/* Initialise fonts here */
-		if(font_init(s, 38, source_ratio) !=0)
+		av->font[0] = font_new(s, 38, source_ratio);
+		if(!av->font[0])
 		{
 			return(HACKTV_ERROR);
-		};
-		
-		av->font[0] = s->av_font;
+		}
 	}
 	else
 	{
@@ -1663,14 +2327,13 @@ int av_ffmpeg_open(vid_t *s, char *input_url, char *format, char *options)
 			}
 			
 			/* Initialise fonts here */
-			if(font_init(s, 38, source_ratio) < 0)
+			av->font[0] = font_new(s, 38, source_ratio);
+			if(!av->font[0])
 			{
 				s->conf.subtitles = 0;
 				s->conf.txsubtitles = 0;
 				return(HACKTV_ERROR);
 			}
-			
-			av->font[0] = s->av_font;
 		}
 	}
 	
@@ -1701,16 +2364,12 @@ int av_ffmpeg_open(vid_t *s, char *input_url, char *format, char *options)
 		av->audio_start_time = av_rescale_q(s->conf.position ? request_timestamp : start_time, time_base, av->audio_time_base);
 	}
 	
+	/* The overlays are loaded into this input's own state, never the
+	 * shared video state, which may be in use by the current input. The
+	 * timestamp is left off if its font can't be loaded */
 	if(s->conf.timestamp)
 	{
-		s->conf.timestamp = time(0);
-		
-		if(font_init(s, 40, source_ratio) != VID_OK)
-		{
-			s->conf.timestamp = 0;
-		};
-		
-		av->font[1] = s->av_font;
+		av->font[1] = font_new(s, 40, source_ratio);
 	}
 	
 	/* Calculate ratio */
@@ -1718,62 +2377,94 @@ int av_ffmpeg_open(vid_t *s, char *input_url, char *format, char *options)
 	ratio = s->conf.pillarbox || s->conf.letterbox ? 4.0/3.0 : ratio;
 	if(s->conf.logo)
 	{
-		if(load_png(&s->vid_logo, s->active_width, s->conf.active_lines, s->conf.logo, 0.75, ratio, IMG_LOGO) == HACKTV_ERROR)
+		if(load_png(&av->logo, s->active_width, s->conf.active_lines, s->conf.logo, 0.75, ratio, IMG_LOGO) != HACKTV_OK)
 		{
-			s->conf.logo = NULL;
+			free_png(&av->logo);
 		}
 	}
 	
-	if(load_png(&s->media_icons[0], s->active_width, s->conf.active_lines, "play", 1, ratio, IMG_MEDIA) != HACKTV_OK)
+	/* The pipelines sharing a decoder have the same picture size,
+	 * so one set of icons is used for all of them */
+	if(load_png(&av->media_icons[0], s->active_width, s->conf.active_lines, "play", 1, ratio, IMG_MEDIA) != HACKTV_OK ||
+	   load_png(&av->media_icons[1], s->active_width, s->conf.active_lines, "pause", 1, ratio, IMG_MEDIA) != HACKTV_OK)
 	{
 		fprintf(stderr, "Error loading media icons.\n");
 		return(HACKTV_ERROR);
 	}
 	
-	if(load_png(&s->media_icons[1], s->active_width, s->conf.active_lines, "pause", 1, ratio, IMG_MEDIA) != HACKTV_OK)
-	{
-		fprintf(stderr, "Error loading media icons.\n");
-		return(HACKTV_ERROR);
-	}
-		
-	/* Generic font */
-	if(font_init(s, 56, source_ratio) == VID_OK)
+	/* Register the callback functions for each pipeline */
+	av->s = s;
+	av->subscribers = n;
+	av->open_subscribers = n;
+	
+	for(i = 0; i < n; i++)
 	{
-		av->font[2] = s->av_font;
-	};
+		av->sub[i].av = av;
+		av->sub[i].s = vids[i];
+		av->sub[i].index = i;
 		
-	/* Register the callback functions */
-	av->s = s;
-	s->av_private = av;
-	s->av_read_video = _av_ffmpeg_read_video;
-	s->av_read_audio = _av_ffmpeg_read_audio;
-	s->av_eof = _av_ffmpeg_eof;
-	s->av_close = _av_ffmpeg_close;
+		memset(&srcs[i], 0, sizeof(vid_av_source_t));
+		srcs[i].private = &av->sub[i];
+		if(av->yiq)
+		{
+			srcs[i].read_yiq = _av_ffmpeg_read_yiq;
+		}
+		else
+		{
+			srcs[i].read_video = _av_ffmpeg_read_video;
+		}
+		srcs[i].read_audio = _av_ffmpeg_read_audio;
+		srcs[i].eof = _av_ffmpeg_eof;
+		srcs[i].close = _av_ffmpeg_close;
+	}
 	
 	/* Start the threads */
 	av->thread_abort = 0;
-	pthread_mutex_init(&av->mutex, NULL);
-	pthread_cond_init(&av->cond, NULL);
-	_packet_queue_init(av, &av->video_queue);
-	_packet_queue_init(av, &av->audio_queue);
+	if(_packet_queue_init(av, &av->video_queue) != 0 ||
+	   _packet_queue_init(av, &av->audio_queue) != 0)
+	{
+		return(HACKTV_OUT_OF_MEMORY);
+	}
 	
 	if(av->video_stream != NULL)
 	{
 		_frame_dbuffer_init(&av->in_video_buffer);
-		_frame_dbuffer_init(&av->out_video_buffer);
+		
+		av->out_frame = av_frame_alloc();
+		av->out_pool = av_buffer_pool_init(
+			av_image_get_linesize(av->out_pix_fmt, av->width, 0) * av->height * (av->yiq ? 3 : 1),
+			_video_out_buffer_alloc
+		);
+		
+		if(!av->out_frame || !av->out_pool)
+		{
+			return(HACKTV_OUT_OF_MEMORY);
+		}
 		
 		/* Allocate memory for the output frame buffers */
-		for(i = 0; i < 2; i++)
+		for(i = 0; i < n; i++)
+		{
+			if(_frame_dbuffer_init(&av->sub[i].out_video_buffer) != 0 ||
+			   _video_out_frame_alloc(av, av->sub[i].out_video_buffer.frame[0]) < 0 ||
+			   _video_out_frame_alloc(av, av->sub[i].out_video_buffer.frame[1]) < 0)
+			{
+				return(HACKTV_OUT_OF_MEMORY);
+			}
+		}
+		
+		if(av->yiq)
 		{
-			av->out_video_buffer.frame[i]->width = s->active_width;
-			av->out_video_buffer.frame[i]->height = s->conf.active_lines;
-			
 			r = av_image_alloc(
-				av->out_video_buffer.frame[i]->data,
-				av->out_video_buffer.frame[i]->linesize,
+				av->yuv_data,
+				av->yuv_linesize,
 				s->active_width, s->conf.active_lines,
-				AV_PIX_FMT_RGB32, 1
+				AV_PIX_FMT_YUV444P, 1
 			);
+			
+			if(r < 0)
+			{
+				return(HACKTV_OUT_OF_MEMORY);
+			}
 		}
 		
 		r = pthread_create(&av->video_decode_thread, NULL, &_video_decode_thread, (void *) av);
@@ -1793,41 +2484,14 @@ int av_ffmpeg_open(vid_t *s, char *input_url, char *format, char *options)
 	if(av->audio_stream != NULL)
 	{
 		_frame_dbuffer_init(&av->in_audio_buffer);
-		_frame_dbuffer_init(&av->out_audio_buffer);
-		
-		/* Calculate the number of samples needed for output */
-		av->out_frame_size = av_rescale_rnd(
-			av->audio_codec_ctx->frame_size, /* Can this be trusted? */
-			HACKTV_AUDIO_SAMPLE_RATE,
-			av->audio_codec_ctx->sample_rate,
-			AV_ROUND_UP
-		);
-		
-		if(av->out_frame_size <= 0)
-		{
-			av->out_frame_size = HACKTV_AUDIO_SAMPLE_RATE;
-		}
 		
 		/* Calculate the allowed error in input samples, +/- 20ms */
 		av->allowed_error = av_rescale_q(AV_TIME_BASE * 0.020, AV_TIME_BASE_Q, av->audio_time_base);
 		
-		for(i = 0; i < 2; i++)
+		if(_audio_ring_init(&av->audio_ring, n) != 0)
 		{
-			av->out_audio_buffer.frame[i]->format = AV_SAMPLE_FMT_S16;
-#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(59, 24, 100)
-			av->out_audio_buffer.frame[i]->ch_layout.nb_channels = AV_CH_LAYOUT_STEREO;
-#else
-			av->out_audio_buffer.frame[i]->channel_layout = AV_CH_LAYOUT_STEREO;
-#endif
-			av->out_audio_buffer.frame[i]->sample_rate = HACKTV_AUDIO_SAMPLE_RATE;
-			av->out_audio_buffer.frame[i]->nb_samples = av->out_frame_size;
-			
-			r = av_frame_get_buffer(av->out_audio_buffer.frame[i], 0);
-			if(r < 0)
-			{
-				fprintf(stderr, "Error allocating output audio buffer %d\n", i);
-				return(HACKTV_OUT_OF_MEMORY);
-			}
+			fprintf(stderr, "Error allocating output audio buffer\n");
+			return(HACKTV_OUT_OF_MEMORY);
 		}
 		
 		r = pthread_create(&av->audio_decode_thread, NULL, &_audio_decode_thread, (void *) av);
@@ -1855,6 +2519,101 @@ int av_ffmpeg_open(vid_t *s, char *input_url, char *format, char *options)
 	return(HACKTV_OK);
 }
 
+static int _av_ffmpeg_shareable(vid_t *a, vid_t *b)
+{
+	/* Pipelines can share a decoder if they want the same picture at
+	 * the same rate, and nothing is drawn over it or read from it */
+	if(a->conf.logo || a->conf.timestamp || a->conf.subtitles || a->conf.txsubtitles ||
+	   b->conf.logo || b->conf.timestamp || b->conf.subtitles || b->conf.txsubtitles)
+	{
+		return(0);
+	}
+	
+	return(a->active_width == b->active_width &&
+	       a->conf.active_lines == b->conf.active_lines &&
+	       a->conf.frame_rate_num == b->conf.frame_rate_num &&
+	       a->conf.frame_rate_den == b->conf.frame_rate_den &&
+	       a->conf.interlace == b->conf.interlace &&
+	       a->conf.letterbox == b->conf.letterbox &&
+	       a->conf.pillarbox == b->conf.pillarbox &&
+	       a->conf.position == b->conf.position &&
+	       a->conf.volume == b->conf.volume &&
+	       a->conf.downmix == b->conf.downmix &&
+	       a->audio == b->audio);
+}
+
+int av_ffmpeg_open_shared(vid_t **vids, vid_av_source_t *srcs, int n, char *input_url, char *format, char *options, char *scaler)
+{
+	vid_t *group[MAX_SUBSCRIBERS];
+	vid_av_source_t group_srcs[MAX_SUBSCRIBERS];
+	int index[MAX_SUBSCRIBERS];
+	int i, j, m;
+	int r;
+	
+	memset(srcs, 0, sizeof(vid_av_source_t) * n);
+	
+	for(i = 0; i < n; i++)
+	{
+		if(srcs[i].close != NULL)
+		{
+			/* Already sharing an earlier pipeline's decoder */
+			continue;
+		}
+		
+		/* Gather the pipelines that can share this one's decoder */
+		for(m = 0, j = i; j < n && m < MAX_SUBSCRIBERS; j++)
+		{
+			if(srcs[j].close == NULL && (j == i || _av_ffmpeg_shareable(vids[i], vids[j])))
+			{
+				group[m] = vids[j];
+				index[m++] = j;
+			}
+		}
+		
+		r = _av_ffmpeg_open(group, group_srcs, m, input_url, format, options, scaler);
+		
+		if(r != HACKTV_OK)
+		{
+			for(j = 0; j < n; j++)
+			{
+				if(srcs[j].close != NULL)
+				{
+					srcs[j].close(srcs[j].private);
+				}
+			}
+			
+			return(r);
+		}
+		
+		for(j = 0; j < m; j++)
+		{
+			srcs[index[j]] = group_srcs[j];
+		}
+	}
+	
+	return(HACKTV_OK);
+}
+
+int av_ffmpeg_open_source(vid_t *s, vid_av_source_t *src, char *input_url, char *format, char *options, char *scaler)
+{
+	return(_av_ffmpeg_open(&s, src, 1, input_url, format, options, scaler));
+}
+
+int av_ffmpeg_open(vid_t *s, char *input_url, char *format, char *options, char *scaler)
+{
+	vid_av_source_t src;
+	int r;
+	
+	r = av_ffmpeg_open_source(s, &src, input_url, format, options, scaler);
+	
+	if(r == HACKTV_OK)
+	{
+		vid_av_attach(s, &src);
+	}
+	
+	return(r);
+}
+
 void av_ffmpeg_init(void)
 {
 #if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(58, 9, 100)
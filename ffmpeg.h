@@ -18,7 +18,10 @@
 #ifndef _FFMPEG_H
 #define _FFMPEG_H
 
-extern int av_ffmpeg_open(vid_t *s, char *input_url, char *format, char *options);
+extern int av_ffmpeg_open(vid_t *s, char *input_url, char *format, char *options, char *scaler);
+extern int av_ffmpeg_open_source(vid_t *s, vid_av_source_t *src, char *input_url, char *format, char *options, char *scaler);
+extern int av_ffmpeg_open_shared(vid_t **vids, vid_av_source_t *srcs, int n, char *input_url, char *format, char *options, char *scaler);
+extern int av_ffmpeg_parse_scaler(const char *name);
 extern void av_ffmpeg_init(void);
 extern void av_ffmpeg_deinit(void);
 
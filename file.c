@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "hacktv.h"
+#include "iqz.h"
 
 /* File sink */
 typedef struct {
@@ -29,9 +30,10 @@ typedef struct {
 	size_t samples;
 	int complex;
 	int type;
+	iqz_writer_t *iqz;
 } rf_file_t;
 
-static int _rf_file_write_uint8_real(void *private, int16_t *iq_data, size_t samples)
+static int _rf_file_write_uint8_real(void *private, const int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
 	uint8_t *u8 = rf->data;
@@ -52,7 +54,7 @@ static int _rf_file_write_uint8_real(void *private, int16_t *iq_data, size_t sam
 	return(HACKTV_OK);
 }
 
-static int _rf_file_write_int8_real(void *private, int16_t *iq_data, size_t samples)
+static int _rf_file_write_int8_real(void *private, const int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
 	int8_t *i8 = rf->data;
@@ -73,7 +75,7 @@ static int _rf_file_write_int8_real(void *private, int16_t *iq_data, size_t samp
 	return(HACKTV_OK);
 }
 
-static int _rf_file_write_uint16_real(void *private, int16_t *iq_data, size_t samples)
+static int _rf_file_write_uint16_real(void *private, const int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
 	uint16_t *u16 = rf->data;
@@ -94,7 +96,7 @@ static int _rf_file_write_uint16_real(void *private, int16_t *iq_data, size_t sa
 	return(HACKTV_OK);
 }
 
-static int _rf_file_write_int16_real(void *private, int16_t *iq_data, size_t samples)
+static int _rf_file_write_int16_real(void *private, const int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
 	int16_t *i16 = rf->data;
@@ -115,7 +117,7 @@ static int _rf_file_write_int16_real(void *private, int16_t *iq_data, size_t sam
 	return(HACKTV_OK);
 }
 
-static int _rf_file_write_int32_real(void *private, int16_t *iq_data, size_t samples)
+static int _rf_file_write_int32_real(void *private, const int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
 	int32_t *i32 = rf->data;
@@ -136,7 +138,7 @@ static int _rf_file_write_int32_real(void *private, int16_t *iq_data, size_t sam
 	return(HACKTV_OK);
 }
 
-static int _rf_file_write_float_real(void *private, int16_t *iq_data, size_t samples)
+static int _rf_file_write_float_real(void *private, const int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
 	float *f32 = rf->data;
@@ -157,7 +159,7 @@ static int _rf_file_write_float_real(void *private, int16_t *iq_data, size_t sam
 	return(HACKTV_OK);
 }
 
-static int _rf_file_write_uint8_complex(void *private, int16_t *iq_data, size_t samples)
+static int _rf_file_write_uint8_complex(void *private, const int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
 	uint8_t *u8 = rf->data;
@@ -179,7 +181,7 @@ static int _rf_file_write_uint8_complex(void *private, int16_t *iq_data, size_t
 	return(HACKTV_OK);
 }
 
-static int _rf_file_write_int8_complex(void *private, int16_t *iq_data, size_t samples)
+static int _rf_file_write_int8_complex(void *private, const int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
 	int8_t *i8 = rf->data;
@@ -201,7 +203,7 @@ static int _rf_file_write_int8_complex(void *private, int16_t *iq_data, size_t s
 	return(HACKTV_OK);
 }
 
-static int _rf_file_write_uint16_complex(void *private, int16_t *iq_data, size_t samples)
+static int _rf_file_write_uint16_complex(void *private, const int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
 	uint16_t *u16 = rf->data;
@@ -223,7 +225,7 @@ static int _rf_file_write_uint16_complex(void *private, int16_t *iq_data, size_t
 	return(HACKTV_OK);
 }
 
-static int _rf_file_write_int16_complex(void *private, int16_t *iq_data, size_t samples)
+static int _rf_file_write_int16_complex(void *private, const int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
 	
@@ -232,7 +234,7 @@ static int _rf_file_write_int16_complex(void *private, int16_t *iq_data, size_t
 	return(HACKTV_OK);
 }
 
-static int _rf_file_write_int32_complex(void *private, int16_t *iq_data, size_t samples)
+static int _rf_file_write_int32_complex(void *private, const int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
 	int32_t *i32 = rf->data;
@@ -254,7 +256,7 @@ static int _rf_file_write_int32_complex(void *private, int16_t *iq_data, size_t
 	return(HACKTV_OK);
 }
 
-static int _rf_file_write_float_complex(void *private, int16_t *iq_data, size_t samples)
+static int _rf_file_write_float_complex(void *private, const int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
 	float *f32 = rf->data;
@@ -276,15 +278,30 @@ static int _rf_file_write_float_complex(void *private, int16_t *iq_data, size_t
 	return(HACKTV_OK);
 }
 
+static int _rf_file_write_iqz(void *private, const int16_t *iq_data, size_t samples)
+{
+	rf_file_t *rf = private;
+	
+	return(iqz_write(rf->iqz, iq_data, samples) == 0 ? HACKTV_OK : HACKTV_ERROR);
+}
+
 static int _rf_file_close(void *private)
 {
 	rf_file_t *rf = private;
+	int r = HACKTV_OK;
+	
+	/* Writing the iqz index and trailer can fail */
+	if(rf->iqz && iqz_write_close(rf->iqz) != 0)
+	{
+		fprintf(stderr, "Error writing the IQ container index\n");
+		r = HACKTV_ERROR;
+	}
 	
 	if(rf->f && rf->f != stdout) fclose(rf->f);
 	if(rf->data) free(rf->data);
 	free(rf);
 	
-	return(HACKTV_OK);
+	return(r);
 }
 
 int rf_file_open(hacktv_t *s, char *filename, int type)
@@ -306,6 +323,29 @@ int rf_file_open(hacktv_t *s, char *filename, int type)
 		_rf_file_close(rf);
 		return(HACKTV_ERROR);
 	}
+	else if(type == HACKTV_IQZ)
+	{
+		/* The compressed container does its own file handling */
+		iqz_info_t info;
+		
+		memset(&info, 0, sizeof(iqz_info_t));
+		info.flags = rf->complex ? IQZ_COMPLEX : 0;
+		info.sample_rate = s->samplerate;
+		info.frequency = s->frequency;
+		strncpy(info.mode, s->mode, sizeof(info.mode) - 1);
+		
+		if(iqz_write_open(&rf->iqz, filename, &info) != 0)
+		{
+			_rf_file_close(rf);
+			return(HACKTV_ERROR);
+		}
+		
+		s->rf_private = rf;
+		s->rf_write = _rf_file_write_iqz;
+		s->rf_close = _rf_file_close;
+		
+		return(HACKTV_OK);
+	}
 	else if(strcmp(filename, "-") == 0)
 	{
 		rf->f = stdout;
@@ -278,19 +278,30 @@ size_t fir_int16_process(fir_int16_t *s, int16_t *out, const int16_t *in, size_t
 
 size_t fir_int16_process_block(fir_int16_t *s, int16_t *out, const int16_t *in, size_t samples, int step)
 {
+	const int16_t zero[2] = { 0, 0 };
+	size_t h;
 	int x;
 	
+	h = s->ataps / 2;
+	if(h > samples) h = samples;
+	
 	/* Pre-fill buffer */
 	memset(s->win, 0, (s->lwin + s->ataps) * sizeof(int16_t));
 	s->owin = 0;
 	
-	for(s->owin = 0; s->owin < s->ataps / 2; s->owin++, in += 2)
+	for(s->owin = 0; s->owin < h; s->owin++, in += step)
 	{
 		s->win[s->owin] = *in;
 		if(s->owin < s->ataps) s->win[s->owin + s->lwin] = *in;
 	}
 	
-	x = fir_int16_process(s, out, in, samples, step);
+	x = fir_int16_process(s, out, in, samples - h, step);
+	
+	/* Flush the tail with zeros rather than reading past the end of the block */
+	for(; h > 0; h--)
+	{
+		x += fir_int16_process(s, out + x * step, zero, 1, step);
+	}
 	
 	return(x);
 }
@@ -600,10 +611,14 @@ void fir_int32_free(fir_int32_t *s)
 
 int iir_int16_init(iir_int16_t *s, const double *a, const double *b)
 {
-	s->a[0] = a[0];
-	s->a[1] = a[1];
-	s->b[0] = b[0];
-	s->b[1] = b[1];
+	/* Coefficients are stored in Q20 fixed point. b[1] is derived from
+	 * the rounded sum of the feed-forward taps so the DC gain survives
+	 * the conversion, a small error here becomes a frequency offset
+	 * when the output drives an FM modulator */
+	s->a[0] = lround(a[0] * (1 << 20));
+	s->a[1] = lround(a[1] * (1 << 20));
+	s->b[0] = lround(b[0] * (1 << 20));
+	s->b[1] = lround((b[0] + b[1]) * (1 << 20)) - s->b[0];
 	s->ix = 0;
 	s->iy = 0;
 	return(0);
@@ -611,17 +626,27 @@ int iir_int16_init(iir_int16_t *s, const double *a, const double *b)
 
 size_t iir_int16_process(iir_int16_t *s, int16_t *out, const int16_t *in, size_t samples, size_t step)
 {
+	int64_t iy = s->iy;
+	int32_t ix = s->ix;
+	int64_t y;
 	size_t i;
 	
 	for(i = 0; i < samples; i++)
 	{
-		s->iy = (double) *in * s->b[0] + s->ix * s->b[1] - s->iy * s->a[1];
-		s->ix = (double) *in;
-		*out = lround(s->iy < INT16_MIN ? INT16_MIN : (s->iy > INT16_MAX ? INT16_MAX : s->iy));
+		/* The feedback state is held unclamped in Q20 */
+		iy = (int64_t) *in * s->b[0] + (int64_t) ix * s->b[1] - ((iy * s->a[1]) >> 20);
+		ix = *in;
+		
+		y = (iy + (1 << 19)) >> 20;
+		*out = y < INT16_MIN ? INT16_MIN : (y > INT16_MAX ? INT16_MAX : y);
+		
 		in += step;
 		out += step;
 	}
 	
+	s->ix = ix;
+	s->iy = iy;
+	
 	return(samples);
 }
 
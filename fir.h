@@ -78,10 +78,10 @@ extern size_t fir_int32_process(fir_int32_t *s, int32_t *out, const int32_t *in,
 extern void fir_int32_free(fir_int32_t *s);
 
 typedef struct {
-	double a[2];
-	double b[2];
-	double ix;
-	double iy;
+	int32_t a[2];
+	int32_t b[2];
+	int32_t ix;
+	int64_t iy;
 } iir_int16_t;
 
 extern int iir_int16_init(iir_int16_t *s, const double *a, const double *b);
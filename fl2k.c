@@ -17,15 +17,29 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <osmo-fl2k.h>
 #include <pthread.h>
+#include <unistd.h>
 #include "hacktv.h"
+#include "common.h"
+#include "fir.h"
+#include "fl2k.h"
+#include "rt.h"
 
 #define BUFFERS 4
 
+/* Upsampler input blocks, in samples */
+#define UP_BLOCKS    4
+#define UP_BLOCK_LEN 65536
+
+/* Input samples resampled at a time */
+#define UP_CHUNK     4096
+
 typedef struct {
 	
 	fl2k_dev_t *d;
+	int started;
 	int abort;
 	
 	uint8_t buffer_r[BUFFERS][FL2K_BUF_LEN];
@@ -34,6 +48,26 @@ typedef struct {
 	int len;
 	int in;
 	int out;
+	unsigned int dac_rate;
+	
+	/* Upsampler, used when the DAC rate is above the sample rate */
+	int interpolation;
+	int decimation;
+	int complex;
+	fir_int16_t ifir;
+	fir_int16_t qfir;
+	int16_t *up_in[UP_BLOCKS];
+	size_t up_in_len[UP_BLOCKS];
+	size_t up_len;
+	int16_t *up_out;
+	int up_wr;
+	int up_rd;
+	int up_count;
+	int up_abort;
+	pthread_mutex_t up_mutex;
+	pthread_cond_t up_cond;
+	pthread_t up_thread;
+	int up_running;
 	
 } fl2k_t;
 
@@ -69,16 +103,10 @@ static void _callback(fl2k_data_info_t *data_info)
 	data_info->b_buf = NULL;
 }
 
-static int _rf_write(void *private, int16_t *iq_data, size_t samples)
+static void _fl2k_put(fl2k_t *rf, const int16_t *iq_data, size_t samples)
 {
-	fl2k_t *rf = private;
 	int i;
 	
-	if(rf->abort)
-	{
-		return(HACKTV_ERROR);
-	}
-	
 	while(samples > 0)
 	{
 		for(; rf->len < FL2K_BUF_LEN && samples > 0; rf->len++, samples--)
@@ -97,6 +125,149 @@ static int _rf_write(void *private, int16_t *iq_data, size_t samples)
 			rf->len = 0;
 		}
 	}
+}
+
+static void *_up_thread(void *arg)
+{
+	fl2k_t *rf = arg;
+	const int16_t *in;
+	size_t i, n, x, len;
+	
+	rt_thread(RT_SINK);
+	
+	pthread_mutex_lock(&rf->up_mutex);
+	
+	while(1)
+	{
+		while(rf->up_count == 0 && !rf->up_abort)
+		{
+			pthread_cond_wait(&rf->up_cond, &rf->up_mutex);
+		}
+		
+		/* Stop once the queue is drained */
+		if(rf->up_count == 0)
+		{
+			break;
+		}
+		
+		in = rf->up_in[rf->up_rd];
+		len = rf->up_in_len[rf->up_rd];
+		pthread_mutex_unlock(&rf->up_mutex);
+		
+		/* Resample the I and Q channels and pass them on to the
+		 * device buffers, a chunk at a time */
+		for(i = 0; i < len && !rf->abort; i += n)
+		{
+			n = len - i;
+			if(n > UP_CHUNK) n = UP_CHUNK;
+			
+			x = fir_int16_process(&rf->ifir, &rf->up_out[0], &in[i * 2 + 0], n, 2);
+			
+			if(rf->complex)
+			{
+				fir_int16_process(&rf->qfir, &rf->up_out[1], &in[i * 2 + 1], n, 2);
+			}
+			
+			_fl2k_put(rf, rf->up_out, x);
+		}
+		
+		pthread_mutex_lock(&rf->up_mutex);
+		rf->up_rd = (rf->up_rd + 1) % UP_BLOCKS;
+		rf->up_count--;
+		pthread_cond_signal(&rf->up_cond);
+	}
+	
+	pthread_mutex_unlock(&rf->up_mutex);
+	
+	return(NULL);
+}
+
+static void _up_queue(fl2k_t *rf)
+{
+	pthread_mutex_lock(&rf->up_mutex);
+	
+	rf->up_in_len[rf->up_wr] = rf->up_len;
+	rf->up_count++;
+	rf->up_wr = (rf->up_wr + 1) % UP_BLOCKS;
+	rf->up_len = 0;
+	pthread_cond_signal(&rf->up_cond);
+	
+	/* Wait for the next block to be free */
+	while(rf->up_count == UP_BLOCKS && !rf->abort)
+	{
+		pthread_cond_wait(&rf->up_cond, &rf->up_mutex);
+	}
+	
+	pthread_mutex_unlock(&rf->up_mutex);
+}
+
+static void _fl2k_drain(fl2k_t *rf)
+{
+	int64_t wait;
+	int i, last;
+	
+	if(rf->len == 0)
+	{
+		return;
+	}
+	
+	/* Pad the last buffer with silence and pass it on */
+	memset(&rf->buffer_r[rf->in][rf->len], 128, FL2K_BUF_LEN - rf->len);
+	memset(&rf->buffer_g[rf->in][rf->len], 128, FL2K_BUF_LEN - rf->len);
+	
+	last = rf->in;
+	i = (rf->in + 1) % BUFFERS;
+	pthread_mutex_lock(&rf->mutex[i]);
+	pthread_mutex_unlock(&rf->mutex[rf->in]);
+	rf->in = i;
+	rf->len = 0;
+	
+	/* Wait for the device to take it, allowing a second more
+	 * than the buffers ahead of it should need */
+	wait = (int64_t) BUFFERS * FL2K_BUF_LEN * 1000000 / rf->dac_rate + 1000000;
+	
+	while(__atomic_load_n(&rf->out, __ATOMIC_ACQUIRE) != last && !rf->abort && wait > 0)
+	{
+		usleep(1000);
+		wait -= 1000;
+	}
+}
+
+static int _rf_write(void *private, const int16_t *iq_data, size_t samples)
+{
+	fl2k_t *rf = private;
+	int16_t *b;
+	size_t n;
+	
+	if(rf->abort)
+	{
+		return(HACKTV_ERROR);
+	}
+	
+	if(rf->interpolation == 0)
+	{
+		_fl2k_put(rf, iq_data, samples);
+		return(HACKTV_OK);
+	}
+	
+	/* Queue the samples for the upsampler thread */
+	while(samples > 0)
+	{
+		b = rf->up_in[rf->up_wr];
+		
+		n = UP_BLOCK_LEN - rf->up_len;
+		if(n > samples) n = samples;
+		
+		memcpy(&b[rf->up_len * 2], iq_data, sizeof(int16_t) * 2 * n);
+		rf->up_len += n;
+		iq_data += n * 2;
+		samples -= n;
+		
+		if(rf->up_len == UP_BLOCK_LEN)
+		{
+			_up_queue(rf);
+		}
+	}
 	
 	return(HACKTV_OK);
 }
@@ -106,22 +277,108 @@ static int _rf_close(void *private)
 	fl2k_t *rf = private;
 	int r;
 	
+	/* Let the upsampler finish the blocks queued for it, and the
+	 * part filled one, while the device is still taking samples */
+	if(rf->up_running)
+	{
+		if(rf->up_len > 0)
+		{
+			_up_queue(rf);
+		}
+		
+		pthread_mutex_lock(&rf->up_mutex);
+		rf->up_abort = 1;
+		pthread_cond_signal(&rf->up_cond);
+		pthread_mutex_unlock(&rf->up_mutex);
+		
+		pthread_join(rf->up_thread, NULL);
+	}
+	
+	if(rf->d && rf->started)
+	{
+		_fl2k_drain(rf);
+	}
+	
 	rf->abort = 1;
 	
-	fl2k_stop_tx(rf->d);
-	fl2k_close(rf->d);
+	if(rf->d)
+	{
+		fl2k_stop_tx(rf->d);
+		fl2k_close(rf->d);
+	}
 	
 	for(r = 0; r < BUFFERS; r++)
 	{
 		pthread_mutex_destroy(&rf->mutex[r]);
 	}
 	
+	if(rf->interpolation)
+	{
+		pthread_cond_destroy(&rf->up_cond);
+		pthread_mutex_destroy(&rf->up_mutex);
+		fir_int16_free(&rf->ifir);
+		fir_int16_free(&rf->qfir);
+		
+		for(r = 0; r < UP_BLOCKS; r++)
+		{
+			free(rf->up_in[r]);
+		}
+		
+		free(rf->up_out);
+	}
+	
 	free(rf);
 	
 	return(HACKTV_OK);
 }
 
-int rf_fl2k_open(hacktv_t *s, const char *device)
+static int _up_init(fl2k_t *rf, hacktv_t *s, unsigned int dac_rate)
+{
+	int d, i;
+	
+	d = gcd(dac_rate, s->vid.sample_rate);
+	rf->interpolation = dac_rate / d;
+	rf->decimation = s->vid.sample_rate / d;
+	rf->complex = s->vid.conf.output_type == HACKTV_INT16_COMPLEX;
+	
+	pthread_mutex_init(&rf->up_mutex, NULL);
+	pthread_cond_init(&rf->up_cond, NULL);
+	
+	if(rf->interpolation < rf->decimation)
+	{
+		fprintf(stderr, "The fl2k DAC rate must not be lower than the sample rate.\n");
+		return(HACKTV_ERROR);
+	}
+	
+	/* The filter has 21 taps for each interpolation step */
+	if(rf->interpolation > 4096)
+	{
+		fprintf(stderr, "The fl2k DAC rate and sample rate ratio %d:%d is too complex. Try rates with a simpler ratio.\n", rf->interpolation, rf->decimation);
+		return(HACKTV_ERROR);
+	}
+	
+	fprintf(stderr, "fl2k: Upsampling %d:%d to %u Hz\n", rf->interpolation, rf->decimation, dac_rate);
+	
+	if(fir_int16_resampler_init(&rf->ifir, rf->interpolation, rf->decimation) != 0 ||
+	   fir_int16_resampler_init(&rf->qfir, rf->interpolation, rf->decimation) != 0)
+	{
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	for(i = 0; i < UP_BLOCKS; i++)
+	{
+		rf->up_in[i] = malloc(sizeof(int16_t) * 2 * UP_BLOCK_LEN);
+		if(!rf->up_in[i]) return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	/* Q stays at zero for real signals */
+	rf->up_out = calloc(((size_t) UP_CHUNK * rf->interpolation / rf->decimation + 1) * 2, sizeof(int16_t));
+	if(!rf->up_out) return(HACKTV_OUT_OF_MEMORY);
+	
+	return(HACKTV_OK);
+}
+
+int rf_fl2k_open(hacktv_t *s, const char *device, unsigned int dac_rate)
 {
 	fl2k_t *rf;
 	int r;
@@ -134,6 +391,22 @@ int rf_fl2k_open(hacktv_t *s, const char *device)
 	
 	rf->abort = 0;
 	
+	/* Set up the upsampler if the DAC runs faster than the signal */
+	if(dac_rate > 0 && dac_rate != s->vid.sample_rate)
+	{
+		if(_up_init(rf, s, dac_rate) != HACKTV_OK)
+		{
+			_rf_close(rf);
+			return(HACKTV_ERROR);
+		}
+	}
+	else
+	{
+		dac_rate = s->vid.sample_rate;
+	}
+	
+	rf->dac_rate = dac_rate;
+	
 	r = device ? atoi(device) : 0;
 	
 	fl2k_open(&rf->d, r);
@@ -167,7 +440,9 @@ int rf_fl2k_open(hacktv_t *s, const char *device)
 		return(HACKTV_ERROR);
 	}
 	
-	r = fl2k_set_sample_rate(rf->d, s->vid.sample_rate);
+	rf->started = 1;
+	
+	r = fl2k_set_sample_rate(rf->d, dac_rate);
 	if(r < 0)
 	{
 		fprintf(stderr, "fl2k_set_sample_rate() failed: %d\n", r);
@@ -177,13 +452,25 @@ int rf_fl2k_open(hacktv_t *s, const char *device)
 	
 	/* Read back the actual frequency */
 	r = fl2k_get_sample_rate(rf->d);
-	if(r != s->vid.sample_rate)
+	if(r != dac_rate)
 	{
-		//fprintf(stderr, "fl2k sample rate changed from %d > %d\n", s->vid.sample_rate, r);
+		//fprintf(stderr, "fl2k sample rate changed from %d > %d\n", dac_rate, r);
 		//_rf_close(rf);
 		//return(HACKTV_ERROR);
 	}
 	
+	if(rf->interpolation)
+	{
+		if(pthread_create(&rf->up_thread, NULL, &_up_thread, rf) != 0)
+		{
+			perror("pthread_create");
+			_rf_close(rf);
+			return(HACKTV_ERROR);
+		}
+		
+		rf->up_running = 1;
+	}
+	
 	/* Register the callback functions */
 	s->rf_private = rf;
 	s->rf_write = _rf_write;
@@ -21,9 +21,7 @@
 #include "font.h"
 #include "fonts.h"
 
-static FT_Library _freetype = NULL;
-
-int font_init(vid_t *s, int size, float ratio)
+av_font_t *font_new(vid_t *s, int size, float ratio)
 {	
 	int r;
 	int x_res;
@@ -34,7 +32,7 @@ int font_init(vid_t *s, int size, float ratio)
 	if(!font)
 	{
 		fprintf(stderr, "Font memory allocation error.\n");
-		return(HACKTV_OUT_OF_MEMORY);
+		return(NULL);
 	}
 	
 	/* Normalise ratio */
@@ -48,16 +46,18 @@ int font_init(vid_t *s, int size, float ratio)
 	/* Hack to deal with different sampling rates */
 	x_res = 96.0 * ((float) font->video_width / font->video_height / font->video_ratio);
 	
-	/* Initialise the freetype library */
-	r = FT_Init_FreeType(&_freetype);
+	/* Initialise the freetype library. Each font has its own, so
+	 * fonts can be created and drawn on different threads */
+	r = FT_Init_FreeType(&font->library);
 	if(r)
 	{
 		fprintf(stderr, "There was an error initialising the freetype library.\n");
-		return(HACKTV_ERROR);
+		free(font);
+		return(NULL);
 	}
 	
-	// r = FT_New_Face(_freetype, fontfile, 0, &font->fontface);
-	r = FT_New_Memory_Face( _freetype,
+	// r = FT_New_Face(font->library, fontfile, 0, &font->fontface);
+	r = FT_New_Memory_Face( font->library,
                             _font_evolventa,    /* first byte in memory */
                             sizeof(_font_evolventa),      /* size in bytes        */
                             0,         /* face_index           */
@@ -65,18 +65,33 @@ int font_init(vid_t *s, int size, float ratio)
 	if(r == FT_Err_Unknown_File_Format)
 	{
 		fprintf(stderr, "Unknown font file format.");
-		return(HACKTV_ERROR);
+		font_free(font);
+		return(NULL);
 	}
 	else if(r)
 	{
 		fprintf(stderr, "Error loading font.");
-		return(HACKTV_ERROR);
+		font_free(font);
+		return(NULL);
 	}
 	
 	r = FT_Set_Char_Size(font->fontface, 0, (FT_F26Dot6) 32 * size, x_res, 96);
 	if(r)
 	{
 		fprintf(stderr, "Error setting font size %d.", 32);
+		font_free(font);
+		return(NULL);
+	}
+	
+	return(font);
+}
+
+int font_init(vid_t *s, int size, float ratio)
+{
+	av_font_t *font = font_new(s, size, ratio);
+	
+	if(!font)
+	{
 		return(HACKTV_ERROR);
 	}
 	
@@ -86,6 +101,15 @@ int font_init(vid_t *s, int size, float ratio)
 	return(HACKTV_OK);
 }
 
+void font_free(av_font_t *font)
+{
+	if(!font) return;
+	
+	if(font->fontface) FT_Done_Face(font->fontface);
+	if(font->library) FT_Done_FreeType(font->library);
+	free(font);
+}
+
 static uint32_t _make_transparent(uint32_t a, uint32_t b, float t)
 {
 	int vr, vg, vb;
@@ -210,7 +234,7 @@ int _printf(av_font_t *font, int32_t x, int32_t y, uint32_t colour, char *fmt)
 	char *s;
 	uint32_t u;
 	
-	if(!_freetype || !font->fontface)
+	if(!font->fontface)
 	{
 		fprintf(stderr, "Freetype library not initialised or no font set.\n");
 		return(HACKTV_ERROR);
@@ -273,7 +297,7 @@ static int _get_line_size(av_font_t *font, char *fmt, int *line_width, int *line
 	*line_width = 0;
 	*line_height = 0;
 	
-	if(!_freetype || !font->fontface)
+	if(!font->fontface)
 	{
 		fprintf(stderr, "Freetype library not initialised or no font set.\n");
 		return(HACKTV_ERROR);
@@ -411,3 +435,45 @@ void print_generic_text(av_font_t *font, uint32_t *vid, char *fmt, float pos_x,
 		_print_line(font, line_width, line_height, (int) pos_x, (int) pos_y, fmt, shadow, box, colour, transparency, 0);
 	}
 }
+
+void get_generic_text_rect(av_font_t *font, char *fmt, float pos_x, float pos_y, int shadow, int box, int *x0, int *y0, int *x1, int *y1)
+{
+	int line_width = 0;
+	int line_height = 0;
+	
+	*x0 = *y0 = *x1 = *y1 = 0;
+	
+	if(strcmp(fmt, "") == 0) return;
+	
+	_get_line_size(font, fmt, &line_width, &line_height);
+	
+	/* Same placement as print_generic_text() */
+	pos_x = font->video_width * (pos_x / 100.00) - (pos_x != 50 ? 0 : line_width * (pos_x / 100.00));
+	pos_y = pos_y / 100.00 * font->video_height;
+	
+	if(box)
+	{
+		*x0 = (int) pos_x - 8;
+		*x1 = *x0 + line_width + 15;
+		*y0 = (int) pos_y - (int) (line_height * 1.15);
+		*y1 = *y0 + (int) (line_height * 1.425);
+	}
+	else
+	{
+		*x0 = (int) pos_x;
+		*x1 = *x0 + line_width + (shadow ? 2 : 0);
+		*y0 = (int) pos_y - line_height;
+		*y1 = (int) pos_y + (shadow ? 2 : 0);
+	}
+	
+	/* Allow for glyphs that overhang their advance width */
+	*x0 -= line_height / 4;
+	*x1 += line_height / 4;
+	*y1 += line_height / 4;
+	
+	/* Clip to the frame */
+	if(*x0 < 0) *x0 = 0;
+	if(*y0 < 0) *y0 = 0;
+	if(*x1 > font->video_width) *x1 = font->video_width;
+	if(*y1 > font->video_height) *y1 = font->video_height;
+}
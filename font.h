@@ -33,6 +33,7 @@ typedef struct {
 	int video_width;
 	int video_height;
 	float video_ratio;
+	FT_Library library;
 	FT_Face fontface;
 	int font_size;
 	char *font_name;
@@ -41,8 +42,11 @@ typedef struct {
 } av_font_t;
 
 
+extern av_font_t *font_new(vid_t *s, int size, float ratio);
 extern int font_init(vid_t *s, int size, float ratio);
+extern void font_free(av_font_t *font);
 extern void print_subtitle(av_font_t *av, uint32_t *vid, char *fmt);
 extern void print_generic_text(av_font_t *font, uint32_t *vid, char *fmt, float pos_x, float pos_y, int shadow, int box, int colour, int transparency);
+extern void get_generic_text_rect(av_font_t *font, char *fmt, float pos_x, float pos_y, int shadow, int box, int *x0, int *y0, int *x1, int *y1);
 extern int display_bitmap_subtitle(av_font_t *av, uint32_t *vid, int w, int h, uint32_t *bitmap_data);
 #endif
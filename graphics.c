@@ -271,12 +271,33 @@ int load_png(image_t *image, int width, int height, char *image_name, float scal
 		}
 		
 		resize_bitmap(logo, image->logo, image->width, image->height, image->img_width, image->img_height);
+		free(logo);
 		return(HACKTV_OK);
 	}
 	
 	return(HACKTV_ERROR);
 }
 
+void free_png(image_t *image)
+{
+	int y;
+	
+	if(image->row_pointers)
+	{
+		for(y = 0; y < image->height; y++)
+		{
+			free(image->row_pointers[y]);
+		}
+		
+		free(image->row_pointers);
+	}
+	
+	free(image->logo);
+	
+	image->row_pointers = NULL;
+	image->logo = NULL;
+}
+
 
 void overlay_image(uint32_t *framebuffer, image_t *l, int vid_width, int vid_height, int pos)
 {
@@ -360,51 +381,112 @@ void overlay_image(uint32_t *framebuffer, image_t *l, int vid_width, int vid_hei
 	}
 }
 
-/* Inspiration from http://tech-algorithm.com/articles/bilinear-image-scaling/ */
+/* Bilinear resize, applied as a horizontal pass over each source row
+ * followed by a vertical blend of two of those rows. The channels are
+ * processed as bytes in 8.16 / 8.15 fixed point so the inner loops are
+ * plain integer arithmetic the compiler can vectorise. Sample positions
+ * match the original scalar resampler:
+ * http://tech-algorithm.com/articles/bilinear-image-scaling/ */
+
+static void _resize_row(const uint8_t *in, uint32_t *out, int new_width, const int *xi, const uint32_t *xf)
+{
+	int j, c;
+	
+	for(j = 0; j < new_width; j++)
+	{
+		const uint8_t *a = &in[xi[j * 2 + 0] * 4];
+		const uint8_t *b = &in[xi[j * 2 + 1] * 4];
+		uint32_t f = xf[j];
+		
+		/* 8.8 fixed point result for each channel */
+		for(c = 0; c < 4; c++)
+		{
+			out[j * 4 + c] = (a[c] * (0x10000 - f) + b[c] * f) >> 8;
+		}
+	}
+}
 
 void resize_bitmap(uint32_t *input, uint32_t *output, int old_width, int old_height, int new_width, int new_height) 
 {
-	int a, b, c, d, x, y, index;
 	float x_ratio = ((float)(old_width - 1)) / new_width;
 	float y_ratio = ((float)(old_height - 1)) / new_height;
-	float x_diff, y_diff, blue, red, green, alpha;
-	int offset = 0 ;
+	int *xi;
+	uint32_t *xf;
+	uint32_t *rows[2];
+	int row_y[2] = { -1, -1 };
+	uint8_t *out = (uint8_t *) output;
+	int i, j, n;
+	
+	if(new_width <= 0 || new_height <= 0) return;
+	
+	n = new_width * 4;
+	xi = malloc(sizeof(int) * 2 * new_width);
+	xf = malloc(sizeof(uint32_t) * new_width);
+	rows[0] = malloc(sizeof(uint32_t) * n);
+	rows[1] = malloc(sizeof(uint32_t) * n);
+	
+	if(!xi || !xf || !rows[0] || !rows[1])
+	{
+		free(xi);
+		free(xf);
+		free(rows[0]);
+		free(rows[1]);
+		return;
+	}
+	
+	/* Source columns and weights for each output column */
+	for(j = 0; j < new_width; j++)
+	{
+		float x = x_ratio * j;
+		
+		xi[j * 2 + 0] = (int) x;
+		xi[j * 2 + 1] = (int) x + 1 < old_width ? (int) x + 1 : old_width - 1;
+		xf[j] = (x - (int) x) * 0x10000;
+	}
 	
-	for (int i = 0; i < new_height; i++) 
+	for(i = 0; i < new_height; i++)
 	{
-		for (int j = 0; j < new_width; j++) 
+		float y = y_ratio * i;
+		int y0 = (int) y;
+		int y1 = y0 + 1 < old_height ? y0 + 1 : old_height - 1;
+		uint32_t f = (y - y0) * 0x8000;
+		uint32_t *r0, *r1;
+		
+		/* Reuse horizontally resized rows from the previous output row */
+		if(row_y[0] != y0 && row_y[1] == y0)
 		{
-			x = (int)(x_ratio * j);
-			y = (int)(y_ratio * i);
-			x_diff = (x_ratio * j) - x;
-			y_diff = (y_ratio * i) - y;
-			index = (y * old_width + x);
-			a = input[index];
-			b = input[index + 1];
-			c = input[index + old_width];
-			d = input[index + old_width + 1];
-			
-			/* Blue */
-			blue = (a & 0xFF) * ( 1- x_diff) * (1 - y_diff) + (b & 0xFF) * (x_diff) * (1 - y_diff) +
-				   (c & 0xFF) * (y_diff) * (1 - x_diff)   + (d & 0xFF) * (x_diff * y_diff);
-			
-			/* Green */
-			green = ((a >> 8) & 0xFF) * (1-x_diff) * (1 - y_diff) + ((b >> 8) & 0xFF) * (x_diff) * (1 - y_diff) +
-					((c >> 8) & 0xFF) * (y_diff) * (1 - x_diff)   + ((d >> 8) & 0xFF) * (x_diff * y_diff);
-			
-			/* Reg */
-			red = ((a >> 16) & 0xFF) * (1 - x_diff) * (1 - y_diff) + ((b >> 16) & 0xFF) * (x_diff) * (1-y_diff) +
-				  ((c >> 16) & 0xFF) * (y_diff) * (1 - x_diff)   + ((d >> 16) & 0xFF) * (x_diff * y_diff);
-			
-			// /* Alpha */
-			alpha = ((a >> 24) & 0xFF) * (1-x_diff) * (1 - y_diff) + ((b >> 24) & 0xFF) * (x_diff) * (1 - y_diff) +
-					((c >> 24) & 0xFF) * (y_diff) * (1 - x_diff)   + ((d >> 24) & 0xFF) * (x_diff * y_diff);
-			
-			output[offset++] = 
-					((((int) alpha) << 24) & 0xFF000000) |
-					((((int) red)   << 16) & 0xFF0000)   |
-					((((int) green) << 8)  & 0xFF00)     |
-					((((int) blue)  << 0)  & 0xFF);
+			uint32_t *t = rows[0];
+			rows[0] = rows[1];
+			rows[1] = t;
+			row_y[0] = y0;
+			row_y[1] = -1;
 		}
+		
+		if(row_y[0] != y0)
+		{
+			_resize_row((uint8_t *) &input[y0 * old_width], rows[0], new_width, xi, xf);
+			row_y[0] = y0;
+		}
+		
+		if(row_y[1] != y1)
+		{
+			_resize_row((uint8_t *) &input[y1 * old_width], rows[1], new_width, xi, xf);
+			row_y[1] = y1;
+		}
+		
+		r0 = rows[0];
+		r1 = rows[1];
+		
+		for(j = 0; j < n; j++)
+		{
+			out[j] = (r0[j] * (0x8000 - f) + r1[j] * f) >> 23;
+		}
+		
+		out += n;
 	}
+	
+	free(xi);
+	free(xf);
+	free(rows[0]);
+	free(rows[1]);
 }
@@ -22,35 +22,11 @@
 #include <pthread.h>
 #include <unistd.h>
 #include "hacktv.h"
+#include "rfbuffer.h"
 
-#define BUFFERS 32
-
-typedef struct {
-	
-	/* Buffers are locked while reading/writing */
-	pthread_mutex_t mutex;
-	
-	/* Pointer to the start of the buffer */
-	int8_t *data;
-	
-	/* Offset to start of data */
-	size_t start;
-	
-	/* Length of data ready */
-	size_t length;
-	
-} buffer_t;
-
-typedef struct {
-	
-	buffer_t *buffers;
-	
-	int length;
-	int count;
-	int in;
-	int out;
-	
-} buffers_t;
+/* Transfers libhackrf keeps queued, and their size in bytes */
+#define HACKRF_TRANSFERS 4
+#define HACKRF_TRANSFER  262144
 
 typedef struct {
 	
@@ -58,207 +34,116 @@ typedef struct {
 	hackrf_device *d;
 	
 	/* Buffers */
-	buffers_t buffers;
-	
-} hackrf_t;
-
-static int _buffer_init(buffers_t *buffers, size_t count, size_t length)
-{
-	int i;
+	rf_buffers_t buffers;
 	
-	buffers->count = count;
-	buffers->length = length;
-	buffers->buffers = calloc(count, sizeof(buffer_t));
+	/* TX is started once the buffers are prefilled */
+	int started;
 	
-	for(i = 0; i < count; i++)
-	{
-		pthread_mutex_init(&buffers->buffers[i].mutex, NULL);
-		buffers->buffers[i].data = malloc(length);
-		buffers->buffers[i].start = 0;
-		buffers->buffers[i].length = 0;
-	}
-	
-	/* Lock the initial buffer for the provider */
-	buffers->in = 0;
-	pthread_mutex_lock(&buffers->buffers[buffers->in].mutex);
-	
-	/* Lock the last empty buffer for the consumer */
-	buffers->out = count - 1;
-	pthread_mutex_lock(&buffers->buffers[buffers->out].mutex);
-
-	return(0);
-}
+} hackrf_t;
 
-static int _buffer_free(buffers_t *buffers)
+static int _tx_callback(hackrf_transfer *transfer)
 {
-	int i;
-	
-	for(i = 0; i < buffers->count; i++)
-	{
-		free(buffers->buffers[i].data);
-		pthread_mutex_destroy(&buffers->buffers[i].mutex);
-	}
+	hackrf_t *rf = transfer->tx_ctx;
 	
-	free(buffers->buffers);
-	memset(buffers, 0, sizeof(buffers_t));
+	rf_buffers_fill(&rf->buffers, transfer->buffer, transfer->valid_length);
 	
 	return(0);
 }
 
-static int _buffer_read(buffers_t *buffers, void *dst, size_t length)
+static int _rf_start(hackrf_t *rf)
 {
-	buffer_t *buf = &buffers->buffers[buffers->out];
-	
-	if(buf->length == 0)
-	{
-		buffer_t *next;
-		int i;
-		
-		/* This buffer is empty, try to move the read lock onto the next one */
-		i = (buffers->out + 1) % buffers->count;
-		next = &buffers->buffers[i];
-		
-		if(pthread_mutex_trylock(&next->mutex) != 0)
-		{
-			/* No luck, the writer must have it */
-			fprintf(stderr, "U");
-			return(0);
-		}
-		
-		/* Got a lock on the next buffer, clear and release the previous */
-		buf->start = 0;
-		pthread_mutex_unlock(&buf->mutex);
-		
-		buf = next;
-		buffers->out = i;
-	}
+	int r;
 	
-	if(length > buf->length)
+	r = hackrf_start_tx(rf->d, _tx_callback, rf);
+	if(r != HACKRF_SUCCESS)
 	{
-		length = buf->length;
+		fprintf(stderr, "hackrf_start_tx() failed: %s (%d)\n", hackrf_error_name(r), r);
+		return(HACKTV_ERROR);
 	}
 	
-	memcpy(dst, buf->data + buf->start, length);
-	buf->start += length;
-	buf->length -= length;
+	rf->started = 1;
 	
-	return(length);
+	return(HACKTV_OK);
 }
 
-static int _buffer_write(buffers_t *buffers, void *src, size_t length)
+static int _rf_write(void *private, const int16_t *iq_data, size_t samples)
 {
-	buffer_t *buf = &buffers->buffers[buffers->in];
-	int i;
+	hackrf_t *rf = private;
 	
-	if(buf->length == buffers->length)
-	{
-		buffer_t *next;
-		
-		/* This buffer is full, move the write lock onto the next one */
-		i = (buffers->in + 1) % buffers->count;
-		next = &buffers->buffers[i];
-		
-		pthread_mutex_lock(&next->mutex);
-		pthread_mutex_unlock(&buf->mutex);
-		
-		buf = next;
-		buffers->in = i;
-	}
+	rf_buffers_write_iq(&rf->buffers, iq_data, samples);
 	
-	i = buf->start + buf->length;
-	if(length > buffers->length - i)
+	if(!rf->started && rf_buffers_ready(&rf->buffers))
 	{
-		length = buffers->length - i;
+		return(_rf_start(rf));
 	}
 	
-	memcpy(buf->data + i, src, length);
-	buf->length += length;
-
-	return(length);
+	return(HACKTV_OK);
 }
 
-static int _tx_callback(hackrf_transfer *transfer)
+static void _rf_free(hackrf_t *rf)
 {
-	hackrf_t *rf = transfer->tx_ctx;
-	size_t l = transfer->valid_length;
-	uint8_t *buf = transfer->buffer;
 	int r;
 	
-	while(l)
+	if(rf->d)
 	{
-		r = _buffer_read(&rf->buffers, buf, l);
-		
-		if(r == 0)
+		r = hackrf_close(rf->d);
+		if(r != HACKRF_SUCCESS)
 		{
-			/* Buffer underrun, fill with zero */
-			memset(buf, 0, l);
-			l = 0;
+			fprintf(stderr, "hackrf_close() failed: %s (%d)\n", hackrf_error_name(r), r);
 		}
-		else
-		{
-			l -= r;
-			buf += r;
-		}
-	}
-	
-	return(0);
-}
-
-static int _rf_write(void *private, int16_t *iq_data, size_t samples)
-{
-	hackrf_t *rf = private;
-	int8_t iq8[1024 * 4];
-	int i, r;
-	
-	samples *= 2;
-	
-	for(i = 0; i < samples; i++)
-	{
-		iq8[i] = iq_data[i] >> 8;
 	}
 	
-	i = 0;
-	while(samples)
-	{
-		r = _buffer_write(&rf->buffers, &iq8[i], samples);
-		
-		samples -= r;
-		i += r;
-	}
+	hackrf_exit();
 	
-	return(HACKTV_OK);
+	rf_buffers_free(&rf->buffers);
+	free(rf);
 }
 
 static int _rf_close(void *private)
 {
 	hackrf_t *rf = private;
-	int r;
-	
-	r = hackrf_stop_tx(rf->d);
-	if(r != HACKRF_SUCCESS)
-	{
-		fprintf(stderr, "hackrf_stop_tx() failed: %s (%d)\n", hackrf_error_name(r), r);
-		return(HACKTV_ERROR);
-	}
+	int r, ret = HACKTV_OK;
 	
-	/* Wait until streaming has stopped */
-	while(hackrf_is_streaming(rf->d) == HACKRF_TRUE)
+	/* Output shorter than the prefill still has to be sent */
+	if(!rf->started && rf->buffers.written > 0)
 	{
-		usleep(100);
+		ret = _rf_start(rf);
 	}
 	
-	r = hackrf_close(rf->d);
-	if(r != HACKRF_SUCCESS)
+	if(rf->started)
 	{
-		fprintf(stderr, "hackrf_close() failed: %s (%d)\n", hackrf_error_name(r), r);
+		/* Let the callback send what is left in the buffers, and
+		 * give the transfers libhackrf has queued time to go out */
+		if(rf_buffers_drain(&rf->buffers) == HACKTV_OK)
+		{
+			usleep((int64_t) HACKRF_TRANSFERS * HACKRF_TRANSFER / 2 * 1000000 / rf->buffers.sample_rate);
+		}
+		else
+		{
+			ret = HACKTV_ERROR;
+		}
+		
+		r = hackrf_stop_tx(rf->d);
+		if(r != HACKRF_SUCCESS)
+		{
+			fprintf(stderr, "hackrf_stop_tx() failed: %s (%d)\n", hackrf_error_name(r), r);
+			ret = HACKTV_ERROR;
+		}
+		else
+		{
+			/* Wait until streaming has stopped */
+			while(hackrf_is_streaming(rf->d) == HACKRF_TRUE)
+			{
+				usleep(100);
+			}
+		}
 	}
 	
-	hackrf_exit();
+	rf_buffers_report(&rf->buffers, "hackrf");
 	
-	_buffer_free(&rf->buffers);
-	free(rf);
+	_rf_free(rf);
 	
-	return(HACKTV_OK);
+	return(ret);
 }
 
 int rf_hackrf_open(hacktv_t *s, const char *serial, uint64_t frequency_hz, unsigned int txvga_gain, unsigned char amp_enable)
@@ -278,14 +163,20 @@ int rf_hackrf_open(hacktv_t *s, const char *serial, uint64_t frequency_hz, unsig
 		return(HACKTV_OUT_OF_MEMORY);
 	}
 	
-	/* Allocate memory for output buffers, each one large enough to hold a single frame */
-	_buffer_init(&rf->buffers, BUFFERS, s->vid.width * s->vid.conf.lines * sizeof(int8_t) * 2);
+	/* Allocate memory for output buffers */
+	r = rf_buffers_open(&rf->buffers, s);
+	if(r != HACKTV_OK)
+	{
+		free(rf);
+		return(r);
+	}
 	
 	/* Prepare the HackRF for output */
 	r = hackrf_init();
 	if(r != HACKRF_SUCCESS)
 	{
 		fprintf(stderr, "hackrf_init() failed: %s (%d)\n", hackrf_error_name(r), r);
+		rf_buffers_free(&rf->buffers);
 		free(rf);
 		return(HACKTV_ERROR);
 	}
@@ -294,7 +185,8 @@ int rf_hackrf_open(hacktv_t *s, const char *serial, uint64_t frequency_hz, unsig
 	if(r != HACKRF_SUCCESS)
 	{
 		fprintf(stderr, "hackrf_open() failed: %s (%d)\n", hackrf_error_name(r), r);
-		free(rf);
+		rf->d = NULL;
+		_rf_free(rf);
 		return(HACKTV_ERROR);
 	}
 	
@@ -302,7 +194,7 @@ int rf_hackrf_open(hacktv_t *s, const char *serial, uint64_t frequency_hz, unsig
 	if(r != HACKRF_SUCCESS)
 	{
 		fprintf(stderr, "hackrf_sample_rate_set() failed: %s (%d)\n", hackrf_error_name(r), r);
-		free(rf);
+		_rf_free(rf);
 		return(HACKTV_ERROR);
 	}
 	
@@ -310,7 +202,7 @@ int rf_hackrf_open(hacktv_t *s, const char *serial, uint64_t frequency_hz, unsig
 	if(r != HACKRF_SUCCESS)
 	{
 		fprintf(stderr, "hackrf_baseband_filter_bandwidth_set() failed: %s (%d)\n", hackrf_error_name(r), r);
-		free(rf);
+		_rf_free(rf);
 		return(HACKTV_ERROR);
 	}
 	
@@ -318,7 +210,7 @@ int rf_hackrf_open(hacktv_t *s, const char *serial, uint64_t frequency_hz, unsig
 	if(r != HACKRF_SUCCESS)
 	{
 		fprintf(stderr, "hackrf_set_freq() failed: %s (%d)\n", hackrf_error_name(r), r);
-		free(rf);
+		_rf_free(rf);
 		return(HACKTV_ERROR);
 	}
 	
@@ -326,7 +218,7 @@ int rf_hackrf_open(hacktv_t *s, const char *serial, uint64_t frequency_hz, unsig
 	if(r != HACKRF_SUCCESS)
 	{
 		fprintf(stderr, "hackrf_set_txvga_gain() failed: %s (%d)\n", hackrf_error_name(r), r);
-		free(rf);
+		_rf_free(rf);
 		return(HACKTV_ERROR);
 	}
 	
@@ -334,17 +226,12 @@ int rf_hackrf_open(hacktv_t *s, const char *serial, uint64_t frequency_hz, unsig
 	if(r != HACKRF_SUCCESS)
 	{
 		fprintf(stderr, "hackrf_set_amp_enable() failed: %s (%d)\n", hackrf_error_name(r), r);
-		free(rf);
+		_rf_free(rf);
 		return(HACKTV_ERROR);
 	}
 	
-	r = hackrf_start_tx(rf->d, _tx_callback, rf);
-	if(r != HACKRF_SUCCESS)
-	{
-		fprintf(stderr, "hackrf_start_tx() failed: %s (%d)\n", hackrf_error_name(r), r);
-		free(rf);
-		return(HACKTV_ERROR);
-	}
+	/* TX starts once the buffers reach the prefill mark */
+	rf->started = 0;
 	
 	/* Register the callback functions */
 	s->rf_private = rf;
@@ -19,12 +19,20 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <inttypes.h>
 #include <getopt.h>
 #include <signal.h>
+#include <pthread.h>
 #include "hacktv.h"
 #include "test.h"
 #include "ffmpeg.h"
 #include "file.h"
+#include "tee.h"
+#include "shm.h"
+#include "emu.h"
+#include "rt.h"
+#include "playout.h"
+#include "digest.h"
 #include "hackrf.h"
 
 #ifdef WIN32
@@ -51,7 +59,7 @@ static void _sigint_callback_handler(int signum)
 }
 
 /* RF sink callback handlers */
-static int _hacktv_rf_write(hacktv_t *s, int16_t *iq_data, size_t samples)
+static int _hacktv_rf_write(hacktv_t *s, const int16_t *iq_data, size_t samples)
 {
 	if(s->rf_write)
 	{
@@ -71,11 +79,198 @@ static int _hacktv_rf_close(hacktv_t *s)
 	return(HACKTV_OK);
 }
 
+/* Replay cache for --repeat */
+typedef struct {
+	int16_t *iq;
+	size_t len;
+	size_t size;
+	size_t limit;
+} _iqcache_t;
+
+static int _iqcache_append(_iqcache_t *c, const int16_t *iq, size_t samples)
+{
+	size_t n = samples * 2;
+	
+	if(c->len + n > c->size)
+	{
+		int16_t *p;
+		size_t size = c->size ? c->size * 2 : 1 << 20;
+		
+		while(size < c->len + n) size *= 2;
+		if(size > c->limit) size = c->limit;
+		
+		if(c->len + n > size)
+		{
+			/* Over the size limit */
+			return(HACKTV_ERROR);
+		}
+		
+		p = realloc(c->iq, sizeof(int16_t) * size);
+		if(!p)
+		{
+			return(HACKTV_OUT_OF_MEMORY);
+		}
+		
+		c->iq = p;
+		c->size = size;
+	}
+	
+	memcpy(&c->iq[c->len], iq, sizeof(int16_t) * n);
+	c->len += n;
+	
+	return(HACKTV_OK);
+}
+
+static void _iqcache_free(_iqcache_t *c)
+{
+	free(c->iq);
+	c->iq = NULL;
+	c->len = 0;
+	c->size = 0;
+}
+
+static int _parse_file_type(const char *type)
+{
+	if(strcmp(type, "uint8") == 0) return(HACKTV_UINT8);
+	else if(strcmp(type, "int8") == 0) return(HACKTV_INT8);
+	else if(strcmp(type, "uint16") == 0) return(HACKTV_UINT16);
+	else if(strcmp(type, "int16") == 0) return(HACKTV_INT16);
+	else if(strcmp(type, "int32") == 0) return(HACKTV_INT32);
+	else if(strcmp(type, "float") == 0) return(HACKTV_FLOAT);
+	else if(strcmp(type, "iqz") == 0) return(HACKTV_IQZ);
+	
+	return(-1);
+}
+
+/* Playout of a pre-rendered IQ file. Only a failed output is returned
+ * as an error, a file that can't be played is skipped like any input */
+static int _hacktv_playout(hacktv_t *s, const char *filename, int loop)
+{
+	playout_t p;
+	const int16_t *data;
+	size_t samples;
+	int r = HACKTV_OK;
+	
+	if(playout_open(&p, filename, s->iq_type, s->vid.conf.output_type == HACKTV_INT16_COMPLEX, s->vid.sample_rate, loop) != HACKTV_OK)
+	{
+		return(HACKTV_OK);
+	}
+	
+	while(!_abort && (data = playout_read(&p, &samples)) != NULL)
+	{
+		r = _hacktv_rf_write(s, data, samples);
+		if(r != HACKTV_OK) break;
+	}
+	
+	playout_close(&p);
+	
+	return(r);
+}
+
+/* Background open of the next ffmpeg input */
+typedef struct {
+	hacktv_t *s;
+	int index;
+	char *url;
+	vid_av_source_t src;
+	int r;
+	int active;
+	pthread_t thread;
+} _prefetch_t;
+
+static char *_ffmpeg_input(char *input)
+{
+	char *sub = strchr(input, ':');
+	int l = (sub != NULL ? sub - input : strlen(input));
+	
+	/* Return the URL if this input is opened by ffmpeg, matching
+	 * the input prefixes recognised in main() */
+	if(strncmp(input, "test", l) == 0) return(NULL);
+	else if(strncmp(input, "ffmpeg", l) == 0) return(sub != NULL ? sub + 1 : NULL);
+	else if(strncmp(input, "iq", l) == 0) return(NULL);
+	
+	return(input);
+}
+
+static int _iq_input(char *input)
+{
+	char *sub = strchr(input, ':');
+	int l = (sub != NULL ? sub - input : strlen(input));
+	
+	if(strncmp(input, "test", l) == 0) return(0);
+	else if(strncmp(input, "ffmpeg", l) == 0) return(0);
+	
+	return(strncmp(input, "iq", l) == 0);
+}
+
+static void *_prefetch_thread(void *arg)
+{
+	_prefetch_t *p = arg;
+	
+	rt_thread(RT_DECODER);
+	
+	p->r = av_ffmpeg_open_source(&p->s->vid, &p->src, p->url, p->s->ffmt, p->s->fopts, p->s->scaler);
+	
+	return(NULL);
+}
+
+static void _prefetch_start(_prefetch_t *p, hacktv_t *s, int index, char *input)
+{
+	p->active = 0;
+	p->url = _ffmpeg_input(input);
+	
+	/* Subtitles are loaded into the shared video state while opening,
+	 * so these inputs can't be opened in advance. Everything else the
+	 * input needs, such as the logo and fonts, belongs to the input */
+	if(p->url == NULL || s->vid.conf.subtitles || s->vid.conf.txsubtitles)
+	{
+		return;
+	}
+	
+	p->s = s;
+	p->index = index;
+	p->r = HACKTV_ERROR;
+	
+	if(pthread_create(&p->thread, NULL, _prefetch_thread, p) != 0)
+	{
+		return;
+	}
+	
+	p->active = 1;
+}
+
+static int _prefetch_finish(_prefetch_t *p, vid_t *vid)
+{
+	/* Wait for the open to complete and attach the source */
+	pthread_join(p->thread, NULL);
+	p->active = 0;
+	
+	if(p->r == HACKTV_OK)
+	{
+		vid_av_attach(vid, &p->src);
+	}
+	
+	return(p->r);
+}
+
+static void _prefetch_cancel(_prefetch_t *p)
+{
+	if(!p->active) return;
+	
+	pthread_join(p->thread, NULL);
+	p->active = 0;
+	
+	if(p->r == HACKTV_OK)
+	{
+		p->src.close(p->src.private);
+	}
+}
+
 static void print_usage(void)
 {
 	printf(
 		"\n"
-		"Usage: hacktv [options] input [input...]\n"
+		"Usage: hacktv [options] [--channel options...] input [input...]\n"
 		"\n"
 		"  -o, --output <target>          Set the output device or file, Default: hackrf\n"
 		"  -m, --mode <name>              Set the television mode. Default: i\n"
@@ -88,6 +283,8 @@ static void print_usage(void)
 		"  -r, --repeat                   Repeat the inputs forever.\n"
 		"  -p, --position <value>         Set start position of video in minutes.\n"
 		"  -v, --verbose                  Enable verbose output.\n"
+		"      --repeat-cache <size>      Cache up to <size> MiB of output and replay\n"
+		"                                 it when repeating static inputs.\n"
 		"      --logo <path>              Overlay picture logo over video.\n"
 		"      --timestamp                Overlay video timestamp over video.\n"
 		"      --teletext <path>          Enable teletext output. (625 line modes only)\n"
@@ -151,6 +348,7 @@ static void print_usage(void)
 		"  test:ueitm         Transmit a UEITM test pattern.\n"
 		"  test:fubk          Transmit a FUBK test pattern.\n"
 		"  ffmpeg:<file|url>  Decode and transmit a video file with ffmpeg.\n"
+		"  iq:<file>          Transmit a pre-rendered IQ file. Use - for stdin.\n"
 		"\n"
 		"  If no valid input prefix is provided, ffmpeg: is assumed.\n"
 		"\n"
@@ -159,6 +357,18 @@ static void print_usage(void)
 		"      --ffmt <format>            Force input file format.\n"
 		"      --fopts <option=value[:option2=value]>\n"
 		"                                 Pass option(s) to ffmpeg.\n"
+		"      --scaler <name>            Set the video scaler. Default: bicubic\n"
+		"\n"
+		"  Scalers: bicubic, bilinear, fast-bilinear, area, point and lanczos.\n"
+		"  Video that already matches the active size and format is not scaled.\n"
+		"\n"
+		"IQ input options\n"
+		"\n"
+		"      --iq-type <type>           Set the IQ file data type. Default: int16\n"
+		"\n"
+		"  The file must match the TV mode and sample rate it is transmitted with.\n"
+		"  iqz files are detected automatically. With --repeat and a single input\n"
+		"  the file is looped without a gap.\n"
 		"\n"
 		"HackRF output options\n"
 		"\n"
@@ -166,9 +376,18 @@ static void print_usage(void)
 		"  -f, --frequency <value>        Set the RF frequency in Hz, 0MHz to 7250MHz.\n"
 		"  -a, --amp                      Enable the TX RF amplifier.\n"
 		"  -g, --gain <value>             Set the TX VGA (IF) gain, 0-47dB. Default: 0dB\n"
+		"      --tx-buffers <n>           Set the number of transmit buffers. Default: 32\n"
+		"      --tx-buffer-size <samples> Set the size of each buffer. Default: 1 frame\n"
+		"      --tx-prefill <n>           Fill <n> buffers before starting to transmit.\n"
+		"                                 Default: half the buffers\n"
 		"\n"
 		"  Only modes with a complex output are supported by the HackRF.\n"
 		"\n"
+		"  The buffers set the transmit latency. Fewer or smaller buffers lower it,\n"
+		"  more make the output more robust against stalls. The latency and number\n"
+		"  of underruns are reported at exit, and every second with --verbose.\n"
+		"  The buffer options also apply to the emulated device.\n"
+		"\n"
 		"SoapySDR output options\n"
 		"\n"
 		"  -o, --output soapysdr[:<opts>] Open a SoapySDR device for output.\n"
@@ -179,6 +398,14 @@ static void print_usage(void)
 		"fl2k output options\n"
 		"\n"
 		"  -o, --output fl2k[:<dev>]      Open an fl2k device for output.\n"
+		"      --fl2k-rate <value>        Set the DAC rate in Hz. Default: Sample rate\n"
+		"\n"
+		"  With --fl2k-rate the signal is generated at the sample rate and\n"
+		"  upsampled to the DAC rate on a separate thread. This is cheaper than\n"
+		"  generating at the DAC rate, but a single thread may not keep up with\n"
+		"  the highest DAC rates, complex signals especially. A 'U' is printed\n"
+		"  for each buffer the device had to skip. The DAC rate must not be below\n"
+		"  the sample rate, and the ratio of the two should be kept simple.\n"
 		"\n"
 		"  Real signals are output on the Red channel. Complex signals are output\n"
 		"  on the Red (I) and Green (Q) channels.\n"
@@ -186,6 +413,17 @@ static void print_usage(void)
 		"  The 0.7v p-p voltage level of the FL2K is too low to create a correct\n"
 		"  composite video signal, it will appear too dark without amplification.\n"
 		"\n"
+		"Emulated device output options\n"
+		"\n"
+		"  -o, --output emu               Send the output to an emulated HackRF.\n"
+		"      --emu-jitter <us>          Delay each transfer by up to <us> microseconds.\n"
+		"      --emu-stall <ms>           Stall the emulated device for <ms> milliseconds.\n"
+		"      --emu-stall-every <sec>    Set the time between stalls. Default: 1\n"
+		"\n"
+		"  The emulated device takes samples at the sample rate, with the same\n"
+		"  buffering as the HackRF output. It reports the number of transfers,\n"
+		"  underruns and transfers missed during stalls when it is closed.\n"
+		"\n"
 		"File output options\n"
 		"\n"
 		"  -o, --output file:<filename>   Open a file for output. Use - for stdout.\n"
@@ -199,12 +437,86 @@ static void print_usage(void)
 		"  int16\n"
 		"  int32\n"
 		"  float\n"
+		"  iqz      (Compressed int16 with an index, sample rate, frequency and mode)\n"
 		"\n"
 		"  The default output is int16. The TV mode will determine if the output\n"
 		"  is real or complex.\n"
 		"\n"
 		"  If no valid output prefix is provided, file: is assumed.\n"
 		"\n"
+		"Tee output options\n"
+		"\n"
+		"  -o, --output tee:<target>[,<target>...]\n"
+		"                                 Send the same output to several targets,\n"
+		"                                 e.g. tee:hackrf,file:out.iq\n"
+		"      --tee-log <path>           Log where each target's dropped blocks were\n"
+		"                                 replaced with silence.\n"
+		"\n"
+		"  Each target is written on its own thread. The first target sets the pace;\n"
+		"  if any other falls more than half a second behind, blocks are dropped\n"
+		"  for it and replaced with silence, and the count is reported at exit.\n"
+		"  The log has a line for each run of silence, giving the target, the\n"
+		"  sample it starts at in that target's output and its length in samples.\n"
+		"  If a target other than the first fails, it is detached and the rest\n"
+		"  carry on. Digest outputs cannot be used in a tee.\n"
+		"\n"
+		"Shared memory output options\n"
+		"\n"
+		"  -o, --output shm:<name>        Publish the output in a POSIX shared memory\n"
+		"                                 ring for other programs to read.\n"
+		"\n"
+		"  The ring holds half a second of int16 I/Q samples after a header with the\n"
+		"  sample rate, frequency, mode and a write counter. The layout is described\n"
+		"  in shm.h. Readers may attach and detach at any time; a reader that falls\n"
+		"  more than the ring behind is overrun and skips ahead. When it is the only\n"
+		"  or first output, the ring is written in real time. An existing ring is\n"
+		"  only replaced if no other writer has it open.\n"
+		"\n"
+		"Digest output options\n"
+		"\n"
+		"  -o, --output digest:<filename> Write CRC32 digests of the output instead of\n"
+		"                                 the signal. Use - for stdout.\n"
+		"  -o, --output check:<filename>  Compare the output against a digest file and\n"
+		"                                 report the first block and stage that differ.\n"
+		"      --fixed-time <seconds>     Use a fixed time for clocks, dates and seeds.\n"
+		"      --frames <n>               Stop after <n> frames.\n"
+		"\n"
+		"  A record is written for every 25 lines and at the end of each frame. It\n"
+		"  holds a CRC of the lines leaving each stage of the video pipeline and of\n"
+		"  the output samples. Use --fixed-time and --frames for repeatable runs.\n"
+		"\n"
+		"Real-time options\n"
+		"\n"
+		"      --rt-generator <settings>  Set the CPUs and scheduling of the threads\n"
+		"                                 generating the signal.\n"
+		"      --rt-sink <settings>       Set the CPUs and scheduling of the threads\n"
+		"                                 feeding the outputs.\n"
+		"      --rt-decoder <settings>    Set the CPUs and scheduling of the threads\n"
+		"                                 reading and decoding the inputs.\n"
+		"      --mlock                    Lock the video tables and buffers into RAM.\n"
+		"\n"
+		"  Settings are [<cpus>][:<policy>[:<priority>]], e.g. 2-3:fifo:20, 4,6\n"
+		"  or :rr. The CPUs are a list of numbers and ranges. The policy is other,\n"
+		"  fifo or rr. Real-time policies default to priority 10, below the kernel's\n"
+		"  interrupt threads. They need CAP_SYS_NICE or an rtprio limit, and\n"
+		"  --mlock needs a locked memory limit (ulimit -l) large enough for the\n"
+		"  mode's tables. Settings that can't be applied are reported and skipped.\n"
+		"  Once any is given, the settings each class of thread ends up with are\n"
+		"  reported at start-up. With a locked memory limit, memory allocated\n"
+		"  after start-up is not locked. These options are taken from the first\n"
+		"  channel.\n"
+		"\n"
+		"Multiple channels\n"
+		"\n"
+		"      --channel                  Start the options for another channel.\n"
+		"\n"
+		"  Each channel has its own output, mode and scrambling options, and is\n"
+		"  rendered from the same inputs on its own thread. Channels with the same\n"
+		"  picture size and frame rate share one decoder, unless they draw a logo,\n"
+		"  timestamp or subtitles. The input options, --repeat and --frames are\n"
+		"  taken from the first channel. Outputs sharing a decoder are held in step,\n"
+		"  so they should be driven from the same clock.\n"
+		"\n"
 		"Supported television modes:\n"
 		"\n"
 		"  i             = PAL colour, 25 fps, 625 lines, AM (complex), 6.0 MHz FM audio\n"
@@ -456,9 +768,125 @@ enum {
 	_OPT_FFMT,
 	_OPT_FOPTS,
 	_OPT_PIXELRATE,
+	_OPT_REPEAT_CACHE,
+	_OPT_IQ_TYPE,
+	_OPT_FIXED_TIME,
+	_OPT_FRAMES,
+	_OPT_SCALER,
+	_OPT_FL2K_RATE,
+	_OPT_TX_BUFFERS,
+	_OPT_TX_BUFFER_SIZE,
+	_OPT_TX_PREFILL,
+	_OPT_EMU_JITTER,
+	_OPT_EMU_STALL,
+	_OPT_EMU_STALL_EVERY,
+	_OPT_RT_GENERATOR,
+	_OPT_RT_SINK,
+	_OPT_RT_DECODER,
+	_OPT_MLOCK,
+	_OPT_TEE_LOG,
 };
 
-int main(int argc, char *argv[])
+static int _hacktv_output(char *output, char **type, char **target)
+{
+	char *pre, *sub;
+	
+	
+	/* Get a pointer to the output prefix and target */
+	pre = output;
+	sub = strchr(pre, ':');
+	
+	if(sub != NULL)
+	{
+		/* Split the optarg into two */
+		*sub = '\0';
+		sub++;
+	}
+	
+	/* Try to match the prefix with a known type */
+	if(strcmp(pre, "file") == 0)
+	{
+		*type = "file";
+		*target = sub;
+	}
+	else if(strcmp(pre, "hackrf") == 0)
+	{
+		*type = "hackrf";
+		*target = sub;
+	}
+	else if(strcmp(pre, "soapysdr") == 0)
+	{
+#ifdef HAVE_SOAPYSDR
+		*type = "soapysdr";
+		*target = sub;
+#else
+		fprintf(stderr, "SoapySDR support is not available in this build of hacktv.\n");
+		return(HACKTV_ERROR);
+#endif
+	}
+	else if(strcmp(pre, "fl2k") == 0)
+	{
+#ifdef HAVE_FL2K
+		*type = "fl2k";
+		*target = sub;
+#else
+		fprintf(stderr, "FL2K support is not available in this build of hacktv.\n");
+		return(HACKTV_ERROR);
+#endif
+	}
+	else if(strcmp(pre, "emu") == 0)
+	{
+#ifndef WIN32
+		*type = "emu";
+		*target = sub;
+#else
+		fprintf(stderr, "The emulated device is not available in this build of hacktv.\n");
+		return(HACKTV_ERROR);
+#endif
+	}
+	else if(strcmp(pre, "shm") == 0)
+	{
+#ifndef WIN32
+		*type = "shm";
+		*target = sub;
+#else
+		fprintf(stderr, "Shared memory output is not available in this build of hacktv.\n");
+		return(HACKTV_ERROR);
+#endif
+	}
+	else if(strcmp(pre, "tee") == 0)
+	{
+		*type = "tee";
+		*target = sub;
+	}
+	else if(strcmp(pre, "digest") == 0)
+	{
+		*type = "digest";
+		*target = sub;
+	}
+	else if(strcmp(pre, "check") == 0)
+	{
+		*type = "check";
+		*target = sub;
+	}
+	else
+	{
+		/* Unrecognised output type, default to file */
+		if(sub != NULL)
+		{
+			/* Recolonise */
+			sub--;
+			*sub = ':';
+		}
+		
+		*type = "file";
+		*target = pre;
+	}
+	
+	return(HACKTV_OK);
+}
+
+static int _hacktv_options(hacktv_t *s, int argc, char *argv[])
 {
 	int c;
 	int option_index;
@@ -472,6 +900,7 @@ int main(int argc, char *argv[])
 		{ "gamma",          required_argument, 0, 'G' },
 		{ "interlace",      no_argument,       0, 'i' },
 		{ "repeat",         no_argument,       0, 'r' },
+		{ "repeat-cache",   required_argument, 0, _OPT_REPEAT_CACHE },
 		{ "verbose",        no_argument,       0, 'v' },
 		{ "teletext",       required_argument, 0, _OPT_TELETEXT },
 		{ "wss",            required_argument, 0, _OPT_WSS },
@@ -525,6 +954,22 @@ int main(int argc, char *argv[])
 		{ "secam-field-id", no_argument,       0, _OPT_SECAM_FIELD_ID },
 		{ "ffmt",           required_argument, 0, _OPT_FFMT },
 		{ "fopts",          required_argument, 0, _OPT_FOPTS },
+		{ "scaler",         required_argument, 0, _OPT_SCALER },
+		{ "iq-type",        required_argument, 0, _OPT_IQ_TYPE },
+		{ "fixed-time",     required_argument, 0, _OPT_FIXED_TIME },
+		{ "frames",         required_argument, 0, _OPT_FRAMES },
+		{ "fl2k-rate",      required_argument, 0, _OPT_FL2K_RATE },
+		{ "tx-buffers",     required_argument, 0, _OPT_TX_BUFFERS },
+		{ "tx-buffer-size", required_argument, 0, _OPT_TX_BUFFER_SIZE },
+		{ "tx-prefill",     required_argument, 0, _OPT_TX_PREFILL },
+		{ "emu-jitter",     required_argument, 0, _OPT_EMU_JITTER },
+		{ "emu-stall",      required_argument, 0, _OPT_EMU_STALL },
+		{ "emu-stall-every", required_argument, 0, _OPT_EMU_STALL_EVERY },
+		{ "rt-generator",   required_argument, 0, _OPT_RT_GENERATOR },
+		{ "rt-sink",        required_argument, 0, _OPT_RT_SINK },
+		{ "rt-decoder",     required_argument, 0, _OPT_RT_DECODER },
+		{ "mlock",          no_argument,       0, _OPT_MLOCK },
+		{ "tee-log",        required_argument, 0, _OPT_TEE_LOG },
 		{ "frequency",      required_argument, 0, 'f' },
 		{ "amp",            no_argument,       0, 'a' },
 		{ "gain",           required_argument, 0, 'g' },
@@ -540,520 +985,595 @@ int main(int argc, char *argv[])
 		{ "volume",         required_argument, 0, _OPT_VOLUME },
 		{ 0,                0,                 0,  0  }
 	};
-	static hacktv_t s;
-	const vid_configs_t *vid_confs;
-	vid_config_t vid_conf;
-	char *pre, *sub;
-	int l;
-	int r;
-	
-	/* Disable console output buffer in Windows */
-	#ifdef WIN32
-	setvbuf(stdout, NULL, _IONBF, 0);
-	setvbuf(stderr, NULL, _IONBF, 0);
-	#endif
 	
 	/* Initialise the state */
-	memset(&s, 0, sizeof(hacktv_t));
+	memset(s, 0, sizeof(hacktv_t));
 	
 	/* Default configuration */
-	s.output_type = "hackrf";
-	s.output = NULL;
-	s.mode = "i";
-	s.samplerate = 20250000;
-	s.pixelrate = 0;
-	s.level = 1.0;
-	s.deviation = -1;
-	s.gamma = -1;
-	s.interlace = 0;
-	s.repeat = 0;
-	s.verbose = 0;
-	s.teletext = NULL;
-	s.position = 0;
-	s.wss = NULL;
-	s.letterbox = 0;
-	s.pillarbox = 0;
-	s.videocrypt = NULL;
-	s.videocrypt2 = NULL;
-	s.videocrypts = NULL;
-	s.showserial = 0;
-	s.findkey = 0;
-	s.eurocrypt = NULL;
-	s.syster = NULL;
-	s.d11 = NULL;
-	s.systercnr = NULL;
-	s.systeraudio = 0;
-	s.acp = 0;
-	s.vits = 0;
-	s.vitc = 0;
-	s.filter = 0;
-	s.nocolour = 0;
-	s.noaudio = 0;
-	s.nonicam = 0;
-	s.a2stereo = 0;
-	s.scramble_video = 0;
-	s.scramble_audio = 0;
-	s.chid = -1;
-	s.mac_audio_stereo = MAC_STEREO;
-	s.mac_audio_quality = MAC_HIGH_QUALITY;
-	s.mac_audio_companded = MAC_COMPANDED;
-	s.mac_audio_protection = MAC_FIRST_LEVEL_PROTECTION;
-	s.frequency = 0;
-	s.amp = 0;
-	s.gain = 0;
-	s.antenna = NULL;
-	s.file_type = HACKTV_INT16;
-	s.logo = NULL;
-	s.timestamp = 0;
-	s.enableemm = 0;
-	s.disableemm = 0;
-	s.showecm = 0;
-	s.subtitles = 0;
-	s.txsubtitles = 0;
-	s.volume = 1;
-	s.downmix = 0;
-	s.ec_ppv = NULL;
-	s.nodate = 0;
+	s->output_type = "hackrf";
+	s->output = NULL;
+	s->mode = "i";
+	s->samplerate = 20250000;
+	s->pixelrate = 0;
+	s->level = 1.0;
+	s->deviation = -1;
+	s->gamma = -1;
+	s->interlace = 0;
+	s->repeat = 0;
+	s->repeat_cache = 0;
+	s->verbose = 0;
+	s->teletext = NULL;
+	s->position = 0;
+	s->wss = NULL;
+	s->letterbox = 0;
+	s->pillarbox = 0;
+	s->videocrypt = NULL;
+	s->videocrypt2 = NULL;
+	s->videocrypts = NULL;
+	s->showserial = 0;
+	s->findkey = 0;
+	s->eurocrypt = NULL;
+	s->syster = NULL;
+	s->d11 = NULL;
+	s->systercnr = NULL;
+	s->systeraudio = 0;
+	s->acp = 0;
+	s->vits = 0;
+	s->vitc = 0;
+	s->filter = 0;
+	s->nocolour = 0;
+	s->noaudio = 0;
+	s->nonicam = 0;
+	s->a2stereo = 0;
+	s->scramble_video = 0;
+	s->scramble_audio = 0;
+	s->chid = -1;
+	s->mac_audio_stereo = MAC_STEREO;
+	s->mac_audio_quality = MAC_HIGH_QUALITY;
+	s->mac_audio_companded = MAC_COMPANDED;
+	s->mac_audio_protection = MAC_FIRST_LEVEL_PROTECTION;
+	s->frequency = 0;
+	s->amp = 0;
+	s->gain = 0;
+	s->antenna = NULL;
+	s->file_type = HACKTV_INT16;
+	s->logo = NULL;
+	s->timestamp = 0;
+	s->enableemm = 0;
+	s->disableemm = 0;
+	s->showecm = 0;
+	s->subtitles = 0;
+	s->txsubtitles = 0;
+	s->volume = 1;
+	s->downmix = 0;
+	s->ec_ppv = NULL;
+	s->nodate = 0;
+	s->iq_type = HACKTV_INT16;
+	s->fl2k_rate = 0;
+	s->tx_buffers = 0;
+	s->tx_buffer_size = 0;
+	s->tx_prefill = -1;
+	s->emu_jitter = 0;
+	s->emu_stall = 0;
+	s->emu_stall_every = 1.0;
+	s->rt_generator = NULL;
+	s->rt_sink = NULL;
+	s->rt_decoder = NULL;
+	s->mlock = 0;
+	s->tee_log = NULL;
 	
 	opterr = 0;
+	optind = 0;
 	while((c = getopt_long(argc, argv, "o:m:s:D:G:irvf:al:g:A:t:p:", long_options, &option_index)) != -1)
 	{
 		switch(c)
 		{
 		case 'o': /* -o, --output <[type:]target> */
-			
-			/* Get a pointer to the output prefix and target */
-			pre = optarg;
-			sub = strchr(pre, ':');
-			
-			if(sub != NULL)
-			{
-				/* Split the optarg into two */
-				*sub = '\0';
-				sub++;
-			}
-			
-			/* Try to match the prefix with a known type */
-			if(strcmp(pre, "file") == 0)
-			{
-				s.output_type = "file";
-				s.output = sub;
-			}
-			else if(strcmp(pre, "hackrf") == 0)
-			{
-				s.output_type = "hackrf";
-				s.output = sub;
-			}
-			else if(strcmp(pre, "soapysdr") == 0)
-			{
-#ifdef HAVE_SOAPYSDR
-				s.output_type = "soapysdr";
-				s.output = sub;
-#else
-				fprintf(stderr, "SoapySDR support is not available in this build of hacktv.\n");
-				return(-1);
-#endif
-			}
-			else if(strcmp(pre, "fl2k") == 0)
-			{
-#ifdef HAVE_FL2K
-				s.output_type = "fl2k";
-				s.output = sub;
-#else
-				fprintf(stderr, "FL2K support is not available in this build of hacktv.\n");
-				return(-1);
-#endif
-			}
-			else
+			if(_hacktv_output(optarg, &s->output_type, &s->output) != HACKTV_OK)
 			{
-				/* Unrecognised output type, default to file */
-				if(sub != NULL)
-				{
-					/* Recolonise */
-					sub--;
-					*sub = ':';
-				}
-				
-				s.output_type = "file";
-				s.output = pre;
+				return(HACKTV_ERROR);
 			}
-			
 			break;
 		
 		case 'm': /* -m, --mode <name> */
-			s.mode = optarg;
+			s->mode = optarg;
 			break;
 		
 		case 's': /* -s, --samplerate <value> */
-			s.samplerate = atoi(optarg);
+			s->samplerate = atoi(optarg);
 			break;
 		
 		case _OPT_PIXELRATE: /* --pixelrate <value> */
-			s.pixelrate = atoi(optarg);
+			s->pixelrate = atoi(optarg);
 			break;
 		
 		case 'l': /* -l, --level <value> */
-			s.level = atof(optarg);
+			s->level = atof(optarg);
 			break;
 		
 		case 'D': /* -D, --deviation <value> */
-			s.deviation = atof(optarg);
+			s->deviation = atof(optarg);
 			break;
 		
 		case 'G': /* -G, --gamma <value> */
-			s.gamma = atof(optarg);
+			s->gamma = atof(optarg);
 			break;
 		
 		case 'i': /* -i, --interlace */
-			s.interlace = 1;
+			s->interlace = 1;
 			break;
 		
 		case 'r': /* -r, --repeat */
-			s.repeat = 1;
+			s->repeat = 1;
+			break;
+		
+		case _OPT_REPEAT_CACHE: /* --repeat-cache <size> */
+			s->repeat_cache = atoi(optarg);
 			break;
 		
 		case 'v': /* -v, --verbose */
-			s.verbose = 1;
+			s->verbose = 1;
 			break;
 		
 		case _OPT_TELETEXT: /* --teletext <path> */
-			s.teletext = optarg;
+			s->teletext = optarg;
 			break;
 		
 		case _OPT_WSS: /* --wss <mode> */
-			s.wss = optarg;
+			s->wss = optarg;
 			break;
 			
 		case _OPT_LETTERBOX: /* --letterbox */
-			s.letterbox = 1;
+			s->letterbox = 1;
 			break;
 			
 		case _OPT_PILLARBOX: /* --pillarbox */
-			s.pillarbox = 1;
+			s->pillarbox = 1;
 			break;
 		
 		case _OPT_VIDEOCRYPT: /* --videocrypt */
-			s.videocrypt = optarg;
+			s->videocrypt = optarg;
 			break;
 
 		case _OPT_VIDEOCRYPT2: /* --videocrypt2 */
-			s.videocrypt2 = optarg;
+			s->videocrypt2 = optarg;
 			break;
 		
 		case _OPT_VIDEOCRYPTS: /* --videocrypts */
-			s.videocrypts = optarg;
+			s->videocrypts = optarg;
 			break;
 		
 		case _OPT_ENABLE_EMM: /* --enable-emm <card_serial> */
-			s.enableemm = (uint32_t) strtod(optarg, NULL);
+			s->enableemm = (uint32_t) strtod(optarg, NULL);
 			break;
 
 		case _OPT_DISABLE_EMM: /* --disable-emm <card_serial> */
-			s.disableemm = (uint32_t) strtod(optarg, NULL);
+			s->disableemm = (uint32_t) strtod(optarg, NULL);
 			break;
 		
 		case _OPT_FINDKEY: /* --findkey */
-			s.findkey = 1;
+			s->findkey = 1;
 			break;
 			
 		case _OPT_SHOWSERIAL: /* --showserial */
-			s.showserial = 1;
+			s->showserial = 1;
 			break;
 			
 		case _OPT_SHOW_ECM: /* --showecm */
-			s.showecm = 1;
+			s->showecm = 1;
 			break;
 		
 		case _OPT_SYSTER: /* --syster */
-			free(s.syster);
-			s.syster = strdup(optarg);
+			free(s->syster);
+			s->syster = strdup(optarg);
 			break;
 			
 		case _OPT_SYSTER_KT1: /* --key-table-1 */
-			s.scramble_video = 1;
+			s->scramble_video = 1;
 			break;
 		
 		case _OPT_SYSTER_KT2: /* --key-table-2 */
-			s.scramble_video = 2;
+			s->scramble_video = 2;
 			break;
 			
 		case _OPT_DISCRET: /* --d11 */
-			free(s.d11);
-			s.d11 = strdup(optarg);
+			free(s->d11);
+			s->d11 = strdup(optarg);
 			break;
 		
 		case _OPT_SMARTCRYPT: /* --systercnr */
-			free(s.systercnr);
-			s.systercnr = strdup(optarg);
+			free(s->systercnr);
+			s->systercnr = strdup(optarg);
 			break;
 			
 		case _OPT_SYSTERAUDIO: /* --systeraudio */
-			s.systeraudio = 1;
+			s->systeraudio = 1;
 			break;
 			
 		case _OPT_VOLUME: /* --volume */
-			s.volume = atof(optarg);
+			s->volume = atof(optarg);
 			break;
 			
 		case _OPT_DOWNMIX: /* --downmix */
-			s.downmix = 1;
+			s->downmix = 1;
 			break;
 			
 		case _OPT_ACP: /* --acp */
-			s.acp = 1;
+			s->acp = 1;
 			break;
 		
 		case _OPT_VITS: /* --vits */
-			s.vits = 1;
+			s->vits = 1;
 			break;
 		
 		case _OPT_VITC: /* --vitc */
-			s.vitc = 1;
+			s->vitc = 1;
 			break;
 		
 		case _OPT_FILTER: /* --filter */
-			s.filter = 1;
+			s->filter = 1;
 			break;
 			
 		case _OPT_SUBTITLES: /* --subtitles */
-			s.subtitles = 1;
+			s->subtitles = 1;
 			if(!optarg && NULL != argv[optind] && '-' != argv[optind][0])
 			{
-				s.subtitles = atof(argv[optind++]);
+				s->subtitles = atof(argv[optind++]);
 			}
 			break;
 			
 		case _OPT_TX_SUBTITLES: /* --tx-subtitles */
-			s.txsubtitles = 1;
+			s->txsubtitles = 1;
 			if(!optarg && NULL != argv[optind] && '-' != argv[optind][0])
 			{
-				s.txsubtitles = atof(argv[optind++]);
+				s->txsubtitles = atof(argv[optind++]);
 			}
 			break;
 		
 		case _OPT_NODATE: /* --nodate */
-			s.nodate = 1;
+			s->nodate = 1;
 			break;
 			
 		case _OPT_LOGO: /* --logo <path> */
-			free(s.logo);
-			s.logo = strdup(optarg);
+			free(s->logo);
+			s->logo = strdup(optarg);
 			break;
 			
 		case _OPT_TIMECODE: /* --timestamp */
-			s.timestamp = 1;
+			s->timestamp = 1;
 			break;
 			
 		case 'p': /* -p, --position <value> */
-			s.position = atof(optarg);
+			s->position = atof(optarg);
 			break;
 			
 		case _OPT_NOCOLOUR: /* --nocolour / --nocolor */
-			s.nocolour = 1;
+			s->nocolour = 1;
 			break;
 		
 		case _OPT_NOAUDIO: /* --noaudio */
-			s.noaudio = 1;
+			s->noaudio = 1;
 			break;
 		
 		case _OPT_NONICAM: /* --nonicam */
-			s.nonicam = 1;
+			s->nonicam = 1;
 			break;
 		
 		case _OPT_A2STEREO: /* --a2stereo */
-			s.a2stereo = 1;
+			s->a2stereo = 1;
 			break;
 		
 		case _OPT_SINGLE_CUT: /* --single-cut */
-			s.scramble_video = 1;
+			s->scramble_video = 1;
 			break;
 		
 		case _OPT_DOUBLE_CUT: /* --double-cut */
-			s.scramble_video = 2;
+			s->scramble_video = 2;
 			break;
 		
 		case _OPT_EUROCRYPT: /* --eurocrypt */
-			s.eurocrypt = optarg;
+			s->eurocrypt = optarg;
 			break;
 		
 		case _OPT_EC_MAT_RATING: /* --ec-mat-rating */
-			s.ec_mat_rating = atoi(optarg);
+			s->ec_mat_rating = atoi(optarg);
 			break;
 		
 		case _OPT_EC_PPV: /* --ec-ppv */
-			s.ec_ppv = "0,0";
+			s->ec_ppv = "0,0";
 			if(!optarg && NULL != argv[optind] && '-' != argv[optind][0])
 			{
-				s.ec_ppv = argv[optind++];
+				s->ec_ppv = argv[optind++];
 			}
 			break;
 			
 		case _OPT_SCRAMBLE_AUDIO: /* --scramble-audio */
-			s.scramble_audio = 1;
+			s->scramble_audio = 1;
 			break;
 		
 		case _OPT_CHID: /* --chid <id> */
-			s.chid = strtol(optarg, NULL, 0);
+			s->chid = strtol(optarg, NULL, 0);
 			break;
 		
 		case _OPT_MAC_AUDIO_STEREO: /* --mac-audio-stereo */
-			s.mac_audio_stereo = MAC_STEREO;
+			s->mac_audio_stereo = MAC_STEREO;
 			break;
 		
 		case _OPT_MAC_AUDIO_MONO: /* --mac-audio-mono */
-			s.mac_audio_stereo = MAC_MONO;
+			s->mac_audio_stereo = MAC_MONO;
 			break;
 		
 		case _OPT_MAC_AUDIO_HIGH_QUALITY: /* --mac-audio-high-quality */
-			s.mac_audio_quality = MAC_HIGH_QUALITY;
+			s->mac_audio_quality = MAC_HIGH_QUALITY;
 			break;
 		
 		case _OPT_MAC_AUDIO_MEDIUM_QUALITY: /* --mac-audio-medium-quality */
-			s.mac_audio_quality = MAC_MEDIUM_QUALITY;
+			s->mac_audio_quality = MAC_MEDIUM_QUALITY;
 			break;
 		
 		case _OPT_MAC_AUDIO_COMPANDED: /* --mac-audio-companded */
-			s.mac_audio_companded = MAC_COMPANDED;
+			s->mac_audio_companded = MAC_COMPANDED;
 			break;
 		
 		case _OPT_MAC_AUDIO_LINEAR: /* --mac-audio-linear */
-			s.mac_audio_companded = MAC_LINEAR;
+			s->mac_audio_companded = MAC_LINEAR;
 			break;
 		
 		case _OPT_MAC_AUDIO_L1_PROTECTION: /* --mac-audio-l1-protection */
-			s.mac_audio_protection = MAC_FIRST_LEVEL_PROTECTION;
+			s->mac_audio_protection = MAC_FIRST_LEVEL_PROTECTION;
 			break;
 		
 		case _OPT_MAC_AUDIO_L2_PROTECTION: /* --mac-audio-l2-protection */
-			s.mac_audio_protection = MAC_SECOND_LEVEL_PROTECTION;
+			s->mac_audio_protection = MAC_SECOND_LEVEL_PROTECTION;
 			break;
 
 		case _OPT_OFFSET: /* --offset <value Hz> */
-			s.offset = (int64_t) strtod(optarg, NULL);
+			s->offset = (int64_t) strtod(optarg, NULL);
 			break;
 		
 		case _OPT_PASSTHRU: /* --passthru <path> */
-			s.passthru = optarg;
+			s->passthru = optarg;
 			break;
 		
 		case _OPT_INVERT_VIDEO: /* --invert-video */
-			s.invert_video = 1;
+			s->invert_video = 1;
 			break;
 		
 		case _OPT_SECAM_FIELD_ID: /* --secam-field-id */
-			s.secam_field_id = 1;
+			s->secam_field_id = 1;
 			break;
 		
 		case _OPT_FFMT: /* --ffmt <format> */
-			s.ffmt = optarg;
+			s->ffmt = optarg;
 			break;
 		
 		case _OPT_FOPTS: /* --fopts <option=value:[option2=value...]> */
-			s.fopts = optarg;
+			s->fopts = optarg;
+			break;
+		
+		case _OPT_SCALER: /* --scaler <name> */
+			
+			if(av_ffmpeg_parse_scaler(optarg) < 0)
+			{
+				fprintf(stderr, "Unrecognised scaler '%s'.\n", optarg);
+				return(HACKTV_ERROR);
+			}
+			
+			s->scaler = optarg;
 			break;
 		
 		case 'f': /* -f, --frequency <value> */
-			s.frequency = (uint64_t) strtod(optarg, NULL);
+			s->frequency = (uint64_t) strtod(optarg, NULL);
 			break;
 		
 		case 'a': /* -a, --amp */
-			s.amp = 1;
+			s->amp = 1;
 			break;
 		
 		case 'g': /* -g, --gain <value> */
-			s.gain = atoi(optarg);
+			s->gain = atoi(optarg);
 			break;
 		
 		case 'A': /* -A, --antenna <name> */
-			s.antenna = optarg;
+			s->antenna = optarg;
 			break;
 		
 		case 't': /* -t, --type <type> */
 			
-			if(strcmp(optarg, "uint8") == 0)
-			{
-				s.file_type = HACKTV_UINT8;
-			}
-			else if(strcmp(optarg, "int8") == 0)
-			{
-				s.file_type = HACKTV_INT8;
-			}
-			else if(strcmp(optarg, "uint16") == 0)
-			{
-				s.file_type = HACKTV_UINT16;
-			}
-			else if(strcmp(optarg, "int16") == 0)
-			{
-				s.file_type = HACKTV_INT16;
-			}
-			else if(strcmp(optarg, "int32") == 0)
-			{
-				s.file_type = HACKTV_INT32;
-			}
-			else if(strcmp(optarg, "float") == 0)
+			s->file_type = _parse_file_type(optarg);
+			
+			if(s->file_type < 0)
 			{
-				s.file_type = HACKTV_FLOAT;
+				fprintf(stderr, "Unrecognised file data type.\n");
+				return(HACKTV_ERROR);
 			}
-			else
+			
+			break;
+		
+		case _OPT_IQ_TYPE: /* --iq-type <type> */
+			
+			s->iq_type = _parse_file_type(optarg);
+			
+			if(s->iq_type < 0)
 			{
-				fprintf(stderr, "Unrecognised file data type.\n");
-				return(-1);
+				fprintf(stderr, "Unrecognised IQ file data type.\n");
+				return(HACKTV_ERROR);
 			}
 			
 			break;
 		
+		case _OPT_FIXED_TIME: /* --fixed-time <seconds> */
+			set_wall_time((time_t) strtoll(optarg, NULL, 10));
+			break;
+		
+		case _OPT_FRAMES: /* --frames <n> */
+			s->frames = atoi(optarg);
+			break;
+		
+		case _OPT_FL2K_RATE: /* --fl2k-rate <value> */
+			s->fl2k_rate = atoi(optarg);
+			break;
+		
+		case _OPT_TX_BUFFERS: /* --tx-buffers <n> */
+			s->tx_buffers = atoi(optarg);
+			break;
+		
+		case _OPT_TX_BUFFER_SIZE: /* --tx-buffer-size <samples> */
+			s->tx_buffer_size = atoi(optarg);
+			break;
+		
+		case _OPT_TX_PREFILL: /* --tx-prefill <n> */
+			s->tx_prefill = atoi(optarg);
+			break;
+		
+		case _OPT_EMU_JITTER: /* --emu-jitter <us> */
+			s->emu_jitter = atoi(optarg);
+			break;
+		
+		case _OPT_EMU_STALL: /* --emu-stall <ms> */
+			s->emu_stall = atoi(optarg);
+			break;
+		
+		case _OPT_EMU_STALL_EVERY: /* --emu-stall-every <seconds> */
+			s->emu_stall_every = atof(optarg);
+			break;
+		
+		case _OPT_RT_GENERATOR: /* --rt-generator <settings> */
+			s->rt_generator = optarg;
+			break;
+		
+		case _OPT_RT_SINK: /* --rt-sink <settings> */
+			s->rt_sink = optarg;
+			break;
+		
+		case _OPT_RT_DECODER: /* --rt-decoder <settings> */
+			s->rt_decoder = optarg;
+			break;
+		
+		case _OPT_MLOCK: /* --mlock */
+			s->mlock = 1;
+			break;
+		
+		case _OPT_TEE_LOG: /* --tee-log <path> */
+			s->tee_log = optarg;
+			break;
+		
 		case '?':
 			print_usage();
-			return(0);
+			exit(0);
 		}
 	}
 	
-	if(optind >= argc)
+	return(HACKTV_OK);
+}
+
+static int _hacktv_tee_output(hacktv_t *s, char *target, int paced);
+
+static int _hacktv_rf_open(hacktv_t *s, char *type, char *target, int paced)
+{
+	if(strcmp(type, "hackrf") == 0)
 	{
-		fprintf(stderr, "No input specified.\n");
-		return(-1);
+		return(rf_hackrf_open(s, target, s->frequency, s->gain, s->amp));
 	}
-	
-	/* Load the mode configuration */
-	for(vid_confs = vid_configs; vid_confs->id != NULL; vid_confs++)
+#ifdef HAVE_SOAPYSDR
+	else if(strcmp(type, "soapysdr") == 0)
 	{
-		if(strcmp(s.mode, vid_confs->id) == 0) break;
+		return(rf_soapysdr_open(s, target, s->frequency, s->gain, s->antenna));
 	}
-	
-	if(vid_confs->id == NULL)
+#endif
+#ifdef HAVE_FL2K
+	else if(strcmp(type, "fl2k") == 0)
 	{
-		fprintf(stderr, "Unrecognised TV mode.\n");
-		return(-1);
+		return(rf_fl2k_open(s, target, s->fl2k_rate));
+	}
+#endif
+	else if(strcmp(type, "file") == 0)
+	{
+		return(rf_file_open(s, target, s->file_type));
+	}
+#ifndef WIN32
+	else if(strcmp(type, "emu") == 0)
+	{
+		return(rf_emu_open(s, s->emu_jitter, s->emu_stall, s->emu_stall_every));
+	}
+	else if(strcmp(type, "shm") == 0)
+	{
+		return(rf_shm_open(s, target, paced));
+	}
+#endif
+	else if(strcmp(type, "tee") == 0)
+	{
+		return(rf_tee_open(s, target, _hacktv_tee_output));
+	}
+	else if(strcmp(type, "digest") == 0 ||
+	        strcmp(type, "check") == 0)
+	{
+		return(rf_digest_open(s, target, strcmp(type, "check") == 0));
+	}
+	
+	return(HACKTV_ERROR);
+}
+
+static int _hacktv_tee_output(hacktv_t *s, char *target, int paced)
+{
+	char *type;
+	
+	if(_hacktv_output(target, &type, &target) != HACKTV_OK)
+	{
+		return(HACKTV_ERROR);
+	}
+	
+	/* The digest sinks read the stage checksums as each line is
+	 * written, which a tee output does some time later */
+	if(strcmp(type, "tee") == 0 ||
+	   strcmp(type, "digest") == 0 ||
+	   strcmp(type, "check") == 0)
+	{
+		fprintf(stderr, "A %s output cannot be used in a tee.\n", type);
+		return(HACKTV_ERROR);
+	}
+	
+	return(_hacktv_rf_open(s, type, target, paced));
+}
+
+static int _hacktv_open(hacktv_t *s)
+{
+	const vid_configs_t *vid_confs;
+	vid_config_t vid_conf;
+	int r;
+	
+	/* Load the mode configuration */
+	for(vid_confs = vid_configs; vid_confs->id != NULL; vid_confs++)
+	{
+		if(strcmp(s->mode, vid_confs->id) == 0) break;
+	}
+	
+	if(vid_confs->id == NULL)
+	{
+		fprintf(stderr, "Unrecognised TV mode.\n");
+		return(HACKTV_ERROR);
 	}
-	
-	/* Catch all the signals */
-	signal(SIGINT, &_sigint_callback_handler);
-	signal(SIGILL, &_sigint_callback_handler);
-	signal(SIGFPE, &_sigint_callback_handler);
-	signal(SIGSEGV, &_sigint_callback_handler);
-	signal(SIGTERM, &_sigint_callback_handler);
-	signal(SIGABRT, &_sigint_callback_handler);
 	
 	memcpy(&vid_conf, vid_confs->conf, sizeof(vid_config_t));
 	
-	if(s.deviation > 0)
+	if(s->deviation > 0)
 	{
 		/* Override the FM deviation value */
-		vid_conf.fm_deviation = s.deviation;
+		vid_conf.fm_deviation = s->deviation;
 	}
 	
-	if(s.gamma > 0)
+	if(s->gamma > 0)
 	{
 		/* Override the gamma value */
-		vid_conf.gamma = s.gamma;
+		vid_conf.gamma = s->gamma;
 	}
 	
-	if(s.interlace)
+	if(s->interlace)
 	{
 		vid_conf.interlace = 1;
 	}
 	
-	if(s.nocolour)
+	if(s->nocolour)
 	{
 		if(vid_conf.colour_mode == VID_PAL ||
 		   vid_conf.colour_mode == VID_SECAM ||
@@ -1063,7 +1583,7 @@ int main(int argc, char *argv[])
 		}
 	}
 	
-	if(s.noaudio > 0)
+	if(s->noaudio > 0)
 	{
 		/* Disable all audio sub-carriers */
 		vid_conf.fm_mono_level = 0;
@@ -1080,257 +1600,257 @@ int main(int argc, char *argv[])
 		vid_conf.am_mono_carrier = 0;
 	}
 	
-	if(s.nonicam > 0)
+	if(s->nonicam > 0)
 	{
 		/* Disable the NICAM sub-carrier */
 		vid_conf.nicam_level = 0;
 		vid_conf.nicam_carrier = 0;
 	}
 	
-	if(s.a2stereo > 0)
+	if(s->a2stereo > 0)
 	{
 		vid_conf.a2stereo = 1;
 	}
 	
-	vid_conf.scramble_video = s.scramble_video;
-	vid_conf.scramble_audio = s.scramble_audio;
+	vid_conf.scramble_video = s->scramble_video;
+	vid_conf.scramble_audio = s->scramble_audio;
 	
-	vid_conf.level *= s.level;
-	vid_conf.mode = s.mode;
+	vid_conf.level *= s->level;
+	vid_conf.mode = s->mode;
 	
-	if(s.teletext)
+	if(s->teletext)
 	{
 		if(vid_conf.lines != 625)
 		{
 			fprintf(stderr, "Teletext is only available with 625 line modes.\n");
-			return(-1);
+			return(HACKTV_ERROR);
 		}
 		
-		vid_conf.teletext = s.teletext;
+		vid_conf.teletext = s->teletext;
 	}
 	
-	if(s.logo)
+	if(s->logo)
 	{
-		asprintf(&vid_conf.logo, "%s", s.logo);
+		asprintf(&vid_conf.logo, "%s", s->logo);
 	}
 	
-	if(s.position)
+	if(s->position)
 	{
-		vid_conf.position = s.position;
+		vid_conf.position = s->position;
 	}
 
-	if(s.timestamp)
+	if(s->timestamp)
 	{
-		vid_conf.timestamp = time(0);
+		vid_conf.timestamp = wall_time();
 	}
 	
-	if(s.wss)
+	if(s->wss)
 	{
 		if(vid_conf.lines != 625)
 		{
 			fprintf(stderr, "WSS is only available with 625 line modes.\n");
-			return(-1);
+			return(HACKTV_ERROR);
 		}
 		
-		vid_conf.wss = s.wss;
+		vid_conf.wss = s->wss;
 	}
 	
-	if(s.letterbox)
+	if(s->letterbox)
 	{
-		vid_conf.letterbox = s.letterbox;
+		vid_conf.letterbox = s->letterbox;
 	}
 	
-	if(s.pillarbox)
+	if(s->pillarbox)
 	{
-		if(s.letterbox)
+		if(s->letterbox)
 		{
 			fprintf(stderr, "Pillarbox mode cannot be used together with letterbox mode.\n");
-			return(-1);
+			return(HACKTV_ERROR);
 		}
 		
-		vid_conf.pillarbox = s.pillarbox;
+		vid_conf.pillarbox = s->pillarbox;
 	}
 	
-	if(s.videocrypt)
+	if(s->videocrypt)
 	{
 		if(vid_conf.lines != 625 && vid_conf.colour_mode != VID_PAL)
 		{
 			fprintf(stderr, "Videocrypt I is only compatible with 625 line PAL modes.\n");
-			return(-1);
+			return(HACKTV_ERROR);
 		}
 		
-		vid_conf.videocrypt = s.videocrypt;
+		vid_conf.videocrypt = s->videocrypt;
 	}
 	
-	if(s.videocrypt2)
+	if(s->videocrypt2)
 	{
 		if(vid_conf.lines != 625 && vid_conf.colour_mode != VID_PAL)
 		{
 			fprintf(stderr, "Videocrypt II is only compatible with 625 line PAL modes.\n");
-			return(-1);
+			return(HACKTV_ERROR);
 		}
 		
-		if(s.videocrypt && (strcmp(s.videocrypt, "conditional") == 0 && strcmp(s.videocrypt2, "free") == 0))
+		if(s->videocrypt && (strcmp(s->videocrypt, "conditional") == 0 && strcmp(s->videocrypt2, "free") == 0))
 		{
 			fprintf(stderr, "Videocrypt II in free mode only work with Videocrypt I in free mode.\n");
-			return(-1);
+			return(HACKTV_ERROR);
 		}
 		
-		vid_conf.videocrypt2 = s.videocrypt2;
+		vid_conf.videocrypt2 = s->videocrypt2;
 	}
 	
-	if(s.videocrypts)
+	if(s->videocrypts)
 	{
 		if(vid_conf.lines != 625 && vid_conf.colour_mode != VID_PAL)
 		{
 			fprintf(stderr, "Videocrypt S is only compatible with 625 line PAL modes.\n");
-			return(-1);
+			return(HACKTV_ERROR);
 		}
 		
-		if(s.videocrypt || s.videocrypt2)
+		if(s->videocrypt || s->videocrypt2)
 		{
 			fprintf(stderr, "Using multiple scrambling modes is not supported.\n");
-			return(-1);
+			return(HACKTV_ERROR);
 		}
 		
-		vid_conf.videocrypts = s.videocrypts;
+		vid_conf.videocrypts = s->videocrypts;
 	}
 	
-	if(s.showserial)
+	if(s->showserial)
 	{
-		if(!s.videocrypt)
+		if(!s->videocrypt)
 		{
 			fprintf(stderr, "'--showserial' is only supported in Videocrypt mode.\n");
-			return(-1);
+			return(HACKTV_ERROR);
 		}
 		
-		vid_conf.showserial = s.showserial;
+		vid_conf.showserial = s->showserial;
 	}
 	
-	if(s.findkey)
+	if(s->findkey)
 	{
-		if(!s.videocrypt || (s.videocrypt && !(strcmp(s.videocrypt, "ppv") == 0)))
+		if(!s->videocrypt || (s->videocrypt && !(strcmp(s->videocrypt, "ppv") == 0)))
 		{
 			fprintf(stderr, "'--findkey' is only supported in Videocrypt PPV mode.\n");
-			return(-1);
+			return(HACKTV_ERROR);
 		}
 		
-		vid_conf.findkey = s.findkey;
+		vid_conf.findkey = s->findkey;
 	}
 	
-	if(s.eurocrypt)
+	if(s->eurocrypt)
 	{
 		if(vid_conf.lines != 625 && vid_conf.colour_mode != VID_MAC)
 		{
 			fprintf(stderr, "Eurocrypt is only compatible with MAC modes.\n");
-			return(-1);
+			return(HACKTV_ERROR);
 		}
-		vid_conf.eurocrypt = s.eurocrypt;
+		vid_conf.eurocrypt = s->eurocrypt;
 	}
 	
-	if(s.ec_mat_rating)
+	if(s->ec_mat_rating)
 	{
-		if(!s.eurocrypt)
+		if(!s->eurocrypt)
 		{
 			fprintf(stderr, "Maturing rating option is only used in conjunction with Eurocrypt.\n");
-			return(-1);
+			return(HACKTV_ERROR);
 		}
-		vid_conf.ec_mat_rating = s.ec_mat_rating;
+		vid_conf.ec_mat_rating = s->ec_mat_rating;
 	}
 	
-	if(s.ec_ppv)
+	if(s->ec_ppv)
 	{
-		if(!s.eurocrypt)
+		if(!s->eurocrypt)
 		{
 			fprintf(stderr, "PPV option is only used in conjunction with Eurocrypt.\n");
-			return(-1);
+			return(HACKTV_ERROR);
 		}
-		vid_conf.ec_ppv = s.ec_ppv;
+		vid_conf.ec_ppv = s->ec_ppv;
 	}
 	
-	if(s.enableemm)
+	if(s->enableemm)
 	{
-		if((s.videocrypt && 
-		!(strcmp(s.videocrypt, "sky07") == 0 ||
-		  strcmp(s.videocrypt, "sky09") == 0)
+		if((s->videocrypt && 
+		!(strcmp(s->videocrypt, "sky07") == 0 ||
+		  strcmp(s->videocrypt, "sky09") == 0)
 		) ||
-		(s.videocrypt2 && !(strcmp(s.videocrypt2, "conditional") == 0)))
+		(s->videocrypt2 && !(strcmp(s->videocrypt2, "conditional") == 0)))
 		{
 			fprintf(stderr, "EMMs are currently only supported in sky07, sky09 and Videocrypt 2 mode.\n");
-			return(-1);
+			return(HACKTV_ERROR);
 		}
 		
-		vid_conf.enableemm = s.enableemm;
+		vid_conf.enableemm = s->enableemm;
 	}
 	
-	if(s.disableemm)
+	if(s->disableemm)
 	{
-		if((s.videocrypt && 
-		!(strcmp(s.videocrypt, "sky07") == 0 ||
-		  strcmp(s.videocrypt, "sky09") == 0)
+		if((s->videocrypt && 
+		!(strcmp(s->videocrypt, "sky07") == 0 ||
+		  strcmp(s->videocrypt, "sky09") == 0)
 		) ||
-		(s.videocrypt2 && !(strcmp(s.videocrypt2, "conditional") == 0)))
+		(s->videocrypt2 && !(strcmp(s->videocrypt2, "conditional") == 0)))
 		{
 			fprintf(stderr, "EMMs are currently only supported in sky07, sky09 and Videocrypt 2 mode.\n");
-			return(-1);
+			return(HACKTV_ERROR);
 		}
 		
-		vid_conf.disableemm = s.disableemm;
+		vid_conf.disableemm = s->disableemm;
 	}
 	
-	if(s.showecm)
+	if(s->showecm)
 	{
-		vid_conf.showecm = s.showecm;
+		vid_conf.showecm = s->showecm;
 	}
 	
-	if(s.d11)
+	if(s->d11)
 	{
 		if(vid_conf.lines != 625 && vid_conf.colour_mode != VID_SECAM)
 		{
 			fprintf(stderr, "Discret 11 is only compatible with 625 line PAL modes.\n");
-			return(-1);
+			return(HACKTV_ERROR);
 		}
 		
 		if(vid_conf.videocrypt || vid_conf.videocrypt2 || vid_conf.videocrypts)
 		{
 			fprintf(stderr, "Using multiple scrambling modes is not supported.\n");
-			return(-1);
+			return(HACKTV_ERROR);
 		}
 		
-		vid_conf.d11 = s.d11;
-		vid_conf.systeraudio = s.systeraudio;
+		vid_conf.d11 = s->d11;
+		vid_conf.systeraudio = s->systeraudio;
 	}
 	
-	if(s.downmix)
+	if(s->downmix)
 	{
-		vid_conf.downmix = s.downmix;
+		vid_conf.downmix = s->downmix;
 	}
 	
-	if(s.syster || s.systercnr)
+	if(s->syster || s->systercnr)
 	{
 		if(vid_conf.lines != 625 && vid_conf.colour_mode != VID_PAL)
 		{
 			fprintf(stderr, "Nagravision Syster is only compatible with 625 line PAL modes.\n");
-			return(-1);
+			return(HACKTV_ERROR);
 		}
 		
 		if(vid_conf.videocrypt || vid_conf.videocrypt2 || vid_conf.videocrypts || vid_conf.d11)
 		{
 			fprintf(stderr, "Using multiple scrambling modes is not supported.\n");
-			return(-1);
+			return(HACKTV_ERROR);
 		}
 		
-		vid_conf.syster = s.syster;
-		vid_conf.systercnr = s.systercnr;
-		vid_conf.systeraudio = s.systeraudio;
+		vid_conf.syster = s->syster;
+		vid_conf.systercnr = s->systercnr;
+		vid_conf.systeraudio = s->systeraudio;
 	}
 	
-	if(s.eurocrypt)
+	if(s->eurocrypt)
 	{
 		if(vid_conf.type != VID_MAC)
 		{
 			fprintf(stderr, "Eurocrypt is only compatible with D/D2-MAC modes.\n");
-			return(-1);
+			return(HACKTV_ERROR);
 		}
 		
 		if(vid_conf.scramble_video == 0)
@@ -1339,60 +1859,60 @@ int main(int argc, char *argv[])
 			vid_conf.scramble_video = 1;
 		}
 		
-		vid_conf.eurocrypt = s.eurocrypt;
+		vid_conf.eurocrypt = s->eurocrypt;
 	}
 	
-	if(s.acp)
+	if(s->acp)
 	{
 		if(vid_conf.lines != 625 && vid_conf.lines != 525)
 		{
 			fprintf(stderr, "Analogue Copy Protection is only compatible with 525 and 625 line modes.\n");
-			return(-1);
+			return(HACKTV_ERROR);
 		}
 		
 		if(vid_conf.videocrypt || vid_conf.videocrypt2 || vid_conf.videocrypts || vid_conf.syster)
 		{
 			fprintf(stderr, "Analogue Copy Protection cannot be used with video scrambling enabled.\n");
-			return(-1);
+			return(HACKTV_ERROR);
 		}
 		
 		vid_conf.acp = 1;
 	}
 	
-	if(s.subtitles)
+	if(s->subtitles)
 	{
-		vid_conf.subtitles = s.subtitles;
+		vid_conf.subtitles = s->subtitles;
 	}
 	
-	if(s.txsubtitles)
+	if(s->txsubtitles)
 	{
-		vid_conf.txsubtitles = s.txsubtitles;
+		vid_conf.txsubtitles = s->txsubtitles;
 	}
 
-	if(s.nodate)
+	if(s->nodate)
 	{
-		vid_conf.nodate = s.nodate;
+		vid_conf.nodate = s->nodate;
 	}
 	
-	if(s.vits)
+	if(s->vits)
 	{
 		if(vid_conf.type != VID_RASTER_625 &&
 		   vid_conf.type != VID_RASTER_525)
 		{
 			fprintf(stderr, "VITS is only currently supported for 625 and 525 line raster modes.\n");
-			return(-1);
+			return(HACKTV_ERROR);
 		}
 		
 		vid_conf.vits = 1;
 	}
 	
-	if(s.vitc)
+	if(s->vitc)
 	{
 		if(vid_conf.type != VID_RASTER_625 &&
 		   vid_conf.type != VID_RASTER_525)
 		{
 			fprintf(stderr, "VITC is only currently supported for 625 and 525 line raster modes.\n");
-			return(-1);
+			return(HACKTV_ERROR);
 		}
 		
 		vid_conf.vitc = 1;
@@ -1400,83 +1920,130 @@ int main(int argc, char *argv[])
 	
 	if(vid_conf.type == VID_MAC)
 	{
-		if(s.chid >= 0)
+		if(s->chid >= 0)
 		{
-			vid_conf.chid = (uint16_t) s.chid;
+			vid_conf.chid = (uint16_t) s->chid;
 		}
 		
-		vid_conf.mac_audio_stereo = s.mac_audio_stereo;
-		vid_conf.mac_audio_quality = s.mac_audio_quality;
-		vid_conf.mac_audio_protection = s.mac_audio_protection;
-		vid_conf.mac_audio_companded = s.mac_audio_companded;
+		vid_conf.mac_audio_stereo = s->mac_audio_stereo;
+		vid_conf.mac_audio_quality = s->mac_audio_quality;
+		vid_conf.mac_audio_protection = s->mac_audio_protection;
+		vid_conf.mac_audio_companded = s->mac_audio_companded;
 	}
 	
-	if(s.filter)
+	if(s->filter)
 	{
 		vid_conf.vfilter = 1;
 	}
 	
-	vid_conf.offset = s.offset;
-	vid_conf.passthru = s.passthru;
-	vid_conf.volume = s.volume;
-	vid_conf.invert_video = s.invert_video;
-	vid_conf.secam_field_id = s.secam_field_id;
+	vid_conf.offset = s->offset;
+	vid_conf.passthru = s->passthru;
+	vid_conf.volume = s->volume;
+	vid_conf.invert_video = s->invert_video;
+	vid_conf.secam_field_id = s->secam_field_id;
 	
 	/* Setup video encoder */
-	r = vid_init(&s.vid, s.samplerate, s.pixelrate, &vid_conf);
+	r = vid_init(&s->vid, s->samplerate, s->pixelrate, &vid_conf);
 	if(r != VID_OK)
 	{
 		fprintf(stderr, "Unable to initialise video encoder.\n");
-		return(-1);
+		return(HACKTV_ERROR);
 	}
 	
-	vid_info(&s.vid);
+	vid_info(&s->vid);
 	
-	if(strcmp(s.output_type, "hackrf") == 0)
+	if(_hacktv_rf_open(s, s->output_type, s->output, 1) != HACKTV_OK)
 	{
-		if(rf_hackrf_open(&s, s.output, s.frequency, s.gain, s.amp) != HACKTV_OK)
-		{
-			vid_free(&s.vid);
-			return(-1);
-		}
+		vid_free(&s->vid);
+		return(HACKTV_ERROR);
 	}
-#ifdef HAVE_SOAPYSDR
-	else if(strcmp(s.output_type, "soapysdr") == 0)
+	
+	return(HACKTV_OK);
+}
+
+static int _hacktv_render(hacktv_t *s, _iqcache_t *cache, int *record)
+{
+	/* Send the current input to the RF sink until it ends, the
+	 * sink fails or the program is stopped. Returns 1 once the
+	 * frame limit has been reached */
+	while(!_abort)
 	{
-		if(rf_soapysdr_open(&s, s.output, s.frequency, s.gain, s.antenna) != HACKTV_OK)
+		size_t samples;
+		int16_t *data = vid_next_line(&s->vid, &samples);
+		
+		if(data == NULL) break;
+		
+		if(_hacktv_rf_write(s, data, samples) != HACKTV_OK) break;
+		
+		if(s->frames > 0 && s->vid.bframe > s->frames && s->vid.bline == 1)
 		{
-			vid_free(&s.vid);
-			return(-1);
+			return(1);
 		}
-	}
-#endif
-#ifdef HAVE_FL2K
-	else if(strcmp(s.output_type, "fl2k") == 0)
-	{
-		if(rf_fl2k_open(&s, s.output) != HACKTV_OK)
+		
+		if(record && *record && _iqcache_append(cache, data, samples) != HACKTV_OK)
 		{
-			vid_free(&s.vid);
-			return(-1);
+			fprintf(stderr, "The output is larger than the repeat cache.\n");
+			*record = 0;
 		}
 	}
-#endif
-	else if(strcmp(s.output_type, "file") == 0)
+	
+	return(0);
+}
+
+static void _hacktv_run(hacktv_t *s, char **inputs, int ninputs)
+{
+	char *pre, *sub;
+	int c, l, r;
+	_iqcache_t cache;
+	int period, replay, pass;
+	_prefetch_t prefetch;
+	
+	/* The replay cache is only used when the whole output repeats */
+	memset(&cache, 0, sizeof(_iqcache_t));
+	memset(&prefetch, 0, sizeof(_prefetch_t));
+	cache.limit = (size_t) s->repeat_cache * 1024 * 1024 / sizeof(int16_t);
+	period = 0;
+	replay = 0;
+	pass = 0;
+	
+	if(s->repeat && s->repeat_cache > 0)
 	{
-		if(rf_file_open(&s, s.output, s.file_type) != HACKTV_OK)
+		period = vid_repeat_period(&s->vid);
+		
+		if(period == 0)
 		{
-			vid_free(&s.vid);
-			return(-1);
+			fprintf(stderr, "The output has dynamic elements and cannot be cached.\n");
 		}
 	}
 	
-	av_ffmpeg_init();
-	
 	do
 	{
-		for(c = optind; c < argc && !_abort; c++)
+		/* The first pass starts from an empty pipeline, so the second
+		 * is recorded. It ends on the same point in the colour and
+		 * scrambler sequences as it started if its length in lines is
+		 * a multiple of the period */
+		int record = period > 0 && pass == 1;
+		int64_t start = (int64_t) s->vid.bframe * s->vid.conf.lines + s->vid.bline;
+		
+		if(replay)
+		{
+			size_t i, n;
+			
+			for(i = 0; i < cache.len && !_abort; i += n)
+			{
+				n = cache.len - i;
+				if(n > s->vid.width * 2) n = s->vid.width * 2;
+				
+				if(_hacktv_rf_write(s, &cache.iq[i], n / 2) != HACKTV_OK) break;
+			}
+			
+			continue;
+		}
+		
+		for(c = 0; c < ninputs && !_abort; c++)
 		{
 			/* Get a pointer to the output prefix and target */
-			pre = argv[c];
+			pre = inputs[c];
 			sub = strchr(pre, ':');
 			
 			if(sub != NULL)
@@ -1489,33 +2056,273 @@ int main(int argc, char *argv[])
 				l = strlen(pre);
 			}
 			
-			if(strncmp(pre, "test", l) == 0)
+			if(prefetch.active && prefetch.index == c)
+			{
+				/* This input was opened while the last one played */
+				r = _prefetch_finish(&prefetch, &s->vid);
+			}
+			else if(strncmp(pre, "test", l) == 0)
 			{
-				r = av_test_open(&s.vid, sub);
+				r = av_test_open(&s->vid, sub);
 			}
 			else if(strncmp(pre, "ffmpeg", l) == 0)
 			{
-				r = av_ffmpeg_open(&s.vid, sub, s.ffmt, s.fopts);
+				r = av_ffmpeg_open(&s->vid, sub, s->ffmt, s->fopts, s->scaler);
+			}
+			else if(strncmp(pre, "iq", l) == 0)
+			{
+				/* IQ files bypass the video encoder. A lone
+				 * repeating input is looped by the reader */
+				if(_hacktv_playout(s, sub, s->repeat && ninputs == 1) != HACKTV_OK)
+				{
+					fprintf(stderr, "Error writing to the output. Stopping.\n");
+					_abort = 1;
+				}
+				
+				record = 0;
+				continue;
 			}
 			else
 			{
-				r = av_ffmpeg_open(&s.vid, pre, s.ffmt, s.fopts);
+				r = av_ffmpeg_open(&s->vid, pre, s->ffmt, s->fopts, s->scaler);
 			}
 			
 			if(r != HACKTV_OK)
 			{
 				/* Error opening this source. Move to the next */
+				record = 0;
 				continue;
 			}
 			
-			while(!_abort)
+			/* Open the next input in the background, so it is
+			 * ready to start on the frame after this one ends */
+			if(c + 1 < ninputs)
+			{
+				_prefetch_start(&prefetch, s, c + 1, inputs[c + 1]);
+			}
+			else if(s->repeat && period == 0)
+			{
+				_prefetch_start(&prefetch, s, 0, inputs[0]);
+			}
+			
+			if(_hacktv_render(s, &cache, &record))
 			{
-				size_t samples;
-				int16_t *data = vid_next_line(&s.vid, &samples);
+				/* Reached the frame limit */
+				_abort = 1;
+			}
+			
+			if(_signal)
+			{
+				fprintf(stderr, "Caught signal %d\n", _signal);
+				_signal = 0;
+			}
+			
+			vid_av_close(&s->vid);
+		}
+		
+		if(record && !_abort)
+		{
+			int64_t lines = (int64_t) s->vid.bframe * s->vid.conf.lines + s->vid.bline - start;
+			
+			if(lines % period == 0)
+			{
+				if(s->verbose)
+				{
+					fprintf(stderr, "Replaying %" PRId64 " lines from the repeat cache.\n", lines);
+				}
 				
-				if(data == NULL) break;
+				replay = 1;
+			}
+			else
+			{
+				fprintf(stderr, "The input length is not a multiple of %d lines and cannot be cached.\n", period);
+			}
+		}
+		
+		if(!replay)
+		{
+			_iqcache_free(&cache);
+		}
+		
+		pass++;
+	}
+	while(s->repeat && !_abort);
+	
+	_prefetch_cancel(&prefetch);
+	_iqcache_free(&cache);
+}
+
+/* Several channels rendered from the same inputs, each on its own thread */
+typedef struct {
+	hacktv_t *s;
+	pthread_t thread;
+	int started;
+	int limit;
+} _channel_t;
+
+static void *_channel_thread(void *arg)
+{
+	_channel_t *ch = arg;
+	
+	rt_thread(RT_GENERATOR);
+	
+	ch->limit = _hacktv_render(ch->s, NULL, NULL);
+	
+	/* Closing the source lets any channels sharing
+	 * its decoder carry on without this one */
+	vid_av_close(&ch->s->vid);
+	
+	return(NULL);
+}
+
+static int _channels_open(hacktv_t *s, vid_t **vids, vid_av_source_t *srcs, int n, char *input)
+{
+	char *url = _ffmpeg_input(input);
+	char *sub = strchr(input, ':');
+	int l = (sub != NULL ? sub - input : strlen(input));
+	int i, r;
+	
+	if(url == NULL && strncmp(input, "test", l) != 0)
+	{
+		/* Only a test input opens without a URL */
+		fprintf(stderr, "No URL given for input '%s'.\n", input);
+		return(HACKTV_ERROR);
+	}
+	
+	if(url != NULL)
+	{
+		/* Decode once for each group of channels that can share it */
+		r = av_ffmpeg_open_shared(vids, srcs, n, url, s->ffmt, s->fopts, s->scaler);
+		
+		if(r == HACKTV_OK)
+		{
+			for(i = 0; i < n; i++)
+			{
+				vid_av_attach(vids[i], &srcs[i]);
+			}
+		}
+		
+		return(r);
+	}
+	
+	/* Test inputs are cheap enough to open for each channel */
+	for(i = 0; i < n; i++)
+	{
+		r = av_test_open(vids[i], sub != NULL ? sub + 1 : NULL);
+		
+		if(r != HACKTV_OK)
+		{
+			while(i--) vid_av_close(vids[i]);
+			return(r);
+		}
+	}
+	
+	return(HACKTV_OK);
+}
+
+static int _channels_prefetch(hacktv_t *s, int n)
+{
+	int i;
+	
+	/* Subtitles are loaded into the channel's video state while
+	 * opening, so these inputs can't be opened in advance. The rest
+	 * belongs to the input, and is attached when the channels switch */
+	for(i = 0; i < n; i++)
+	{
+		if(s[i].vid.conf.subtitles || s[i].vid.conf.txsubtitles)
+		{
+			return(0);
+		}
+	}
+	
+	return(1);
+}
+
+static void _hacktv_run_channels(hacktv_t *s, int n, char **inputs, int ninputs)
+{
+	_channel_t *ch;
+	vid_t **vids;
+	vid_av_source_t *srcs, *next;
+	char *url;
+	int c, i, r, limit, prefetch;
+	
+	ch = calloc(n, sizeof(_channel_t));
+	vids = calloc(n, sizeof(vid_t *));
+	srcs = calloc(n * 2, sizeof(vid_av_source_t));
+	
+	if(!ch || !vids || !srcs)
+	{
+		fprintf(stderr, "Out of memory.\n");
+		free(ch);
+		free(vids);
+		free(srcs);
+		return;
+	}
+	
+	next = &srcs[n];
+	
+	for(i = 0; i < n; i++)
+	{
+		ch[i].s = &s[i];
+		vids[i] = &s[i].vid;
+	}
+	
+	prefetch = 0;
+	
+	do
+	{
+		for(c = 0; c < ninputs && !_abort; c++)
+		{
+			if(prefetch)
+			{
+				/* This input was opened while the last one played */
+				for(i = 0; i < n; i++)
+				{
+					vid_av_attach(vids[i], &next[i]);
+				}
+				
+				prefetch = 0;
+			}
+			else if(_channels_open(s, vids, srcs, n, inputs[c]) != HACKTV_OK)
+			{
+				/* Error opening this source. Move to the next */
+				continue;
+			}
+			
+			for(i = 0; i < n; i++)
+			{
+				ch[i].limit = 0;
+				ch[i].started = pthread_create(&ch[i].thread, NULL, _channel_thread, &ch[i]) == 0;
+				
+				if(!ch[i].started)
+				{
+					fprintf(stderr, "Error starting channel %d thread.\n", i + 1);
+					vid_av_close(vids[i]);
+					_abort = 1;
+				}
+			}
+			
+			/* Open the next input while this one plays */
+			url = c + 1 < ninputs ? _ffmpeg_input(inputs[c + 1]) : NULL;
+			
+			if(url != NULL && !_abort && _channels_prefetch(s, n))
+			{
+				r = av_ffmpeg_open_shared(vids, next, n, url, s->ffmt, s->fopts, s->scaler);
+				prefetch = (r == HACKTV_OK);
+			}
+			
+			for(limit = 0, i = 0; i < n; i++)
+			{
+				if(!ch[i].started) continue;
 				
-				if(_hacktv_rf_write(&s, data, samples) != HACKTV_OK) break;
+				pthread_join(ch[i].thread, NULL);
+				limit |= ch[i].limit;
+			}
+			
+			if(limit)
+			{
+				/* Reached the frame limit */
+				_abort = 1;
 			}
 			
 			if(_signal)
@@ -1523,19 +2330,170 @@ int main(int argc, char *argv[])
 				fprintf(stderr, "Caught signal %d\n", _signal);
 				_signal = 0;
 			}
+		}
+	}
+	while(s->repeat && !_abort);
+	
+	if(prefetch)
+	{
+		for(i = 0; i < n; i++)
+		{
+			next[i].close(next[i].private);
+		}
+	}
+	
+	free(ch);
+	free(vids);
+	free(srcs);
+}
+
+int main(int argc, char *argv[])
+{
+	hacktv_t *s;
+	char **args, **inputs;
+	int channels, ninputs;
+	int c, i, n;
+	int r;
+	
+	/* Disable console output buffer in Windows */
+	#ifdef WIN32
+	setvbuf(stdout, NULL, _IONBF, 0);
+	setvbuf(stderr, NULL, _IONBF, 0);
+	#endif
+	
+	/* Each --channel starts the options for another channel */
+	for(channels = 1, c = 1; c < argc; c++)
+	{
+		if(strcmp(argv[c], "--channel") == 0) channels++;
+	}
+	
+	s = calloc(channels, sizeof(hacktv_t));
+	args = calloc(argc + 1, sizeof(char *));
+	inputs = calloc(argc, sizeof(char *));
+	
+	if(!s || !args || !inputs)
+	{
+		fprintf(stderr, "Out of memory.\n");
+		return(-1);
+	}
+	
+	for(ninputs = 0, c = 1, i = 0; i < channels; i++, c++)
+	{
+		/* Copy out this channel's arguments */
+		args[0] = argv[0];
+		
+		for(n = 1; c < argc && strcmp(argv[c], "--channel") != 0; c++)
+		{
+			args[n++] = argv[c];
+		}
+		
+		args[n] = NULL;
+		
+		if(_hacktv_options(&s[i], n, args) != HACKTV_OK)
+		{
+			return(-1);
+		}
+		
+		/* Anything that isn't an option is an input */
+		for(; optind < n; optind++)
+		{
+			inputs[ninputs++] = args[optind];
+		}
+	}
+	
+	if(ninputs == 0)
+	{
+		fprintf(stderr, "No input specified.\n");
+		return(-1);
+	}
+	
+	if(channels > 1)
+	{
+		for(c = 0; c < ninputs; c++)
+		{
+			if(_iq_input(inputs[c]))
+			{
+				fprintf(stderr, "IQ inputs can't be used with more than one channel.\n");
+				return(-1);
+			}
+		}
+		
+		if(s[0].repeat_cache > 0)
+		{
+			fprintf(stderr, "The repeat cache is not used with more than one channel.\n");
+		}
+		
+		/* All channels stop together */
+		for(i = 1; i < channels; i++)
+		{
+			s[i].frames = s[0].frames;
+		}
+	}
+	
+	/* Catch all the signals */
+	signal(SIGINT, &_sigint_callback_handler);
+	signal(SIGILL, &_sigint_callback_handler);
+	signal(SIGFPE, &_sigint_callback_handler);
+	signal(SIGSEGV, &_sigint_callback_handler);
+	signal(SIGTERM, &_sigint_callback_handler);
+	signal(SIGABRT, &_sigint_callback_handler);
+	
+	/* Set up before the outputs start their threads */
+	if(rt_init(s[0].rt_generator, s[0].rt_sink, s[0].rt_decoder, s[0].mlock) != HACKTV_OK)
+	{
+		return(-1);
+	}
+	
+	for(i = 0; i < channels; i++)
+	{
+		if(_hacktv_open(&s[i]) != HACKTV_OK)
+		{
+			while(i--)
+			{
+				_hacktv_rf_close(&s[i]);
+				vid_free(&s[i].vid);
+			}
 			
-			vid_av_close(&s.vid);
+			return(-1);
 		}
 	}
-	while(s.repeat && !_abort);
 	
-	_hacktv_rf_close(&s);
-	vid_free(&s.vid);
+	/* Lock the memory once the video tables and buffers are allocated */
+	if(s[0].mlock)
+	{
+		rt_lock();
+	}
+	
+	av_ffmpeg_init();
+	
+	rt_thread(RT_GENERATOR);
+	
+	if(channels == 1)
+	{
+		_hacktv_run(s, inputs, ninputs);
+	}
+	else
+	{
+		_hacktv_run_channels(s, channels, inputs, ninputs);
+	}
+	
+	for(r = HACKTV_OK, i = 0; i < channels; i++)
+	{
+		if(_hacktv_rf_close(&s[i]) != HACKTV_OK)
+		{
+			r = HACKTV_ERROR;
+		}
+		
+		vid_free(&s[i].vid);
+	}
 	
 	av_ffmpeg_deinit();
 	
+	free(inputs);
+	free(args);
+	free(s);
+	
 	fprintf(stderr, "\n");
 	
-	return(0);
+	return(r == HACKTV_OK ? 0 : 1);
 }
-
@@ -36,6 +36,7 @@
 #define HACKTV_INT16  3
 #define HACKTV_INT32  4
 #define HACKTV_FLOAT  5 /* 32-bit float */
+#define HACKTV_IQZ    6 /* Compressed int16 container */
 
 /* Standard audio sample rate */
 #define HACKTV_AUDIO_SAMPLE_RATE 32000
@@ -45,8 +46,9 @@ typedef uint32_t *(*hacktv_av_read_video_t)(void *private, float *ratio);
 typedef int16_t *(*hacktv_av_read_audio_t)(void *private, size_t *samples);
 typedef int (*hacktv_av_close_t)(void *private);
 
-/* RF output function prototypes */
-typedef int (*hacktv_rf_write_t)(void *private, int16_t *iq_data, size_t samples);
+/* RF output function prototypes. The samples passed to rf_write may be
+ * read-only memory, such as a mapped IQ file, and must not be changed */
+typedef int (*hacktv_rf_write_t)(void *private, const int16_t *iq_data, size_t samples);
 typedef int (*hacktv_rf_close_t)(void *private);
 
 /* Program state */
@@ -63,6 +65,7 @@ typedef struct {
 	float gamma;
 	int interlace;
 	int repeat;
+	int repeat_cache;
 	int verbose;
 	char *d11;
 	char *systercnr;
@@ -118,6 +121,21 @@ typedef struct {
 	int secam_field_id;
 	char *ffmt;
 	char *fopts;
+	char *scaler;
+	int iq_type;
+	int frames;
+	unsigned int fl2k_rate;
+	int tx_buffers;
+	int tx_buffer_size;
+	int tx_prefill;
+	int emu_jitter;
+	int emu_stall;
+	float emu_stall_every;
+	char *rt_generator;
+	char *rt_sink;
+	char *rt_decoder;
+	int mlock;
+	char *tee_log;
 	
 	/* Video encoder state */
 	vid_t vid;
@@ -0,0 +1,199 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "hugepage.h"
+
+#ifdef WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+/* Each allocation starts with a header, the caller's
+ * memory follows it on the next cache line */
+#define HUGE_HEADER 64
+
+typedef struct {
+	int type;
+	size_t length;
+} _huge_header_t;
+
+static void *_huge_init(void *p, int type, size_t length)
+{
+	_huge_header_t *h = p;
+	
+	h->type = type;
+	h->length = length;
+	
+	return((uint8_t *) p + HUGE_HEADER);
+}
+
+#ifndef WIN32
+
+#ifdef MADV_HUGEPAGE
+static int _thp_enabled(void)
+{
+	static int enabled = -1;
+	char buf[64];
+	FILE *f;
+	int e;
+	
+	e = __atomic_load_n(&enabled, __ATOMIC_RELAXED);
+	if(e >= 0) return(e);
+	
+	/* madvise() is accepted even when the kernel won't use huge pages,
+	 * so check the mode here rather than report them wrongly */
+	e = 0;
+	f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+	if(f)
+	{
+		if(fgets(buf, sizeof(buf), f) && strstr(buf, "[never]") == NULL)
+		{
+			e = 1;
+		}
+		
+		fclose(f);
+	}
+	
+	__atomic_store_n(&enabled, e, __ATOMIC_RELAXED);
+	
+	return(e);
+}
+#endif
+
+static void *_huge_map(size_t size)
+{
+	size_t length;
+	uint8_t *p;
+	
+	length = (size + HUGE_HEADER + HUGE_PAGE_SIZE - 1) & ~((size_t) HUGE_PAGE_SIZE - 1);
+	
+	#ifdef MAP_HUGETLB
+	/* Fails straight away if there aren't enough reserved pages free */
+	p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if(p != MAP_FAILED)
+	{
+		return(_huge_init(p, HUGE_HUGETLB, length));
+	}
+	#endif
+	
+	#ifdef MADV_HUGEPAGE
+	if(_thp_enabled())
+	{
+		uint8_t *a;
+		
+		/* Map an extra huge page so the block can be aligned to one,
+		 * then give back the unused ends */
+		p = mmap(NULL, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(p != MAP_FAILED)
+		{
+			a = (uint8_t *) (((uintptr_t) p + HUGE_PAGE_SIZE - 1) & ~((uintptr_t) HUGE_PAGE_SIZE - 1));
+			
+			if(a > p) munmap(p, a - p);
+			munmap(a + length, p + HUGE_PAGE_SIZE - a);
+			
+			madvise(a, length, MADV_HUGEPAGE);
+			
+			return(_huge_init(a, HUGE_TRANSPARENT, length));
+		}
+	}
+	#endif
+	
+	return(NULL);
+}
+
+void *huge_alloc(size_t size)
+{
+	size_t length;
+	uint8_t *p;
+	
+	/* Rounding a smaller allocation up to a huge page would waste
+	 * most of the page, so only the large ones get them */
+	if(size + HUGE_HEADER >= HUGE_PAGE_SIZE)
+	{
+		p = _huge_map(size);
+		if(p != NULL) return(p);
+	}
+	
+	/* Fall back to normal pages */
+	length = size + HUGE_HEADER;
+	
+	if(posix_memalign((void **) &p, HUGE_HEADER, length) != 0)
+	{
+		return(NULL);
+	}
+	
+	memset(p, 0, length);
+	
+	return(_huge_init(p, HUGE_NONE, length));
+}
+
+void huge_free(void *ptr)
+{
+	_huge_header_t *h;
+	
+	if(ptr == NULL) return;
+	
+	h = (_huge_header_t *) ((uint8_t *) ptr - HUGE_HEADER);
+	
+	if(h->type == HUGE_NONE)
+	{
+		free(h);
+	}
+	else
+	{
+		munmap(h, h->length);
+	}
+}
+
+#else
+
+void *huge_alloc(size_t size)
+{
+	uint8_t *p;
+	
+	p = _aligned_malloc(size + HUGE_HEADER, HUGE_HEADER);
+	if(p == NULL)
+	{
+		return(NULL);
+	}
+	
+	memset(p, 0, size + HUGE_HEADER);
+	
+	return(_huge_init(p, HUGE_NONE, size + HUGE_HEADER));
+}
+
+void huge_free(void *ptr)
+{
+	if(ptr == NULL) return;
+	
+	_aligned_free((uint8_t *) ptr - HUGE_HEADER);
+}
+
+#endif
+
+int huge_type(const void *ptr)
+{
+	const _huge_header_t *h = (const _huge_header_t *) ((const uint8_t *) ptr - HUGE_HEADER);
+	
+	return(h->type);
+}
+
@@ -0,0 +1,44 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _HUGEPAGE_H
+#define _HUGEPAGE_H
+
+#include <stddef.h>
+
+/* Allocator for large, long-lived tables and buffers that are read at
+ * random or streamed every line. An allocation of at least a huge page
+ * is rounded up to whole huge pages and backed by reserved huge pages
+ * (MAP_HUGETLB) if there are enough free, else by transparent huge pages
+ * if the kernel allows them. Smaller allocations, and any that can't get
+ * huge pages, come from malloc. The memory is cleared and 64-byte
+ * aligned. */
+
+#define HUGE_PAGE_SIZE  (2 * 1024 * 1024)
+#define SMALL_PAGE_SIZE 4096
+
+/* How an allocation is backed */
+#define HUGE_NONE        0
+#define HUGE_HUGETLB     1
+#define HUGE_TRANSPARENT 2
+
+extern void *huge_alloc(size_t size);
+extern void huge_free(void *ptr);
+extern int huge_type(const void *ptr);
+
+#endif
+
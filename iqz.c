@@ -0,0 +1,730 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <zlib.h>
+#include "iqz.h"
+#include "rt.h"
+
+/* Number of compression threads */
+#define IQZ_THREADS 4
+
+/* Number of blocks in flight */
+#define IQZ_SLOTS (IQZ_THREADS * 2)
+
+#define IQZ_HEADER_LEN  64
+#define IQZ_BLOCK_LEN   16
+#define IQZ_INDEX_LEN   16
+#define IQZ_TRAILER_LEN 24
+
+enum {
+	_SLOT_FREE = 0,
+	_SLOT_FILLED,
+	_SLOT_BUSY,
+};
+
+typedef struct {
+	int state;
+	uint32_t seq;
+	size_t samples;
+	int16_t *iq;
+	uint8_t *raw;
+	uint8_t *comp;
+	uLongf comp_len;
+	uint32_t crc;
+} _iqz_slot_t;
+
+struct iqz_writer_t {
+	
+	FILE *f;
+	int channels;
+	
+	/* Block slots, shared with the compression threads */
+	_iqz_slot_t slots[IQZ_SLOTS];
+	_iqz_slot_t *fill;
+	uint32_t next_fill;
+	uint32_t next_compress;
+	uint32_t next_write;
+	int exit;
+	int error;
+	
+	/* Block index */
+	uint64_t *index_sample;
+	uint64_t *index_offset;
+	uint32_t blocks;
+	uint32_t index_size;
+	uint64_t samples;
+	uint64_t offset;
+	
+	pthread_t threads[IQZ_THREADS];
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+static void _put_u16(uint8_t *b, uint16_t v)
+{
+	b[0] = v;
+	b[1] = v >> 8;
+}
+
+static void _put_u32(uint8_t *b, uint32_t v)
+{
+	_put_u16(&b[0], v);
+	_put_u16(&b[2], v >> 16);
+}
+
+static void _put_u64(uint8_t *b, uint64_t v)
+{
+	_put_u32(&b[0], v);
+	_put_u32(&b[4], v >> 32);
+}
+
+static uint16_t _get_u16(const uint8_t *b)
+{
+	return(b[0] | (b[1] << 8));
+}
+
+static uint32_t _get_u32(const uint8_t *b)
+{
+	return(_get_u16(&b[0]) | ((uint32_t) _get_u16(&b[2]) << 16));
+}
+
+static uint64_t _get_u64(const uint8_t *b)
+{
+	return(_get_u32(&b[0]) | ((uint64_t) _get_u32(&b[4]) << 32));
+}
+
+static void _encode_block(_iqz_slot_t *b, int channels)
+{
+	size_t n = b->samples * channels;
+	int16_t prev[2] = { 0, 0 };
+	size_t i;
+	
+	/* Each channel is stored as the difference from its previous
+	 * sample, with the low and high bytes in separate planes */
+	for(i = 0; i < n; i++)
+	{
+		uint16_t d = (uint16_t) (b->iq[i] - prev[i % channels]);
+		
+		prev[i % channels] = b->iq[i];
+		b->raw[i] = d & 0xFF;
+		b->raw[n + i] = d >> 8;
+	}
+	
+	b->crc = crc32(0, b->raw, n * 2);
+	b->comp_len = compressBound(n * 2);
+	
+	if(compress2(b->comp, &b->comp_len, b->raw, n * 2, Z_BEST_SPEED) != Z_OK)
+	{
+		b->comp_len = 0;
+	}
+}
+
+static void _decode_block(int16_t *iq, const uint8_t *raw, size_t samples, int channels)
+{
+	size_t n = samples * channels;
+	int16_t prev[2] = { 0, 0 };
+	size_t i;
+	
+	for(i = 0; i < n; i++)
+	{
+		int c = i % channels;
+		
+		prev[c] += (int16_t) (raw[i] | (raw[n + i] << 8));
+		
+		/* Real signals are returned with an empty Q channel */
+		if(channels == 2)
+		{
+			iq[i] = prev[c];
+		}
+		else
+		{
+			iq[i * 2 + 0] = prev[c];
+			iq[i * 2 + 1] = 0;
+		}
+	}
+}
+
+static int _write_block(iqz_writer_t *w, _iqz_slot_t *b)
+{
+	uint8_t hdr[IQZ_BLOCK_LEN];
+	
+	memcpy(hdr, "IQZB", 4);
+	_put_u32(&hdr[4], b->samples);
+	_put_u32(&hdr[8], b->comp_len);
+	_put_u32(&hdr[12], b->crc);
+	
+	if(b->comp_len == 0 ||
+	   fwrite(hdr, IQZ_BLOCK_LEN, 1, w->f) != 1 ||
+	   fwrite(b->comp, b->comp_len, 1, w->f) != 1)
+	{
+		return(-1);
+	}
+	
+	return(0);
+}
+
+static void *_compress_thread(void *arg)
+{
+	iqz_writer_t *w = arg;
+	_iqz_slot_t *b;
+	int r;
+	
+	rt_thread(RT_SINK);
+	
+	pthread_mutex_lock(&w->mutex);
+	
+	while(1)
+	{
+		/* Wait for the next filled block */
+		b = &w->slots[w->next_compress % IQZ_SLOTS];
+		
+		if(b->state != _SLOT_FILLED)
+		{
+			if(w->exit) break;
+			pthread_cond_wait(&w->cond, &w->mutex);
+			continue;
+		}
+		
+		b->state = _SLOT_BUSY;
+		w->next_compress++;
+		pthread_mutex_unlock(&w->mutex);
+		
+		_encode_block(b, w->channels);
+		
+		/* Blocks are written in order */
+		pthread_mutex_lock(&w->mutex);
+		
+		while(w->next_write != b->seq)
+		{
+			pthread_cond_wait(&w->cond, &w->mutex);
+		}
+		
+		pthread_mutex_unlock(&w->mutex);
+		
+		r = _write_block(w, b);
+		
+		pthread_mutex_lock(&w->mutex);
+		
+		if(r == 0 && w->blocks == w->index_size)
+		{
+			uint64_t *si = realloc(w->index_sample, sizeof(uint64_t) * w->index_size * 2);
+			uint64_t *so = si ? realloc(w->index_offset, sizeof(uint64_t) * w->index_size * 2) : NULL;
+			
+			if(si) w->index_sample = si;
+			if(so) w->index_offset = so;
+			
+			if(si && so) w->index_size *= 2;
+			else r = -1;
+		}
+		
+		if(r == 0)
+		{
+			w->index_sample[w->blocks] = w->samples;
+			w->index_offset[w->blocks] = w->offset;
+			w->blocks++;
+		}
+		else
+		{
+			w->error = 1;
+		}
+		
+		w->samples += b->samples;
+		w->offset += IQZ_BLOCK_LEN + b->comp_len;
+		w->next_write++;
+		
+		b->samples = 0;
+		b->state = _SLOT_FREE;
+		
+		pthread_cond_broadcast(&w->cond);
+	}
+	
+	pthread_mutex_unlock(&w->mutex);
+	
+	return(NULL);
+}
+
+static void _submit_block(iqz_writer_t *w)
+{
+	pthread_mutex_lock(&w->mutex);
+	w->fill->state = _SLOT_FILLED;
+	w->fill->seq = w->next_fill++;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+	
+	w->fill = NULL;
+}
+
+static void _free_writer(iqz_writer_t *w)
+{
+	int i;
+	
+	for(i = 0; i < IQZ_SLOTS; i++)
+	{
+		free(w->slots[i].iq);
+		free(w->slots[i].raw);
+		free(w->slots[i].comp);
+	}
+	
+	free(w->index_sample);
+	free(w->index_offset);
+	
+	if(w->f && w->f != stdout) fclose(w->f);
+	
+	free(w);
+}
+
+int iqz_write_open(iqz_writer_t **pw, const char *filename, const iqz_info_t *info)
+{
+	iqz_writer_t *w;
+	uint8_t hdr[IQZ_HEADER_LEN];
+	size_t n;
+	int i;
+	
+	w = calloc(1, sizeof(iqz_writer_t));
+	if(!w)
+	{
+		perror("calloc");
+		return(-1);
+	}
+	
+	w->channels = info->flags & IQZ_COMPLEX ? 2 : 1;
+	n = IQZ_BLOCK_SAMPLES * w->channels;
+	
+	for(i = 0; i < IQZ_SLOTS; i++)
+	{
+		w->slots[i].iq = malloc(sizeof(int16_t) * n);
+		w->slots[i].raw = malloc(sizeof(int16_t) * n);
+		w->slots[i].comp = malloc(compressBound(sizeof(int16_t) * n));
+		
+		if(!w->slots[i].iq || !w->slots[i].raw || !w->slots[i].comp)
+		{
+			perror("malloc");
+			_free_writer(w);
+			return(-1);
+		}
+	}
+	
+	w->index_size = 1024;
+	w->index_sample = malloc(sizeof(uint64_t) * w->index_size);
+	w->index_offset = malloc(sizeof(uint64_t) * w->index_size);
+	
+	if(!w->index_sample || !w->index_offset)
+	{
+		perror("malloc");
+		_free_writer(w);
+		return(-1);
+	}
+	
+	if(strcmp(filename, "-") == 0)
+	{
+		w->f = stdout;
+	}
+	else
+	{
+		w->f = fopen(filename, "wb");
+		
+		if(!w->f)
+		{
+			perror("fopen");
+			_free_writer(w);
+			return(-1);
+		}
+	}
+	
+	/* Write the header */
+	memset(hdr, 0, IQZ_HEADER_LEN);
+	memcpy(hdr, "HACKTVIQ", 8);
+	_put_u16(&hdr[8], IQZ_VERSION);
+	_put_u16(&hdr[10], info->flags);
+	_put_u32(&hdr[12], info->sample_rate);
+	_put_u64(&hdr[16], info->frequency);
+	_put_u32(&hdr[24], IQZ_BLOCK_SAMPLES);
+	memcpy(&hdr[32], info->mode, sizeof(info->mode) - 1);
+	
+	if(fwrite(hdr, IQZ_HEADER_LEN, 1, w->f) != 1)
+	{
+		perror("fwrite");
+		_free_writer(w);
+		return(-1);
+	}
+	
+	w->offset = IQZ_HEADER_LEN;
+	
+	pthread_mutex_init(&w->mutex, NULL);
+	pthread_cond_init(&w->cond, NULL);
+	
+	for(i = 0; i < IQZ_THREADS; i++)
+	{
+		pthread_create(&w->threads[i], NULL, &_compress_thread, (void *) w);
+	}
+	
+	*pw = w;
+	
+	return(0);
+}
+
+int iqz_write(iqz_writer_t *w, const int16_t *iq_data, size_t samples)
+{
+	size_t i;
+	
+	while(samples)
+	{
+		if(w->fill == NULL)
+		{
+			/* Wait for the next slot to be free */
+			pthread_mutex_lock(&w->mutex);
+			
+			w->fill = &w->slots[w->next_fill % IQZ_SLOTS];
+			while(w->fill->state != _SLOT_FREE)
+			{
+				pthread_cond_wait(&w->cond, &w->mutex);
+			}
+			
+			pthread_mutex_unlock(&w->mutex);
+		}
+		
+		if(w->channels == 2)
+		{
+			i = IQZ_BLOCK_SAMPLES - w->fill->samples;
+			if(i > samples) i = samples;
+			
+			memcpy(&w->fill->iq[w->fill->samples * 2], iq_data, sizeof(int16_t) * 2 * i);
+			w->fill->samples += i;
+			iq_data += i * 2;
+			samples -= i;
+		}
+		else
+		{
+			for(; samples && w->fill->samples < IQZ_BLOCK_SAMPLES; samples--, iq_data += 2)
+			{
+				w->fill->iq[w->fill->samples++] = iq_data[0];
+			}
+		}
+		
+		if(w->fill->samples == IQZ_BLOCK_SAMPLES)
+		{
+			_submit_block(w);
+		}
+	}
+	
+	return(w->error ? -1 : 0);
+}
+
+int iqz_write_close(iqz_writer_t *w)
+{
+	uint8_t b[IQZ_TRAILER_LEN];
+	uint32_t i;
+	int r;
+	
+	/* Flush the last partial block */
+	if(w->fill != NULL && w->fill->samples > 0)
+	{
+		_submit_block(w);
+	}
+	
+	pthread_mutex_lock(&w->mutex);
+	w->exit = 1;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+	
+	for(i = 0; i < IQZ_THREADS; i++)
+	{
+		pthread_join(w->threads[i], NULL);
+	}
+	
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->mutex);
+	
+	/* Write the index and trailer */
+	for(i = 0; i < w->blocks; i++)
+	{
+		_put_u64(&b[0], w->index_sample[i]);
+		_put_u64(&b[8], w->index_offset[i]);
+		fwrite(b, IQZ_INDEX_LEN, 1, w->f);
+	}
+	
+	memcpy(b, "IQZX", 4);
+	_put_u32(&b[4], w->blocks);
+	_put_u64(&b[8], w->offset);
+	_put_u64(&b[16], w->samples);
+	fwrite(b, IQZ_TRAILER_LEN, 1, w->f);
+	
+	r = w->error || fflush(w->f) != 0 || ferror(w->f) ? -1 : 0;
+	
+	_free_writer(w);
+	
+	return(r);
+}
+
+static int _read_block(iqz_reader_t *r)
+{
+	uint8_t hdr[IQZ_BLOCK_LEN];
+	int channels = r->info.flags & IQZ_COMPLEX ? 2 : 1;
+	uLongf len;
+	uint32_t samples, clen;
+	
+	if(fread(hdr, IQZ_BLOCK_LEN, 1, r->f) != 1 ||
+	   memcmp(hdr, "IQZB", 4) != 0)
+	{
+		/* End of the blocks */
+		return(-1);
+	}
+	
+	samples = _get_u32(&hdr[4]);
+	clen = _get_u32(&hdr[8]);
+	
+	if(samples > IQZ_BLOCK_SAMPLES ||
+	   clen > compressBound(sizeof(int16_t) * IQZ_BLOCK_SAMPLES * channels) ||
+	   fread(r->comp, clen, 1, r->f) != 1)
+	{
+		fprintf(stderr, "iqz: Corrupt or truncated block\n");
+		return(-1);
+	}
+	
+	len = samples * channels * 2;
+	
+	if(uncompress(r->raw, &len, r->comp, clen) != Z_OK ||
+	   len != samples * channels * 2 ||
+	   crc32(0, r->raw, len) != _get_u32(&hdr[12]))
+	{
+		fprintf(stderr, "iqz: Block CRC error\n");
+		return(-1);
+	}
+	
+	_decode_block(r->iq, r->raw, samples, channels);
+	
+	r->iq_len = samples * 2;
+	r->iq_pos = 0;
+	r->block++;
+	
+	return(0);
+}
+
+int iqz_open(iqz_reader_t *r, const char *filename)
+{
+	uint8_t hdr[IQZ_HEADER_LEN];
+	uint8_t b[IQZ_TRAILER_LEN];
+	uint64_t offset;
+	off_t end;
+	uint32_t i;
+	size_t n;
+	
+	memset(r, 0, sizeof(iqz_reader_t));
+	
+	if(strcmp(filename, "-") == 0)
+	{
+		r->f = stdin;
+	}
+	else
+	{
+		r->f = fopen(filename, "rb");
+		
+		if(!r->f)
+		{
+			perror(filename);
+			return(-1);
+		}
+	}
+	
+	if(fread(hdr, IQZ_HEADER_LEN, 1, r->f) != 1 ||
+	   memcmp(hdr, "HACKTVIQ", 8) != 0 ||
+	   _get_u16(&hdr[8]) != IQZ_VERSION ||
+	   _get_u32(&hdr[24]) != IQZ_BLOCK_SAMPLES)
+	{
+		fprintf(stderr, "%s: Not a supported IQ container\n", filename);
+		iqz_close(r);
+		return(-1);
+	}
+	
+	r->info.flags = _get_u16(&hdr[10]);
+	r->info.sample_rate = _get_u32(&hdr[12]);
+	r->info.frequency = _get_u64(&hdr[16]);
+	memcpy(r->info.mode, &hdr[32], 31);
+	
+	n = IQZ_BLOCK_SAMPLES * 2;
+	r->iq = malloc(sizeof(int16_t) * n);
+	r->raw = malloc(sizeof(int16_t) * n);
+	r->comp = malloc(compressBound(sizeof(int16_t) * n));
+	
+	if(!r->iq || !r->raw || !r->comp)
+	{
+		perror("malloc");
+		iqz_close(r);
+		return(-1);
+	}
+	
+	/* Load the index if the input is seekable. Without it
+	 * the blocks can still be read in order */
+	if(fseeko(r->f, -IQZ_TRAILER_LEN, SEEK_END) == 0 &&
+	   (end = ftello(r->f)) >= IQZ_HEADER_LEN)
+	{
+		if(fread(b, IQZ_TRAILER_LEN, 1, r->f) == 1 &&
+		   memcmp(b, "IQZX", 4) == 0)
+		{
+			r->blocks = _get_u32(&b[4]);
+			offset = _get_u64(&b[8]);
+			r->samples = _get_u64(&b[16]);
+			
+			/* The index runs from its offset up to the trailer. Checking
+			 * it fits there also keeps the block count in range */
+			if(offset < IQZ_HEADER_LEN || offset > (uint64_t) end ||
+			   (uint64_t) end - offset != (uint64_t) r->blocks * IQZ_INDEX_LEN ||
+			   r->blocks >= SIZE_MAX / sizeof(uint64_t))
+			{
+				fprintf(stderr, "%s: Corrupt index\n", filename);
+				iqz_close(r);
+				return(-1);
+			}
+			
+			r->index_sample = malloc(sizeof(uint64_t) * ((size_t) r->blocks + 1));
+			r->index_offset = malloc(sizeof(uint64_t) * ((size_t) r->blocks + 1));
+			
+			if(!r->index_sample || !r->index_offset)
+			{
+				perror("malloc");
+				iqz_close(r);
+				return(-1);
+			}
+			
+			if(fseeko(r->f, offset, SEEK_SET) != 0)
+			{
+				perror(filename);
+				iqz_close(r);
+				return(-1);
+			}
+			
+			for(i = 0; i < r->blocks; i++)
+			{
+				if(fread(b, IQZ_INDEX_LEN, 1, r->f) != 1)
+				{
+					fprintf(stderr, "%s: Truncated index\n", filename);
+					iqz_close(r);
+					return(-1);
+				}
+				
+				r->index_sample[i] = _get_u64(&b[0]);
+				r->index_offset[i] = _get_u64(&b[8]);
+				
+				/* Seeking trusts these, so the blocks must start at
+				 * sample 0 and run in order between the header and
+				 * the index */
+				if(r->index_sample[i] >= r->samples ||
+				   r->index_offset[i] < IQZ_HEADER_LEN ||
+				   r->index_offset[i] >= offset ||
+				   (i == 0 && r->index_sample[i] != 0) ||
+				   (i > 0 && r->index_sample[i] <= r->index_sample[i - 1]) ||
+				   (i > 0 && r->index_offset[i] <= r->index_offset[i - 1]))
+				{
+					fprintf(stderr, "%s: Corrupt index\n", filename);
+					iqz_close(r);
+					return(-1);
+				}
+			}
+		}
+		
+		if(fseeko(r->f, IQZ_HEADER_LEN, SEEK_SET) != 0)
+		{
+			iqz_close(r);
+			return(-1);
+		}
+	}
+	
+	return(0);
+}
+
+size_t iqz_read(iqz_reader_t *r, int16_t *iq_data, size_t samples)
+{
+	size_t n, i;
+	
+	for(n = 0; n < samples; n += i)
+	{
+		if(r->iq_pos == r->iq_len && _read_block(r) != 0)
+		{
+			break;
+		}
+		
+		i = (r->iq_len - r->iq_pos) / 2;
+		if(i > samples - n) i = samples - n;
+		
+		memcpy(&iq_data[n * 2], &r->iq[r->iq_pos], sizeof(int16_t) * 2 * i);
+		r->iq_pos += i * 2;
+	}
+	
+	return(n);
+}
+
+int iqz_seek(iqz_reader_t *r, uint64_t sample)
+{
+	uint32_t lo, hi, mid;
+	
+	if(r->blocks == 0 || sample >= r->samples)
+	{
+		return(-1);
+	}
+	
+	/* Find the block containing this sample */
+	lo = 0;
+	hi = r->blocks - 1;
+	
+	while(lo < hi)
+	{
+		mid = (lo + hi + 1) / 2;
+		
+		if(r->index_sample[mid] <= sample) lo = mid;
+		else hi = mid - 1;
+	}
+	
+	if(fseeko(r->f, r->index_offset[lo], SEEK_SET) != 0)
+	{
+		return(-1);
+	}
+	
+	r->block = lo;
+	
+	if(_read_block(r) != 0)
+	{
+		return(-1);
+	}
+	
+	/* The block must actually hold the sample */
+	if((sample - r->index_sample[lo]) * 2 >= r->iq_len)
+	{
+		fprintf(stderr, "iqz: Block %u is shorter than the index says\n", lo);
+		return(-1);
+	}
+	
+	r->iq_pos = (sample - r->index_sample[lo]) * 2;
+	
+	return(0);
+}
+
+void iqz_close(iqz_reader_t *r)
+{
+	if(r->f && r->f != stdin) fclose(r->f);
+	free(r->index_sample);
+	free(r->index_offset);
+	free(r->iq);
+	free(r->raw);
+	free(r->comp);
+	memset(r, 0, sizeof(iqz_reader_t));
+}
+
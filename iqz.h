@@ -0,0 +1,82 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _IQZ_H
+#define _IQZ_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Compressed IQ container
+ * 
+ * A header, followed by independently compressed blocks and an index
+ * of block positions at the end of the file. All values are little
+ * endian. Each block holds the sample to sample difference of each
+ * channel, split into low and high byte planes and deflated. Readers
+ * without a seekable input can skip the index and read the blocks in
+ * order.
+*/
+
+#define IQZ_VERSION 1
+
+/* Header flags */
+#define IQZ_COMPLEX 0x0001
+
+/* Samples per block */
+#define IQZ_BLOCK_SAMPLES (1 << 18)
+
+typedef struct {
+	uint32_t flags;
+	uint32_t sample_rate;
+	uint64_t frequency;
+	char mode[32];
+} iqz_info_t;
+
+typedef struct iqz_writer_t iqz_writer_t;
+
+typedef struct {
+	
+	FILE *f;
+	iqz_info_t info;
+	
+	/* Block index */
+	uint64_t *index_sample;
+	uint64_t *index_offset;
+	uint32_t blocks;
+	uint64_t samples;
+	
+	/* Current block */
+	uint32_t block;
+	uint8_t *comp;
+	uint8_t *raw;
+	int16_t *iq;
+	size_t iq_len;
+	size_t iq_pos;
+	
+} iqz_reader_t;
+
+extern int iqz_write_open(iqz_writer_t **w, const char *filename, const iqz_info_t *info);
+extern int iqz_write(iqz_writer_t *w, const int16_t *iq_data, size_t samples);
+extern int iqz_write_close(iqz_writer_t *w);
+
+extern int iqz_open(iqz_reader_t *r, const char *filename);
+extern size_t iqz_read(iqz_reader_t *r, int16_t *iq_data, size_t samples);
+extern int iqz_seek(iqz_reader_t *r, uint64_t sample);
+extern void iqz_close(iqz_reader_t *r);
+
+#endif
+
@@ -899,7 +899,7 @@ static int _create_si_dg4_packet(mac_t *s, uint8_t *pkt, int golay)
 	int x;
 	uint16_t b;
 	
-	memset(pkt, 0, MAC_PAYLOAD_BYTES);
+	memset(pkt, 0, MAC_PAYLOAD_BYTES * 2);
 	
 	/* PT Packet Type */
 	pkt[0] = golay ? 0x00 : 0xF8;
@@ -961,7 +961,7 @@ static int _create_si_dg9_packet(mac_t *s, uint8_t *pkt)
 	int x;
 	uint16_t b;
 	
-	memset(pkt, 0, MAC_PAYLOAD_BYTES);
+	memset(pkt, 0, MAC_PAYLOAD_BYTES * 2);
 	
 	/* PT Packet Type */
 	pkt[0] = 0xF8;
@@ -982,7 +982,7 @@ static int _create_si_dg9_packet(mac_t *s, uint8_t *pkt)
 
 	/* Parameter TIME */
 	char t[32];
-    time_t now = time(0);
+    time_t now = wall_time();
     strftime (t, 32, "%d/%m/%Y %H:%M:%S", localtime (&now));
 
 	pkt[x++] = 0x20;		/* PI Service Reference */
@@ -1098,7 +1098,7 @@ int mac_init(vid_t *s)
 	mac->teletext = (s->conf.teletext ? 1 : 0);
 	mac->txsubtitles = (s->conf.txsubtitles ? 1 : 0);
 	
-	_update_udt(s->mac.udt, time(NULL));
+	_update_udt(s->mac.udt, wall_time());
 	
 	mac->rdf = 0;
 	
@@ -1879,7 +1879,7 @@ int mac_next_line(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 		/* Update the UDT date and time every 25 frames */
 		if(l->frame % 25 == 0)
 		{
-			_update_udt(s->mac.udt, time(NULL));
+			_update_udt(s->mac.udt, wall_time());
 		}
 	}
 	
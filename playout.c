@@ -0,0 +1,397 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Playout of pre-rendered IQ files */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "hacktv.h"
+#include "playout.h"
+#include "rt.h"
+
+static size_t _sample_size(int type)
+{
+	switch(type)
+	{
+	case HACKTV_UINT8:  return(sizeof(uint8_t));
+	case HACKTV_INT8:   return(sizeof(int8_t));
+	case HACKTV_UINT16: return(sizeof(uint16_t));
+	case HACKTV_INT16:  return(sizeof(int16_t));
+	case HACKTV_INT32:  return(sizeof(int32_t));
+	case HACKTV_FLOAT:  return(sizeof(float));
+	}
+	
+	return(0);
+}
+
+static void _convert(playout_t *p, int16_t *iq, size_t samples)
+{
+	size_t i, n;
+	int step;
+	
+	/* Real signals are expanded with an empty Q channel */
+	if(p->complex)
+	{
+		n = samples * 2;
+		step = 1;
+	}
+	else
+	{
+		memset(iq, 0, sizeof(int16_t) * 2 * samples);
+		n = samples;
+		step = 2;
+	}
+	
+	switch(p->type)
+	{
+	case HACKTV_UINT8:
+		for(i = 0; i < n; i++) iq[i * step] = (((uint8_t *) p->data)[i] << 8) + INT16_MIN;
+		break;
+	
+	case HACKTV_INT8:
+		for(i = 0; i < n; i++) iq[i * step] = ((int8_t *) p->data)[i] << 8;
+		break;
+	
+	case HACKTV_UINT16:
+		for(i = 0; i < n; i++) iq[i * step] = ((uint16_t *) p->data)[i] + INT16_MIN;
+		break;
+	
+	case HACKTV_INT16:
+		for(i = 0; i < n; i++) iq[i * step] = ((int16_t *) p->data)[i];
+		break;
+	
+	case HACKTV_INT32:
+		for(i = 0; i < n; i++) iq[i * step] = ((int32_t *) p->data)[i] >> 16;
+		break;
+	
+	case HACKTV_FLOAT:
+		for(i = 0; i < n; i++)
+		{
+			float f = ((float *) p->data)[i] * 32767.0;
+			iq[i * step] = f < INT16_MIN ? INT16_MIN : (f > INT16_MAX ? INT16_MAX : f);
+		}
+		break;
+	}
+}
+
+static size_t _fill(playout_t *p, int16_t *iq)
+{
+	size_t n = 0;
+	int retry;
+	
+	for(retry = 0; retry < 2 && n == 0; retry++)
+	{
+		if(retry > 0)
+		{
+			/* Loop back to the start of the file */
+			if(!p->loop) break;
+			
+			if(p->f == NULL)
+			{
+				if(iqz_seek(&p->iqz, 0) != 0) break;
+			}
+			else if(fseek(p->f, 0, SEEK_SET) != 0)
+			{
+				break;
+			}
+		}
+		
+		if(p->f == NULL)
+		{
+			n = iqz_read(&p->iqz, iq, PLAYOUT_BLOCK);
+		}
+		else
+		{
+			n = fread(p->data, p->data_size, PLAYOUT_BLOCK, p->f);
+			_convert(p, iq, n);
+		}
+	}
+	
+	return(n);
+}
+
+static void *_read_thread(void *arg)
+{
+	playout_t *p = arg;
+	size_t n;
+	
+	rt_thread(RT_DECODER);
+	
+	pthread_mutex_lock(&p->mutex);
+	
+	while(!p->abort)
+	{
+		if(p->ready[p->head])
+		{
+			/* Wait for a free buffer */
+			pthread_cond_wait(&p->cond, &p->mutex);
+			continue;
+		}
+		
+		pthread_mutex_unlock(&p->mutex);
+		n = _fill(p, p->buffers[p->head]);
+		pthread_mutex_lock(&p->mutex);
+		
+		if(n == 0)
+		{
+			p->eof = 1;
+			pthread_cond_broadcast(&p->cond);
+			break;
+		}
+		
+		p->samples[p->head] = n;
+		p->ready[p->head] = 1;
+		p->head = (p->head + 1) % PLAYOUT_BUFFERS;
+		
+		pthread_cond_broadcast(&p->cond);
+	}
+	
+	pthread_mutex_unlock(&p->mutex);
+	
+	return(NULL);
+}
+
+static int _is_iqz(const char *filename)
+{
+	FILE *f;
+	char magic[8];
+	int r = 0;
+	
+	f = fopen(filename, "rb");
+	if(f)
+	{
+		r = fread(magic, 8, 1, f) == 1 && memcmp(magic, "HACKTVIQ", 8) == 0;
+		fclose(f);
+	}
+	
+	return(r);
+}
+
+int playout_open(playout_t *p, const char *filename, int type, int complex, unsigned int sample_rate, int loop)
+{
+	int i;
+	
+	memset(p, 0, sizeof(playout_t));
+	
+	p->type = type;
+	p->complex = complex;
+	p->loop = loop;
+	
+	if(filename == NULL)
+	{
+		fprintf(stderr, "No IQ filename provided.\n");
+		return(HACKTV_ERROR);
+	}
+	
+	if(type == HACKTV_IQZ || (strcmp(filename, "-") != 0 && _is_iqz(filename)))
+	{
+		/* The compressed container */
+		if(iqz_open(&p->iqz, filename) != 0)
+		{
+			return(HACKTV_ERROR);
+		}
+		
+		if(p->iqz.info.sample_rate != sample_rate)
+		{
+			fprintf(stderr, "%s: Sample rate %u does not match the output sample rate %u.\n",
+				filename, p->iqz.info.sample_rate, sample_rate
+			);
+			iqz_close(&p->iqz);
+			return(HACKTV_ERROR);
+		}
+		
+		if(!(p->iqz.info.flags & IQZ_COMPLEX) != !complex)
+		{
+			fprintf(stderr, "%s: The file is %s but the TV mode is %s.\n",
+				filename,
+				p->iqz.info.flags & IQZ_COMPLEX ? "complex" : "real",
+				complex ? "complex" : "real"
+			);
+			iqz_close(&p->iqz);
+			return(HACKTV_ERROR);
+		}
+	}
+	else
+	{
+		p->data_size = _sample_size(type) * (complex ? 2 : 1);
+		
+		if(strcmp(filename, "-") == 0)
+		{
+			p->f = stdin;
+		}
+		else
+		{
+			p->f = fopen(filename, "rb");
+		}
+		
+		if(!p->f)
+		{
+			perror(filename);
+			return(HACKTV_ERROR);
+		}
+		
+#ifndef WIN32
+		if(type == HACKTV_INT16 && complex && p->f != stdin)
+		{
+			struct stat st;
+			void *map;
+			
+			/* The file already matches the sink input format,
+			 * map it and pass it through without copying */
+			if(fstat(fileno(p->f), &st) == 0 && st.st_size >= sizeof(int16_t) * 2)
+			{
+				map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fileno(p->f), 0);
+				
+				if(map != MAP_FAILED)
+				{
+					madvise(map, st.st_size, MADV_SEQUENTIAL);
+					
+					p->map = map;
+					p->map_len = st.st_size / (sizeof(int16_t) * 2);
+					
+					fclose(p->f);
+					p->f = NULL;
+					
+					return(HACKTV_OK);
+				}
+			}
+		}
+#endif
+		
+		p->data = malloc(p->data_size * PLAYOUT_BLOCK);
+		if(!p->data)
+		{
+			perror("malloc");
+			playout_close(p);
+			return(HACKTV_ERROR);
+		}
+	}
+	
+	for(i = 0; i < PLAYOUT_BUFFERS; i++)
+	{
+		p->buffers[i] = malloc(sizeof(int16_t) * 2 * PLAYOUT_BLOCK);
+		if(!p->buffers[i])
+		{
+			perror("malloc");
+			playout_close(p);
+			return(HACKTV_ERROR);
+		}
+	}
+	
+	/* Start the read-ahead thread */
+	pthread_mutex_init(&p->mutex, NULL);
+	pthread_cond_init(&p->cond, NULL);
+	pthread_create(&p->thread, NULL, &_read_thread, (void *) p);
+	p->thread_running = 1;
+	
+	return(HACKTV_OK);
+}
+
+const int16_t *playout_read(playout_t *p, size_t *samples)
+{
+	const int16_t *iq;
+	
+	if(p->map)
+	{
+		if(p->map_pos == p->map_len)
+		{
+			if(!p->loop) return(NULL);
+			p->map_pos = 0;
+		}
+		
+		*samples = p->map_len - p->map_pos;
+		if(*samples > PLAYOUT_BLOCK) *samples = PLAYOUT_BLOCK;
+		
+		iq = &p->map[p->map_pos * 2];
+		p->map_pos += *samples;
+		
+		return(iq);
+	}
+	
+	pthread_mutex_lock(&p->mutex);
+	
+	/* Release the previous buffer */
+	if(p->held)
+	{
+		p->ready[p->tail] = 0;
+		p->tail = (p->tail + 1) % PLAYOUT_BUFFERS;
+		p->held = 0;
+		pthread_cond_broadcast(&p->cond);
+	}
+	
+	while(!p->ready[p->tail] && !p->eof)
+	{
+		pthread_cond_wait(&p->cond, &p->mutex);
+	}
+	
+	if(!p->ready[p->tail])
+	{
+		pthread_mutex_unlock(&p->mutex);
+		return(NULL);
+	}
+	
+	p->held = 1;
+	*samples = p->samples[p->tail];
+	iq = p->buffers[p->tail];
+	
+	pthread_mutex_unlock(&p->mutex);
+	
+	return(iq);
+}
+
+void playout_close(playout_t *p)
+{
+	int i;
+	
+	if(p->thread_running)
+	{
+		pthread_mutex_lock(&p->mutex);
+		p->abort = 1;
+		pthread_cond_broadcast(&p->cond);
+		pthread_mutex_unlock(&p->mutex);
+		
+		pthread_join(p->thread, NULL);
+		pthread_cond_destroy(&p->cond);
+		pthread_mutex_destroy(&p->mutex);
+	}
+	
+#ifndef WIN32
+	if(p->map)
+	{
+		munmap(p->map, p->map_len * sizeof(int16_t) * 2);
+	}
+#endif
+	
+	if(p->f && p->f != stdin) fclose(p->f);
+	if(p->iqz.f) iqz_close(&p->iqz);
+	
+	for(i = 0; i < PLAYOUT_BUFFERS; i++)
+	{
+		free(p->buffers[i]);
+	}
+	
+	free(p->data);
+	memset(p, 0, sizeof(playout_t));
+}
+
@@ -0,0 +1,68 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _PLAYOUT_H
+#define _PLAYOUT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "iqz.h"
+
+#define PLAYOUT_BUFFERS 8
+#define PLAYOUT_BLOCK   65536
+
+typedef struct {
+	
+	/* Source */
+	FILE *f;
+	iqz_reader_t iqz;
+	int type;
+	int complex;
+	int loop;
+	
+	/* Memory mapped int16 complex files */
+	int16_t *map;
+	size_t map_len;
+	size_t map_pos;
+	
+	/* Read-ahead thread and buffers */
+	void *data;
+	size_t data_size;
+	int16_t *buffers[PLAYOUT_BUFFERS];
+	size_t samples[PLAYOUT_BUFFERS];
+	int ready[PLAYOUT_BUFFERS];
+	int head;
+	int tail;
+	int held;
+	int eof;
+	int abort;
+	
+	int thread_running;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	
+} playout_t;
+
+extern int playout_open(playout_t *p, const char *filename, int type, int complex, unsigned int sample_rate, int loop);
+/* The returned samples may be read-only, as mapped from the file */
+extern const int16_t *playout_read(playout_t *p, size_t *samples);
+extern void playout_close(playout_t *p);
+
+#endif
+
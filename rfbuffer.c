@@ -0,0 +1,335 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include "hacktv.h"
+#include "rfbuffer.h"
+
+int rf_buffers_open(rf_buffers_t *buffers, hacktv_t *s)
+{
+	size_t count, length;
+	size_t prefill;
+	
+	/* By default each buffer holds a frame */
+	count = s->tx_buffers > 0 ? s->tx_buffers : RF_BUFFERS;
+	length = s->tx_buffer_size > 0 ? s->tx_buffer_size : (size_t) s->vid.width * s->vid.conf.lines;
+	prefill = s->tx_prefill >= 0 ? s->tx_prefill : count / 2;
+	
+	/* The writer and reader each hold a buffer. The writer can fill
+	 * all but the reader's before it has to wait */
+	if(count < 3)
+	{
+		fprintf(stderr, "At least 3 transmit buffers are needed.\n");
+		return(HACKTV_ERROR);
+	}
+	
+	if(prefill > count - 1)
+	{
+		fprintf(stderr, "The transmit prefill must be less than the number of buffers.\n");
+		return(HACKTV_ERROR);
+	}
+	
+	if(rf_buffers_init(buffers, count, length * sizeof(int8_t) * 2) != 0)
+	{
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	buffers->prefill = (uint64_t) prefill * buffers->length;
+	buffers->sample_rate = s->vid.sample_rate;
+	buffers->verbose = s->verbose;
+	buffers->report = buffers->prefill;
+	
+	fprintf(stderr, "Transmit buffers: %zu x %.1f ms, prefill %zu (%.1f ms)\n",
+		count, 1000.0 * length / s->vid.sample_rate,
+		prefill, 1000.0 * length * prefill / s->vid.sample_rate
+	);
+	
+	return(HACKTV_OK);
+}
+
+int rf_buffers_ready(rf_buffers_t *buffers)
+{
+	return(buffers->written >= buffers->prefill);
+}
+
+double rf_buffers_latency(rf_buffers_t *buffers)
+{
+	uint64_t q;
+	
+	q = __atomic_load_n(&buffers->written, __ATOMIC_ACQUIRE) - __atomic_load_n(&buffers->read, __ATOMIC_ACQUIRE);
+	
+	return(1000.0 * q / 2 / buffers->sample_rate);
+}
+
+void rf_buffers_report(rf_buffers_t *buffers, const char *name)
+{
+	double scale = 1000.0 / 2 / buffers->sample_rate;
+	
+	if(buffers->latency_count > 0)
+	{
+		fprintf(stderr, "%s: latency %.1f ms (min %.1f, max %.1f), %" PRIu64 " underruns\n",
+			name,
+			scale * buffers->latency_sum / buffers->latency_count,
+			scale * buffers->latency_min,
+			scale * buffers->latency_max,
+			buffers->underruns
+		);
+	}
+	else
+	{
+		fprintf(stderr, "%s: not started, %" PRIu64 " underruns\n", name, buffers->underruns);
+	}
+}
+
+int rf_buffers_init(rf_buffers_t *buffers, size_t count, size_t length)
+{
+	int i;
+	
+	memset(buffers, 0, sizeof(rf_buffers_t));
+	
+	buffers->count = count;
+	buffers->length = length;
+	buffers->buffers = calloc(count, sizeof(rf_buffer_t));
+	
+	if(!buffers->buffers)
+	{
+		return(-1);
+	}
+	
+	for(i = 0; i < count; i++)
+	{
+		pthread_mutex_init(&buffers->buffers[i].mutex, NULL);
+		buffers->buffers[i].data = malloc(length);
+		buffers->buffers[i].start = 0;
+		buffers->buffers[i].length = 0;
+		
+		if(!buffers->buffers[i].data)
+		{
+			buffers->count = i + 1;
+			rf_buffers_free(buffers);
+			return(-1);
+		}
+	}
+	
+	/* Lock the initial buffer for the provider */
+	buffers->in = 0;
+	pthread_mutex_lock(&buffers->buffers[buffers->in].mutex);
+	
+	/* Lock the last empty buffer for the consumer */
+	buffers->out = count - 1;
+	pthread_mutex_lock(&buffers->buffers[buffers->out].mutex);
+	
+	return(0);
+}
+
+int rf_buffers_free(rf_buffers_t *buffers)
+{
+	int i;
+	
+	for(i = 0; i < buffers->count; i++)
+	{
+		free(buffers->buffers[i].data);
+		pthread_mutex_destroy(&buffers->buffers[i].mutex);
+	}
+	
+	free(buffers->buffers);
+	memset(buffers, 0, sizeof(rf_buffers_t));
+	
+	return(0);
+}
+
+int rf_buffers_read(rf_buffers_t *buffers, void *dst, size_t length)
+{
+	rf_buffer_t *buf = &buffers->buffers[buffers->out];
+	
+	if(buf->length == 0)
+	{
+		rf_buffer_t *next;
+		int i;
+		
+		/* This buffer is empty, try to move the read lock onto the next one */
+		i = (buffers->out + 1) % buffers->count;
+		next = &buffers->buffers[i];
+		
+		if(pthread_mutex_trylock(&next->mutex) != 0)
+		{
+			/* No luck, the writer must have it */
+			fprintf(stderr, "U");
+			__atomic_add_fetch(&buffers->underruns, 1, __ATOMIC_RELAXED);
+			return(0);
+		}
+		
+		/* Got a lock on the next buffer, clear and release the previous */
+		buf->start = 0;
+		pthread_mutex_unlock(&buf->mutex);
+		
+		buf = next;
+		buffers->out = i;
+	}
+	
+	if(length > buf->length)
+	{
+		length = buf->length;
+	}
+	
+	memcpy(dst, buf->data + buf->start, length);
+	buf->start += length;
+	buf->length -= length;
+	__atomic_add_fetch(&buffers->read, length, __ATOMIC_RELEASE);
+	
+	return(length);
+}
+
+int rf_buffers_write(rf_buffers_t *buffers, void *src, size_t length)
+{
+	rf_buffer_t *buf = &buffers->buffers[buffers->in];
+	int i;
+	
+	if(buf->length == buffers->length)
+	{
+		rf_buffer_t *next;
+		
+		/* This buffer is full, move the write lock onto the next one */
+		i = (buffers->in + 1) % buffers->count;
+		next = &buffers->buffers[i];
+		
+		pthread_mutex_lock(&next->mutex);
+		pthread_mutex_unlock(&buf->mutex);
+		
+		buf = next;
+		buffers->in = i;
+	}
+	
+	i = buf->start + buf->length;
+	if(length > buffers->length - i)
+	{
+		length = buffers->length - i;
+	}
+	
+	memcpy(buf->data + i, src, length);
+	buf->length += length;
+	__atomic_add_fetch(&buffers->written, length, __ATOMIC_RELEASE);
+	
+	return(length);
+}
+
+void rf_buffers_write_iq(rf_buffers_t *buffers, const int16_t *iq_data, size_t samples)
+{
+	int8_t iq8[1024 * 4];
+	int i, l, r;
+	
+	samples *= 2;
+	
+	/* Writes can be longer than a line, convert them in pieces */
+	while(samples)
+	{
+		l = samples < sizeof(iq8) ? samples : sizeof(iq8);
+		
+		for(i = 0; i < l; i++)
+		{
+			iq8[i] = iq_data[i] >> 8;
+		}
+		
+		iq_data += l;
+		samples -= l;
+		
+		i = 0;
+		while(l)
+		{
+			r = rf_buffers_write(buffers, &iq8[i], l);
+			
+			l -= r;
+			i += r;
+		}
+	}
+	
+	/* Report the latency about once a second */
+	if(buffers->verbose && buffers->written >= buffers->report)
+	{
+		fprintf(stderr, "Latency: %.1f ms, %" PRIu64 " underruns\n",
+			rf_buffers_latency(buffers),
+			__atomic_load_n(&buffers->underruns, __ATOMIC_RELAXED)
+		);
+		
+		buffers->report += (uint64_t) buffers->sample_rate * 2;
+	}
+}
+
+int rf_buffers_drain(rf_buffers_t *buffers)
+{
+	uint64_t queued;
+	int64_t wait;
+	
+	/* Hand the part filled buffer to the reader. Nothing may be
+	 * written after this */
+	pthread_mutex_unlock(&buffers->buffers[buffers->in].mutex);
+	
+	/* Wait for the reader to take everything written, allowing
+	 * a second more than it should need */
+	queued = buffers->written - __atomic_load_n(&buffers->read, __ATOMIC_ACQUIRE);
+	wait = (int64_t) (1000000.0 * queued / 2 / buffers->sample_rate) + 1000000;
+	
+	while(__atomic_load_n(&buffers->read, __ATOMIC_ACQUIRE) < buffers->written)
+	{
+		if(wait <= 0)
+		{
+			fprintf(stderr, "Timed out waiting for the transmit buffers to drain.\n");
+			return(HACKTV_ERROR);
+		}
+		
+		usleep(1000);
+		wait -= 1000;
+	}
+	
+	return(HACKTV_OK);
+}
+
+void rf_buffers_fill(rf_buffers_t *buffers, uint8_t *dst, size_t length)
+{
+	uint64_t q;
+	int r;
+	
+	/* Samples queued ahead of this transfer */
+	q = __atomic_load_n(&buffers->written, __ATOMIC_ACQUIRE) - buffers->read;
+	
+	if(buffers->latency_count == 0 || q < buffers->latency_min) buffers->latency_min = q;
+	if(q > buffers->latency_max) buffers->latency_max = q;
+	buffers->latency_sum += q;
+	buffers->latency_count++;
+	
+	while(length)
+	{
+		r = rf_buffers_read(buffers, dst, length);
+		
+		if(r == 0)
+		{
+			/* Buffer underrun, fill with zero */
+			memset(dst, 0, length);
+			length = 0;
+		}
+		else
+		{
+			length -= r;
+			dst += r;
+		}
+	}
+}
+
@@ -0,0 +1,96 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _RFBUFFER_H
+#define _RFBUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* Ring of int8 I/Q buffers between the generator and a device callback.
+ * The writer and reader each hold the lock on their current buffer and
+ * move it on to the next. The reader never waits; if the writer has the
+ * next buffer it is an underrun. The reader should not be started until
+ * the ring has been filled to the prefill mark. The bytes queued between
+ * the writer and the reader give the transmit latency. At the end, the
+ * writer drains the ring to let the reader send what is left in it. */
+
+#define RF_BUFFERS 32
+
+typedef struct {
+	
+	/* Buffers are locked while reading/writing */
+	pthread_mutex_t mutex;
+	
+	/* Pointer to the start of the buffer */
+	int8_t *data;
+	
+	/* Offset to start of data */
+	size_t start;
+	
+	/* Length of data ready */
+	size_t length;
+	
+} rf_buffer_t;
+
+typedef struct {
+	
+	rf_buffer_t *buffers;
+	
+	int length;
+	int count;
+	int in;
+	int out;
+	
+	/* Reads that found no data ready */
+	uint64_t underruns;
+	
+	/* Bytes written to and read from the ring */
+	uint64_t written;
+	uint64_t read;
+	
+	/* Bytes to write before the reader is started */
+	uint64_t prefill;
+	
+	/* Latency seen by the reader, in bytes queued */
+	uint64_t latency_min;
+	uint64_t latency_max;
+	uint64_t latency_sum;
+	uint64_t latency_count;
+	
+	/* Live latency reports */
+	unsigned int sample_rate;
+	int verbose;
+	uint64_t report;
+	
+} rf_buffers_t;
+
+extern int rf_buffers_open(rf_buffers_t *buffers, hacktv_t *s);
+extern int rf_buffers_ready(rf_buffers_t *buffers);
+extern double rf_buffers_latency(rf_buffers_t *buffers);
+extern void rf_buffers_report(rf_buffers_t *buffers, const char *name);
+extern int rf_buffers_init(rf_buffers_t *buffers, size_t count, size_t length);
+extern int rf_buffers_free(rf_buffers_t *buffers);
+extern int rf_buffers_read(rf_buffers_t *buffers, void *dst, size_t length);
+extern int rf_buffers_write(rf_buffers_t *buffers, void *src, size_t length);
+extern void rf_buffers_write_iq(rf_buffers_t *buffers, const int16_t *iq_data, size_t samples);
+extern int rf_buffers_drain(rf_buffers_t *buffers);
+extern void rf_buffers_fill(rf_buffers_t *buffers, uint8_t *dst, size_t length);
+
+#endif
+
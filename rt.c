@@ -0,0 +1,393 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* CPU affinity, real-time scheduling and memory locking for the threads.
+ * Failing to apply a setting is reported but is not fatal, the thread
+ * carries on as it was. */
+
+#ifndef WIN32
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hacktv.h"
+#include "rt.h"
+
+#ifndef WIN32
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+/* Main thread stack to fault in when locking memory */
+#define RT_STACK_PREFAULT (256 * 1024)
+
+typedef struct {
+	const char *name;
+	int policy;
+} _rt_policy_t;
+
+static const _rt_policy_t _policies[] = {
+	{ "other", SCHED_OTHER },
+	{ "fifo",  SCHED_FIFO },
+	{ "rr",    SCHED_RR },
+	{ NULL,    0 },
+};
+
+typedef struct {
+	const char *name;
+	
+	/* CPUs the threads may run on, or all the process started with */
+	int pinned;
+	cpu_set_t cpus;
+	
+	int policy;
+	int priority;
+	
+} _rt_class_t;
+
+static _rt_class_t _classes[RT_CLASSES] = {
+	{ "generator" },
+	{ "sink" },
+	{ "decoder" },
+};
+
+static int _enabled = 0;
+static cpu_set_t _cpus;
+
+static const char *_policy_name(int policy)
+{
+	const _rt_policy_t *p;
+	
+	for(p = _policies; p->name; p++)
+	{
+		if(p->policy == policy) return(p->name);
+	}
+	
+	return("unknown");
+}
+
+static int _parse_cpus(cpu_set_t *cpus, const char *s, const char **end)
+{
+	long a, b;
+	char *e;
+	
+	CPU_ZERO(cpus);
+	
+	while(1)
+	{
+		a = b = strtol(s, &e, 10);
+		if(e == s || a < 0 || a >= CPU_SETSIZE) return(-1);
+		
+		if(*e == '-')
+		{
+			s = e + 1;
+			b = strtol(s, &e, 10);
+			if(e == s || b < a || b >= CPU_SETSIZE) return(-1);
+		}
+		
+		for(; a <= b; a++)
+		{
+			CPU_SET(a, cpus);
+		}
+		
+		if(*e != ',') break;
+		s = e + 1;
+	}
+	
+	*end = e;
+	
+	return(0);
+}
+
+static int _parse(_rt_class_t *c, const char *s)
+{
+	const _rt_policy_t *p;
+	char *e;
+	int l;
+	
+	c->pinned = 0;
+	c->policy = SCHED_OTHER;
+	c->priority = 0;
+	
+	if(*s != ':' && *s != '\0')
+	{
+		if(_parse_cpus(&c->cpus, s, &s) != 0) return(-1);
+		c->pinned = 1;
+	}
+	
+	if(*s == ':')
+	{
+		s++;
+		
+		for(p = _policies; p->name; p++)
+		{
+			l = strlen(p->name);
+			if(strncmp(s, p->name, l) == 0 && (s[l] == ':' || s[l] == '\0')) break;
+		}
+		
+		if(p->name == NULL) return(-1);
+		
+		c->policy = p->policy;
+		s += l;
+		
+		if(c->policy != SCHED_OTHER)
+		{
+			c->priority = RT_DEFAULT_PRIORITY;
+		}
+		
+		if(*s == ':')
+		{
+			c->priority = strtol(s + 1, &e, 10);
+			if(e == s + 1) return(-1);
+			s = e;
+		}
+		
+		if(c->priority < sched_get_priority_min(c->policy) ||
+		   c->priority > sched_get_priority_max(c->policy))
+		{
+			return(-1);
+		}
+	}
+	
+	return(*s == '\0' ? 0 : -1);
+}
+
+static void _format_cpus(char *s, size_t len, cpu_set_t *cpus)
+{
+	int a, b, n;
+	
+	*s = '\0';
+	
+	for(a = 0; a < CPU_SETSIZE && len > 1; a = b + 1)
+	{
+		if(!CPU_ISSET(a, cpus))
+		{
+			b = a;
+			continue;
+		}
+		
+		for(b = a; b + 1 < CPU_SETSIZE && CPU_ISSET(b + 1, cpus); b++);
+		
+		if(a == b) n = snprintf(s, len, "%s%d", *s ? "," : "", a);
+		else n = snprintf(s, len, "%s%d-%d", *s ? "," : "", a, b);
+		
+		if(n < 0 || n >= len) break;
+		s += n;
+		len -= n;
+	}
+}
+
+static void _prefault_stack(void)
+{
+	volatile char stack[RT_STACK_PREFAULT];
+	int i;
+	
+	for(i = 0; i < sizeof(stack); i += 4096)
+	{
+		stack[i] = 0;
+	}
+}
+
+static void _apply(_rt_class_t *c, int report)
+{
+	struct sched_param sp;
+	cpu_set_t cpus;
+	char str[256];
+	int ra, rs;
+	int policy;
+	
+	/* Threads inherit the settings of the thread that started them,
+	 * so classes left unset are put back to how the process started */
+	ra = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), c->pinned ? &c->cpus : &_cpus);
+	
+	sp.sched_priority = c->priority;
+	rs = pthread_setschedparam(pthread_self(), c->policy, &sp);
+	
+	if(!report)
+	{
+		return;
+	}
+	
+	if(ra != 0)
+	{
+		fprintf(stderr, "Warning: Unable to set the %s thread CPUs: %s\n", c->name, strerror(ra));
+	}
+	
+	if(rs != 0)
+	{
+		fprintf(stderr, "Warning: Unable to set the %s thread to %s priority %d: %s\n",
+			c->name, _policy_name(c->policy), c->priority, strerror(rs));
+	}
+	
+	if(pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus) != 0 ||
+	   pthread_getschedparam(pthread_self(), &policy, &sp) != 0)
+	{
+		return;
+	}
+	
+	_format_cpus(str, sizeof(str), &cpus);
+	fprintf(stderr, "Thread %s: CPUs %s, %s", c->name, str, _policy_name(policy));
+	
+	if(policy == SCHED_FIFO || policy == SCHED_RR)
+	{
+		fprintf(stderr, " priority %d", sp.sched_priority);
+	}
+	
+	fprintf(stderr, "\n");
+}
+
+static void *_report_thread(void *arg)
+{
+	_apply(arg, 1);
+	
+	return(NULL);
+}
+
+static void _report(void)
+{
+	pthread_t thread;
+	int i;
+	
+	/* Try each class's settings on a short lived thread, so what the
+	 * threads will end up with is known before any of them start */
+	for(i = 0; i < RT_CLASSES; i++)
+	{
+		if(pthread_create(&thread, NULL, _report_thread, &_classes[i]) != 0)
+		{
+			fprintf(stderr, "Warning: Unable to check the %s thread settings.\n", _classes[i].name);
+			continue;
+		}
+		
+		pthread_join(thread, NULL);
+	}
+}
+
+int rt_init(const char *generator, const char *sink, const char *decoder, int lock)
+{
+	const char *settings[RT_CLASSES] = { generator, sink, decoder };
+	int i;
+	
+	if(sched_getaffinity(0, sizeof(cpu_set_t), &_cpus) != 0)
+	{
+		CPU_ZERO(&_cpus);
+		for(i = 0; i < CPU_SETSIZE; i++) CPU_SET(i, &_cpus);
+	}
+	
+	for(i = 0; i < RT_CLASSES; i++)
+	{
+		_classes[i].pinned = 0;
+		_classes[i].policy = SCHED_OTHER;
+		_classes[i].priority = 0;
+		
+		if(settings[i] == NULL) continue;
+		
+		if(_parse(&_classes[i], settings[i]) != 0)
+		{
+			fprintf(stderr, "Invalid %s thread settings '%s'.\n", _classes[i].name, settings[i]);
+			return(HACKTV_ERROR);
+		}
+		
+		_enabled = 1;
+	}
+	
+	if(_enabled)
+	{
+		_report();
+	}
+	
+	#ifdef __GLIBC__
+	if(lock)
+	{
+		/* Keep freed memory in the heap rather than returning it to
+		 * the kernel, where it would have to be faulted in again. Frame
+		 * sized buffers are taken from the heap too, not mapped for
+		 * each frame */
+		mallopt(M_TRIM_THRESHOLD, -1);
+		mallopt(M_MMAP_THRESHOLD, 16 * 1024 * 1024);
+	}
+	#endif
+	
+	return(HACKTV_OK);
+}
+
+void rt_lock(void)
+{
+	struct rlimit rl;
+	int limited;
+	
+	/* The limit does not apply to root */
+	limited = geteuid() != 0 && getrlimit(RLIMIT_MEMLOCK, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY;
+	
+	/* Lock what is allocated so far, the video tables and buffers.
+	 * Later allocations are only locked too when there is no limit,
+	 * as any that went past it would fail */
+	if(mlockall(limited ? MCL_CURRENT : MCL_CURRENT | MCL_FUTURE) != 0)
+	{
+		perror("mlockall");
+		fprintf(stderr, "Warning: Memory is not locked. Check the locked memory limit (ulimit -l).\n");
+		return;
+	}
+	
+	_prefault_stack();
+	
+	if(limited)
+	{
+		fprintf(stderr, "Memory locked, limit %.1f MB. Memory allocated from here on is not locked.\n", rl.rlim_cur / 1048576.0);
+	}
+	else
+	{
+		fprintf(stderr, "Memory locked, no limit.\n");
+	}
+}
+
+void rt_thread(int cls)
+{
+	if(!_enabled) return;
+	
+	_apply(&_classes[cls], 0);
+}
+
+#else
+
+int rt_init(const char *generator, const char *sink, const char *decoder, int lock)
+{
+	if(generator || sink || decoder || lock)
+	{
+		fprintf(stderr, "Warning: Thread scheduling and memory locking are not supported on this platform.\n");
+	}
+	
+	return(HACKTV_OK);
+}
+
+void rt_lock(void)
+{
+}
+
+void rt_thread(int cls)
+{
+}
+
+#endif
+
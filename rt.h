@@ -0,0 +1,43 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _RT_H
+#define _RT_H
+
+/* Thread classes. Each thread calls rt_thread() with its class as it
+ * starts, which applies the CPU affinity and scheduling set for it */
+#define RT_GENERATOR 0 /* Renders the signal */
+#define RT_SINK      1 /* Feeds an output */
+#define RT_DECODER   2 /* Reads and decodes an input */
+#define RT_CLASSES   3
+
+/* Priority used when a real-time policy is given without one. Kept below
+ * the kernel's threaded interrupt handlers, which the USB devices need */
+#define RT_DEFAULT_PRIORITY 10
+
+/* Settings are "[<cpus>][:<policy>[:<priority>]]", or NULL to leave the
+ * class unchanged. The settings each class ends up with are reported.
+ * Must be called before any threads are started */
+extern int rt_init(const char *generator, const char *sink, const char *decoder, int lock);
+
+/* Locks the memory allocated so far into RAM. Call once the video
+ * tables and buffers are allocated, if lock was passed to rt_init() */
+extern void rt_lock(void);
+extern void rt_thread(int cls);
+
+#endif
+
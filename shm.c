@@ -0,0 +1,299 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef WIN32
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hacktv.h"
+#include "shm.h"
+
+/* Milliseconds of output held in the ring */
+#define SHM_RING_MS 500
+
+/* How far the output may fall behind real time before the pacing
+ * clock is reset, in nanoseconds */
+#define SHM_PACE_SLACK 100000000LL
+
+typedef struct {
+	char *name;
+	int fd;
+	void *map;
+	size_t map_len;
+	shm_header_t *h;
+	int16_t *ring;
+	uint64_t pos;
+	
+	/* Real time pacing */
+	int paced;
+	struct timespec start;
+	uint64_t start_pos;
+	
+} rf_shm_t;
+
+static int64_t _ns(const struct timespec *t)
+{
+	return((int64_t) t->tv_sec * 1000000000LL + t->tv_nsec);
+}
+
+static void _rf_shm_pace(rf_shm_t *rf)
+{
+	struct timespec now;
+	int64_t due;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	if(rf->start.tv_sec == 0 && rf->start.tv_nsec == 0)
+	{
+		rf->start = now;
+		rf->start_pos = rf->pos;
+		return;
+	}
+	
+	/* The time the last sample written is due to be sent */
+	due = _ns(&rf->start) + (int64_t) ((rf->pos - rf->start_pos) * 1000000000.0 / rf->h->sample_rate);
+	
+	if(_ns(&now) - due > SHM_PACE_SLACK)
+	{
+		/* Running late, don't try to catch up */
+		rf->start = now;
+		rf->start_pos = rf->pos;
+	}
+	else if(due > _ns(&now))
+	{
+		now.tv_sec = due / 1000000000LL;
+		now.tv_nsec = due % 1000000000LL;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &now, NULL);
+	}
+}
+
+static int _rf_shm_write(void *private, const int16_t *iq_data, size_t samples)
+{
+	rf_shm_t *rf = private;
+	size_t o, n;
+	
+	/* Mark the samples about to be overwritten before touching them */
+	__atomic_store_n(&rf->h->write_end, rf->pos + samples, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	
+	while(samples > 0)
+	{
+		o = rf->pos % rf->h->ring_samples;
+		n = rf->h->ring_samples - o;
+		if(n > samples) n = samples;
+		
+		memcpy(&rf->ring[o * 2], iq_data, sizeof(int16_t) * 2 * n);
+		
+		rf->pos += n;
+		iq_data += n * 2;
+		samples -= n;
+	}
+	
+	/* Publish the new samples */
+	__atomic_store_n(&rf->h->write_pos, rf->pos, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&rf->h->sequence, 1, __ATOMIC_RELEASE);
+	
+	if(rf->paced)
+	{
+		_rf_shm_pace(rf);
+	}
+	
+	return(HACKTV_OK);
+}
+
+static int _rf_shm_stale(const char *name)
+{
+	struct stat st;
+	shm_header_t *h;
+	int fd, r;
+	
+	/* Check an existing object is a ring with no writer */
+	fd = shm_open(name, O_RDONLY, 0);
+	if(fd < 0)
+	{
+		perror(name);
+		return(0);
+	}
+	
+	if(fstat(fd, &st) != 0 || st.st_size < sizeof(shm_header_t))
+	{
+		fprintf(stderr, "%s exists and is not an IQ ring.\n", name);
+		close(fd);
+		return(0);
+	}
+	
+	h = mmap(NULL, sizeof(shm_header_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	
+	if(h == MAP_FAILED)
+	{
+		perror("mmap");
+		return(0);
+	}
+	
+	r = 0;
+	
+	if(h->magic != SHM_MAGIC)
+	{
+		fprintf(stderr, "%s exists and is not an IQ ring.\n", name);
+	}
+	else if(h->version != SHM_VERSION)
+	{
+		fprintf(stderr, "%s is an IQ ring of a different version. Remove /dev/shm%s to replace it.\n", name, name);
+	}
+	else if(__atomic_load_n(&h->active, __ATOMIC_ACQUIRE))
+	{
+		fprintf(stderr, "%s is in use by another writer. If it was left behind, remove /dev/shm%s.\n", name, name);
+	}
+	else
+	{
+		r = 1;
+	}
+	
+	munmap(h, sizeof(shm_header_t));
+	
+	return(r);
+}
+
+static int _rf_shm_close(void *private)
+{
+	rf_shm_t *rf = private;
+	
+	if(rf->h)
+	{
+		__atomic_store_n(&rf->h->active, 0, __ATOMIC_RELEASE);
+	}
+	
+	if(rf->map) munmap(rf->map, rf->map_len);
+	if(rf->fd >= 0) close(rf->fd);
+	if(rf->name)
+	{
+		shm_unlink(rf->name);
+		free(rf->name);
+	}
+	
+	free(rf);
+	
+	return(HACKTV_OK);
+}
+
+int rf_shm_open(hacktv_t *s, char *name, int paced)
+{
+	rf_shm_t *rf;
+	size_t header_size;
+	uint64_t ring_samples;
+	
+	if(name == NULL || *name == '\0')
+	{
+		fprintf(stderr, "No shared memory name provided.\n");
+		return(HACKTV_ERROR);
+	}
+	
+	rf = calloc(1, sizeof(rf_shm_t));
+	if(!rf)
+	{
+		perror("calloc");
+		return(HACKTV_ERROR);
+	}
+	
+	rf->fd = -1;
+	rf->paced = paced;
+	
+	/* POSIX shared memory names begin with a single slash */
+	rf->name = malloc(strlen(name) + 2);
+	if(!rf->name)
+	{
+		perror("malloc");
+		_rf_shm_close(rf);
+		return(HACKTV_ERROR);
+	}
+	
+	sprintf(rf->name, "%s%s", name[0] == '/' ? "" : "/", name);
+	
+	rf->fd = shm_open(rf->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if(rf->fd < 0 && errno == EEXIST && _rf_shm_stale(rf->name))
+	{
+		/* Replace a ring left behind by an earlier run. Readers
+		 * still attached to it keep their mapping */
+		shm_unlink(rf->name);
+		rf->fd = shm_open(rf->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	}
+	
+	if(rf->fd < 0)
+	{
+		if(errno != EEXIST) perror(rf->name);
+		free(rf->name);
+		rf->name = NULL;
+		_rf_shm_close(rf);
+		return(HACKTV_ERROR);
+	}
+	
+	/* Keep the ring aligned to a cache line */
+	header_size = (sizeof(shm_header_t) + 63) & ~(size_t) 63;
+	ring_samples = (uint64_t) s->vid.sample_rate * SHM_RING_MS / 1000;
+	rf->map_len = header_size + ring_samples * sizeof(int16_t) * 2;
+	
+	if(ftruncate(rf->fd, rf->map_len) != 0)
+	{
+		perror("ftruncate");
+		_rf_shm_close(rf);
+		return(HACKTV_ERROR);
+	}
+	
+	rf->map = mmap(NULL, rf->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, rf->fd, 0);
+	if(rf->map == MAP_FAILED)
+	{
+		perror("mmap");
+		rf->map = NULL;
+		_rf_shm_close(rf);
+		return(HACKTV_ERROR);
+	}
+	
+	rf->h = rf->map;
+	rf->ring = (int16_t *) ((uint8_t *) rf->map + header_size);
+	
+	rf->h->magic = SHM_MAGIC;
+	rf->h->version = SHM_VERSION;
+	rf->h->header_size = header_size;
+	rf->h->flags = s->vid.conf.output_type == HACKTV_INT16_COMPLEX ? SHM_COMPLEX : 0;
+	rf->h->sample_rate = s->vid.sample_rate;
+	rf->h->frequency = s->frequency;
+	rf->h->ring_samples = ring_samples;
+	strncpy(rf->h->mode, s->mode, sizeof(rf->h->mode) - 1);
+	rf->h->write_pos = 0;
+	rf->h->write_end = 0;
+	rf->h->sequence = 0;
+	__atomic_store_n(&rf->h->active, 1, __ATOMIC_RELEASE);
+	
+	/* Register the callback functions */
+	s->rf_private = rf;
+	s->rf_write = _rf_shm_write;
+	s->rf_close = _rf_shm_close;
+	
+	return(HACKTV_OK);
+}
+
+#endif
+
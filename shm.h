@@ -0,0 +1,80 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _SHM_H
+#define _SHM_H
+
+#include <stdint.h>
+
+/* Shared memory IQ ring
+ *
+ * A POSIX shared memory object holding a header followed by a ring of
+ * ring_samples int16 I/Q pairs, in host byte order. Real modes leave Q
+ * at zero. Sample n of the output is stored at position
+ * n % ring_samples.
+ *
+ * The writer never waits for readers. Before copying a block into the
+ * ring it stores the position the block ends at in write_end, followed
+ * by a release fence. Once the copy is done it advances write_pos (a
+ * release store) to the same position, and increments sequence. The
+ * samples between write_pos and write_end may be part written. A reader
+ * keeps its own position:
+ *
+ * 1. Load write_pos (acquire). Nothing new if it equals the position.
+ * 2. If write_pos - position > ring_samples the reader has been
+ *    overrun. Skip ahead to write_pos.
+ * 3. Copy the samples from position to write_pos.
+ * 4. Issue an acquire fence and load write_end. If it is more than
+ *    ring_samples ahead of the position, the writer may have been
+ *    overwriting the samples during the copy, and they should be
+ *    treated as an overrun.
+ *
+ * active is set while a writer has the ring open, and cleared when it
+ * closes. The object is unlinked at close, so readers which are still
+ * attached can finish reading. A writer will only replace an existing
+ * object that is an inactive ring.
+*/
+
+#define SHM_MAGIC   0x51495654 /* "TVIQ" */
+#define SHM_VERSION 2
+
+/* Header flags */
+#define SHM_COMPLEX 0x0001
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t flags;
+	uint32_t sample_rate;
+	uint32_t reserved;
+	uint64_t frequency;
+	uint64_t ring_samples;
+	char mode[32];
+	
+	/* Updated by the writer */
+	uint64_t write_pos;
+	uint64_t write_end;
+	uint64_t sequence;
+	uint32_t active;
+	
+} shm_header_t;
+
+extern int rf_shm_open(hacktv_t *s, char *name, int paced);
+
+#endif
+
@@ -422,24 +422,47 @@ void _render_ng_vbi(ng_t *s, vid_t *vid, vid_line_t *l)
 
 int _ng_audio_init(ng_t *s)
 {
-	/* Allocate memory for the audio inversion FIR filters */
-	s->firli = calloc(NTAPS * 2, sizeof(int16_t));
-	s->firlq = calloc(NTAPS * 2, sizeof(int16_t));
-	s->firri = calloc(NTAPS * 2, sizeof(int16_t));
-	s->firrq = calloc(NTAPS * 2, sizeof(int16_t));
+	int p, x, m;
+	
+	/* The mixer repeats every 5 samples, so it can be folded into
+	 * the complex filter. This leaves 5 sets of real taps, one for
+	 * each phase of the mixer at the newest sample:
+	 * 
+	 * h[p][x] = mi[m] * firi[x] - mq[m] * firq[x]
+	 * 
+	 * Where m is the mixer phase of the sample at tap x, and mi and
+	 * mq are the I and Q outputs of the mixer for a real input.
+	*/
+	s->firh = malloc(sizeof(int16_t) * NTAPS * 5);
+	
+	/* Ring buffer of interleaved stereo samples, duplicated so the
+	 * filter can always read NTAPS contiguous samples */
+	s->firs = calloc(NTAPS * 2 * 2, sizeof(int16_t));
 	s->mixx = 0;
 	s->firx = 0;
 	
-	if(s->firli == NULL || s->firlq == NULL ||
-		 s->firri == NULL || s->firrq == NULL)
+	if(s->firh == NULL || s->firs == NULL)
 	{
 		return(VID_OUT_OF_MEMORY);
 	}
 	
+	for(p = 0; p < 5; p++)
+	{
+		for(x = 0; x < NTAPS; x++)
+		{
+			m = ((p - (NTAPS - 1) + x) % 5 + 5) % 5;
+			
+			s->firh[p * NTAPS + x] = lround((
+				(double) (_mixi[m] - _mixq[m]) * _firi[x] -
+				(double) (_mixq[m] + _mixi[m]) * _firq[x]
+			) / 32768.0);
+		}
+	}
+	
 	return(VID_OK);
 }
 
-void _rand_seed(ng_t *s, unsigned char data[8], unsigned char key[8], int ecm_type)
+void _rand_seed(ng_t *s, unsigned char data[8], unsigned char key[8], int ecm_type, unsigned int *seed)
 {
 	int i, j;
 	
@@ -448,7 +471,7 @@ void _rand_seed(ng_t *s, unsigned char data[8], unsigned char key[8], int ecm_ty
 	{
 		for(i = 0; i < 16; i++)
 		{
-			s->blocks[j].ecm[i] = i < 4 || i > 11 ? (ecm_type == STATIC_ECM ? i : rand() + 0xFF) : data[i-4];
+			s->blocks[j].ecm[i] = i < 4 || i > 11 ? (ecm_type == STATIC_ECM ? i : rand_r(seed) + 0xFF) : data[i-4];
 		}
 		
 		/* Encrypt plain control word to send to card */
@@ -513,17 +536,15 @@ int _init_common(ng_t *s, vid_t *vid, char *mode, int ecm_type)
 	s->table = (vid->conf.scramble_video == 1 ? _key_table1 : _key_table2);
 	
 	/* Generate random seeds */
-	_rand_seed(s, n->data, n->key, ecm_type);
+	_rand_seed(s, n->data, n->key, ecm_type, &vid->rand_seed);
 	
 	return(VID_OK);
 }
 
 int ng_init(ng_t *s, vid_t *vid)
 {
-	time_t t;
 	int x;
 	
-	srand((unsigned) time(&t));
 	char *mode = vid->conf.syster ? vid->conf.syster : vid->conf.systercnr;
 	
 	if(vid->conf.syster && vid->conf.systercnr)
@@ -570,18 +591,18 @@ int ng_init(ng_t *s, vid_t *vid)
 
 void ng_free(ng_t *s)
 {
-	free(s->firli);
-	free(s->firlq);
-	free(s->firri);
-	free(s->firrq);
+	free(s->firh);
+	free(s->firs);
 	free(s->delay);
 	free(s->lut);
 }
 
 void ng_invert_audio(ng_t *s, int16_t *audio, size_t samples)
 {
+	const int16_t *h;
+	const int16_t *w;
 	int i, x;
-	int a;
+	int l, r;
 	
 	/* Invert the audio spectrum below 12.8 kHz.
 	 * 
@@ -591,49 +612,32 @@ void ng_invert_audio(ng_t *s, int16_t *audio, size_t samples)
 	 * copied back into the audio buffer.
 	 * 
 	 * The mixing and filtering use complex operations to avoid the
-	 * upper sideband interfering after mixing.
+	 * upper sideband interfering after mixing. Both are folded into
+	 * the real taps selected by the mixer phase, see _ng_audio_init().
 	 */
 	
 	if(audio == NULL) return;
 	
 	for(i = 0; i < samples; i++)
 	{
-		/* Left */
-		s->firli[s->firx + NTAPS] = s->firli[s->firx] =
-			(audio[i * 2 + 0] * _mixi[s->mixx] -
-			 audio[i * 2 + 0] * _mixq[s->mixx]) >> 15;
-		s->firlq[s->firx + NTAPS] = s->firlq[s->firx] =
-			(audio[i * 2 + 0] * _mixq[s->mixx] +
-			 audio[i * 2 + 0] * _mixi[s->mixx]) >> 15;
+		s->firs[(s->firx + NTAPS) * 2 + 0] = s->firs[s->firx * 2 + 0] = audio[i * 2 + 0];
+		s->firs[(s->firx + NTAPS) * 2 + 1] = s->firs[s->firx * 2 + 1] = audio[i * 2 + 1];
 		
-		/* Right */
-		s->firri[s->firx + NTAPS] = s->firri[s->firx] =
-			(audio[i * 2 + 1] * _mixi[s->mixx] -
-			 audio[i * 2 + 1] * _mixq[s->mixx]) >> 15;
-		s->firrq[s->firx + NTAPS] = s->firrq[s->firx] =
-			(audio[i * 2 + 1] * _mixq[s->mixx] +
-			 audio[i * 2 + 1] * _mixi[s->mixx]) >> 15;
+		h = &s->firh[s->mixx * NTAPS];
 		
 		if(++s->firx == NTAPS) s->firx = 0;
 		if(++s->mixx == 5) s->mixx = 0;
 		
-		/* Left */
-		for(a = x = 0; x < NTAPS; x++)
-		{
-			a += s->firli[s->firx + x] * _firi[x] -
-			     s->firlq[s->firx + x] * _firq[x];
-		}
-		
-		audio[i * 2 + 0] = a >> 15;
+		w = &s->firs[s->firx * 2];
 		
-		/* Right */
-		for(a = x = 0; x < NTAPS; x++)
+		for(l = r = x = 0; x < NTAPS; x++)
 		{
-			a += s->firri[s->firx + x] * _firi[x] -
-			     s->firrq[s->firx + x] * _firq[x];
+			l += w[x * 2 + 0] * h[x];
+			r += w[x * 2 + 1] * h[x];
 		}
 		
-		audio[i * 2 + 1] = a >> 15;
+		audio[i * 2 + 0] = l >> 15;
+		audio[i * 2 + 1] = r >> 15;
 	}
 }
 
@@ -125,8 +125,8 @@ typedef struct {
 	int d11_line_delay[D11_LINES_PER_FIELD * D11_FIELDS];
 
 	/* Audio inversion FIR filter */
-	int16_t *firli, *firlq; /* Left channel, I + Q */
-	int16_t *firri, *firrq; /* Right channel, I + Q */
+	int16_t *firh; /* Taps for each mixer phase */
+	int16_t *firs; /* Stereo sample ring */
 	int mixx;
 	int firx;
 	
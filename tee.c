@@ -0,0 +1,541 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* The tee sink copies each block of output once and passes a reference
+ * to it to every output. Each output writes its blocks on its own thread.
+ * The first output paces the generator. The others drop blocks when their
+ * queue is full, and write silence in their place so the recording keeps
+ * its timing. Where each run of silence starts can be logged to a file.
+ * An output other than the first that fails is detached, and the rest
+ * carry on without it. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include "hacktv.h"
+#include "tee.h"
+#include "rt.h"
+
+/* Lines of output per block */
+#define TEE_BLOCK_LINES 16
+
+/* Milliseconds of output each queue can hold */
+#define TEE_QUEUE_MS 500
+
+typedef struct {
+	int16_t *iq;
+	size_t samples;
+	int refs;
+} _tee_block_t;
+
+typedef struct {
+	_tee_block_t *block;
+	
+	/* Samples dropped before this block */
+	size_t gap;
+	
+} _tee_entry_t;
+
+typedef struct _rf_tee_t rf_tee_t;
+
+typedef struct {
+	rf_tee_t *tee;
+	char *name;
+	
+	/* The output's own sink interface */
+	void *private;
+	hacktv_rf_write_t write;
+	hacktv_rf_close_t close;
+	
+	/* Blocks waiting to be written */
+	_tee_entry_t *queue;
+	int head;
+	int len;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t thread;
+	int thread_running;
+	int abort;
+	
+	/* Samples dropped since the last queued block */
+	size_t gap;
+	
+	/* Samples written, including silence */
+	uint64_t position;
+	
+	/* Totals */
+	uint64_t dropped_blocks;
+	uint64_t dropped_samples;
+	
+	int error;
+	int detached;
+	
+} _tee_output_t;
+
+struct _rf_tee_t {
+	_tee_output_t out[TEE_MAX_OUTPUTS];
+	int outputs;
+	int depth;
+	
+	/* The block pool */
+	size_t block_samples;
+	_tee_block_t *blocks;
+	_tee_block_t **free;
+	int nblocks;
+	int nfree;
+	pthread_mutex_t free_mutex;
+	
+	/* The block being filled */
+	_tee_block_t *block;
+	
+	/* Silence written in place of dropped blocks */
+	int16_t *zeros;
+	
+	/* Log of the dropped blocks, or NULL */
+	FILE *log;
+};
+
+static _tee_block_t *_tee_alloc(rf_tee_t *rf)
+{
+	_tee_block_t *b = NULL;
+	
+	/* The pool holds one block more than the outputs can have
+	 * queued or in flight, so one is always free here */
+	pthread_mutex_lock(&rf->free_mutex);
+	if(rf->nfree > 0) b = rf->free[--rf->nfree];
+	pthread_mutex_unlock(&rf->free_mutex);
+	
+	return(b);
+}
+
+static void _tee_release(rf_tee_t *rf, _tee_block_t *b)
+{
+	if(__atomic_sub_fetch(&b->refs, 1, __ATOMIC_ACQ_REL) > 0)
+	{
+		return;
+	}
+	
+	b->samples = 0;
+	
+	pthread_mutex_lock(&rf->free_mutex);
+	rf->free[rf->nfree++] = b;
+	pthread_mutex_unlock(&rf->free_mutex);
+}
+
+static int _tee_fill(_tee_output_t *o, size_t samples)
+{
+	size_t n;
+	
+	if(o->tee->log)
+	{
+		fprintf(o->tee->log, "%s\t%" PRIu64 "\t%zu\n", o->name, o->position, samples);
+	}
+	
+	o->position += samples;
+	
+	while(samples > 0)
+	{
+		n = samples < o->tee->block_samples ? samples : o->tee->block_samples;
+		
+		if(o->write(o->private, o->tee->zeros, n) != HACKTV_OK)
+		{
+			return(HACKTV_ERROR);
+		}
+		
+		samples -= n;
+	}
+	
+	return(HACKTV_OK);
+}
+
+static void *_tee_thread(void *arg)
+{
+	_tee_output_t *o = arg;
+	rf_tee_t *rf = o->tee;
+	_tee_entry_t e;
+	int r;
+	
+	rt_thread(RT_SINK);
+	
+	pthread_mutex_lock(&o->mutex);
+	
+	while(1)
+	{
+		while(o->len == 0 && !o->abort)
+		{
+			pthread_cond_wait(&o->cond, &o->mutex);
+		}
+		
+		if(o->len == 0)
+		{
+			/* Aborted with nothing left to write */
+			break;
+		}
+		
+		e = o->queue[o->head];
+		pthread_mutex_unlock(&o->mutex);
+		
+		r = HACKTV_OK;
+		
+		if(!o->error)
+		{
+			if(e.gap > 0) r = _tee_fill(o, e.gap);
+			if(r == HACKTV_OK) r = o->write(o->private, e.block->iq, e.block->samples);
+			o->position += e.block->samples;
+		}
+		
+		_tee_release(rf, e.block);
+		
+		pthread_mutex_lock(&o->mutex);
+		
+		if(r != HACKTV_OK)
+		{
+			o->error = 1;
+		}
+		
+		o->head = (o->head + 1) % rf->depth;
+		o->len--;
+		pthread_cond_signal(&o->cond);
+	}
+	
+	/* Blocks dropped at the very end still need their silence */
+	if(!o->error && o->gap > 0 && _tee_fill(o, o->gap) != HACKTV_OK)
+	{
+		o->error = 1;
+	}
+	
+	pthread_mutex_unlock(&o->mutex);
+	
+	return(NULL);
+}
+
+static int _tee_dispatch(rf_tee_t *rf)
+{
+	_tee_block_t *b = rf->block;
+	_tee_output_t *o;
+	int r = HACKTV_OK;
+	int i;
+	
+	b->refs = rf->outputs;
+	
+	for(i = 0; i < rf->outputs; i++)
+	{
+		o = &rf->out[i];
+		
+		pthread_mutex_lock(&o->mutex);
+		
+		/* Only the first output may hold up the generator */
+		while(i == 0 && o->len == rf->depth && !o->error)
+		{
+			pthread_cond_wait(&o->cond, &o->mutex);
+		}
+		
+		if(o->error)
+		{
+			/* Only a failure of the first output stops
+			 * the run. Any other is detached */
+			if(i == 0)
+			{
+				r = HACKTV_ERROR;
+			}
+			else if(!o->detached)
+			{
+				fprintf(stderr, "tee: %s: write failed, detaching output\n", o->name);
+				o->detached = 1;
+			}
+			
+			pthread_mutex_unlock(&o->mutex);
+			
+			_tee_release(rf, b);
+			continue;
+		}
+		
+		if(o->len == rf->depth)
+		{
+			o->gap += b->samples;
+			o->dropped_blocks++;
+			o->dropped_samples += b->samples;
+			pthread_mutex_unlock(&o->mutex);
+			
+			_tee_release(rf, b);
+			continue;
+		}
+		
+		o->queue[(o->head + o->len) % rf->depth].block = b;
+		o->queue[(o->head + o->len) % rf->depth].gap = o->gap;
+		o->gap = 0;
+		o->len++;
+		
+		pthread_cond_signal(&o->cond);
+		pthread_mutex_unlock(&o->mutex);
+	}
+	
+	rf->block = _tee_alloc(rf);
+	
+	return(r);
+}
+
+static int _rf_tee_write(void *private, const int16_t *iq_data, size_t samples)
+{
+	rf_tee_t *rf = private;
+	_tee_block_t *b;
+	size_t n;
+	
+	while(samples > 0)
+	{
+		b = rf->block;
+		
+		n = rf->block_samples - b->samples;
+		if(n > samples) n = samples;
+		
+		memcpy(&b->iq[b->samples * 2], iq_data, sizeof(int16_t) * 2 * n);
+		b->samples += n;
+		iq_data += n * 2;
+		samples -= n;
+		
+		if(b->samples == rf->block_samples &&
+		   _tee_dispatch(rf) != HACKTV_OK)
+		{
+			return(HACKTV_ERROR);
+		}
+	}
+	
+	return(HACKTV_OK);
+}
+
+static int _rf_tee_close(void *private)
+{
+	rf_tee_t *rf = private;
+	_tee_output_t *o;
+	int r = HACKTV_OK;
+	int i;
+	
+	/* Send the last partial block */
+	if(rf->block && rf->block->samples > 0)
+	{
+		_tee_dispatch(rf);
+	}
+	
+	/* Let every output drain its queue */
+	for(i = 0; i < rf->outputs; i++)
+	{
+		o = &rf->out[i];
+		
+		pthread_mutex_lock(&o->mutex);
+		o->abort = 1;
+		pthread_cond_signal(&o->cond);
+		pthread_mutex_unlock(&o->mutex);
+	}
+	
+	for(i = 0; i < rf->outputs; i++)
+	{
+		o = &rf->out[i];
+		
+		if(o->thread_running)
+		{
+			pthread_join(o->thread, NULL);
+		}
+		
+		if(o->dropped_blocks > 0)
+		{
+			fprintf(stderr, "tee: %s: dropped %" PRIu64 " blocks (%" PRIu64 " samples)\n",
+				o->name, o->dropped_blocks, o->dropped_samples);
+		}
+		
+		if(o->error)
+		{
+			if(!o->detached)
+			{
+				fprintf(stderr, "tee: %s: write failed\n", o->name);
+			}
+			
+			r = HACKTV_ERROR;
+		}
+		
+		if(o->close && o->close(o->private) != HACKTV_OK)
+		{
+			r = HACKTV_ERROR;
+		}
+		
+		pthread_cond_destroy(&o->cond);
+		pthread_mutex_destroy(&o->mutex);
+		free(o->queue);
+		free(o->name);
+	}
+	
+	if(rf->blocks)
+	{
+		for(i = 0; i < rf->nblocks; i++)
+		{
+			free(rf->blocks[i].iq);
+		}
+		
+		free(rf->blocks);
+	}
+	
+	if(rf->log && fclose(rf->log) != 0)
+	{
+		perror("tee: fclose");
+		r = HACKTV_ERROR;
+	}
+	
+	pthread_mutex_destroy(&rf->free_mutex);
+	free(rf->free);
+	free(rf->zeros);
+	free(rf);
+	
+	return(r);
+}
+
+int rf_tee_open(hacktv_t *s, char *targets, rf_tee_open_t open)
+{
+	rf_tee_t *rf;
+	_tee_output_t *o;
+	char *target, *next;
+	int i;
+	
+	if(targets == NULL || *targets == '\0')
+	{
+		fprintf(stderr, "No tee outputs provided.\n");
+		return(HACKTV_ERROR);
+	}
+	
+	rf = calloc(1, sizeof(rf_tee_t));
+	if(!rf)
+	{
+		perror("calloc");
+		return(HACKTV_ERROR);
+	}
+	
+	pthread_mutex_init(&rf->free_mutex, NULL);
+	
+	/* Open each of the comma separated outputs */
+	for(target = targets; target != NULL; target = next)
+	{
+		next = strchr(target, ',');
+		if(next != NULL) *next++ = '\0';
+		
+		if(rf->outputs == TEE_MAX_OUTPUTS)
+		{
+			fprintf(stderr, "Too many tee outputs. The maximum is %d.\n", TEE_MAX_OUTPUTS);
+			_rf_tee_close(rf);
+			return(HACKTV_ERROR);
+		}
+		
+		o = &rf->out[rf->outputs];
+		o->tee = rf;
+		o->name = strdup(target);
+		
+		s->rf_private = NULL;
+		s->rf_write = NULL;
+		s->rf_close = NULL;
+		
+		if(o->name == NULL || open(s, target, rf->outputs == 0) != HACKTV_OK)
+		{
+			free(o->name);
+			o->name = NULL;
+			_rf_tee_close(rf);
+			return(HACKTV_ERROR);
+		}
+		
+		o->private = s->rf_private;
+		o->write = s->rf_write;
+		o->close = s->rf_close;
+		pthread_mutex_init(&o->mutex, NULL);
+		pthread_cond_init(&o->cond, NULL);
+		rf->outputs++;
+	}
+	
+	/* Size the blocks and queues */
+	rf->block_samples = (size_t) s->vid.width * TEE_BLOCK_LINES;
+	rf->depth = (int) ((int64_t) s->vid.sample_rate * TEE_QUEUE_MS / 1000 / rf->block_samples);
+	if(rf->depth < 2) rf->depth = 2;
+	
+	rf->nblocks = rf->outputs * (rf->depth + 1) + 1;
+	rf->blocks = calloc(rf->nblocks, sizeof(_tee_block_t));
+	rf->free = calloc(rf->nblocks, sizeof(_tee_block_t *));
+	rf->zeros = calloc(rf->block_samples * 2, sizeof(int16_t));
+	
+	if(!rf->blocks || !rf->free || !rf->zeros)
+	{
+		perror("calloc");
+		_rf_tee_close(rf);
+		return(HACKTV_ERROR);
+	}
+	
+	for(i = 0; i < rf->nblocks; i++)
+	{
+		rf->blocks[i].iq = malloc(sizeof(int16_t) * 2 * rf->block_samples);
+		if(!rf->blocks[i].iq)
+		{
+			perror("malloc");
+			_rf_tee_close(rf);
+			return(HACKTV_ERROR);
+		}
+		
+		rf->free[rf->nfree++] = &rf->blocks[i];
+	}
+	
+	rf->block = _tee_alloc(rf);
+	
+	if(s->tee_log)
+	{
+		rf->log = fopen(s->tee_log, "w");
+		if(!rf->log)
+		{
+			perror(s->tee_log);
+			_rf_tee_close(rf);
+			return(HACKTV_ERROR);
+		}
+		
+		fprintf(rf->log, "# output\tsample\tsamples\n");
+	}
+	
+	/* Start the output threads */
+	for(i = 0; i < rf->outputs; i++)
+	{
+		o = &rf->out[i];
+		
+		o->queue = calloc(rf->depth, sizeof(_tee_entry_t));
+		if(!o->queue)
+		{
+			perror("calloc");
+			_rf_tee_close(rf);
+			return(HACKTV_ERROR);
+		}
+		
+		if(pthread_create(&o->thread, NULL, &_tee_thread, o) != 0)
+		{
+			perror("pthread_create");
+			_rf_tee_close(rf);
+			return(HACKTV_ERROR);
+		}
+		
+		o->thread_running = 1;
+	}
+	
+	/* Register the callback functions */
+	s->rf_private = rf;
+	s->rf_write = _rf_tee_write;
+	s->rf_close = _rf_tee_close;
+	
+	return(HACKTV_OK);
+}
+
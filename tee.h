@@ -0,0 +1,31 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _TEE_H
+#define _TEE_H
+
+/* Maximum number of outputs fed by one tee */
+#define TEE_MAX_OUTPUTS 8
+
+/* Opens one output of the tee. Sets the RF sink interface of s. paced
+ * is set for the first output, which the generator runs in step with */
+typedef int (*rf_tee_open_t)(hacktv_t *s, char *target, int paced);
+
+extern int rf_tee_open(hacktv_t *s, char *targets, rf_tee_open_t open);
+
+#endif
+
@@ -610,7 +610,7 @@ static int _next_packet(tt_service_t *s, uint8_t line[45], unsigned int timecode
 	time_t timestamp;
 	
 	/* Update the timestamp */
-	timestamp = time(NULL);
+	timestamp = wall_time();
 	
 	/* If the timestamp has changed, we need to insert an 8/30 packet */
 	if(s->timestamp != timestamp)
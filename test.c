@@ -34,29 +34,64 @@ typedef struct {
 	int img_height;
 	image_t image;
 	av_font_t *font[10];
+	
+	/* Double buffered frames with the clock drawn over the
+	 * static test card in video. Only the area covered by the
+	 * clock is restored and redrawn when the second changes */
+	uint32_t *frame[2];
+	int rect[2][4];
+	int cur;
+	time_t secs;
 } av_test_t;
 
-static uint32_t *_av_test_read_video(void *private, float *ratio)
+static void _av_test_draw_clock(av_test_t *av, int b, time_t secs)
 {
-	/* Get current time */
 	char timestr[9];
-	time_t secs = time(0);
 	struct tm *local = localtime(&secs);
+	uint32_t *frame = av->frame[b];
+	int *r = av->rect[b];
+	int y;
+	
 	sprintf(timestr, "%02d:%02d:%02d", local->tm_hour, local->tm_min, local->tm_sec);
 	
+	/* Restore the test card under the previous clock in this buffer */
+	for(y = r[1]; y < r[3]; y++)
+	{
+		memcpy(&frame[y * av->vid_width + r[0]], &av->video[y * av->vid_width + r[0]], sizeof(uint32_t) * (r[2] - r[0]));
+	}
+	
+	print_generic_text(	av->font[0],
+						frame,
+						timestr,
+						av->font[0]->x_loc, av->font[0]->y_loc, 0, 1, 0, 1);
+	
+	get_generic_text_rect(av->font[0], timestr, av->font[0]->x_loc, av->font[0]->y_loc, 0, 1, &r[0], &r[1], &r[2], &r[3]);
+}
+
+static uint32_t *_av_test_read_video(void *private, float *ratio)
+{
 	av_test_t *av = private;
+	time_t secs;
 	
-	/* Print clock */
-	if(av->font[0])
+	if(ratio) *ratio = 4.0 / 3.0;
+	
+	if(!av->font[0])
 	{
-		print_generic_text(	av->font[0],
-							av->video,
-							timestr,
-							av->font[0]->x_loc, av->font[0]->y_loc, 0, 1, 0, 1);
+		/* No clock, the test card is static */
+		return(av->video);
 	}
-						
-	if(ratio) *ratio = 4.0 / 3.0;
-	return(av->video);
+	
+	/* Update the clock in the back buffer when the second changes */
+	secs = wall_time();
+	
+	if(secs != av->secs)
+	{
+		av->cur ^= 1;
+		_av_test_draw_clock(av, av->cur, secs);
+		av->secs = secs;
+	}
+	
+	return(av->frame[av->cur]);
 }
 
 static int16_t *_av_test_read_audio(void *private, size_t *samples)
@@ -70,6 +105,8 @@ static int _av_test_close(void *private)
 {
 	av_test_t *av = private;
 	if(av->video) free(av->video);
+	if(av->frame[0]) free(av->frame[0]);
+	if(av->frame[1]) free(av->frame[1]);
 	if(av->audio) free(av->audio);
 	free(av);
 	return(HACKTV_OK);
@@ -307,6 +344,22 @@ int av_test_open(vid_t *s, char *test_screen)
 		}
 	}
 	
+	/* Copy the finished test card into both frame buffers */
+	if(av->font[0])
+	{
+		for(x = 0; x < 2; x++)
+		{
+			av->frame[x] = malloc(vid_get_framebuffer_length(s));
+			if(!av->frame[x])
+			{
+				_av_test_close(av);
+				return(HACKTV_OUT_OF_MEMORY);
+			}
+			
+			memcpy(av->frame[x], av->video, vid_get_framebuffer_length(s));
+		}
+	}
+	
 	/* Generate the 1khz test tones (BBC 1 style) */
 	d = 1000.0 * 2 * M_PI / HACKTV_AUDIO_SAMPLE_RATE;
 	y = HACKTV_AUDIO_SAMPLE_RATE * 64 / 100; /* 640ms */
@@ -314,7 +367,7 @@ int av_test_open(vid_t *s, char *test_screen)
 	av->audio = malloc(av->audio_samples * 2 * sizeof(int16_t));
 	if(!av->audio)
 	{
-		free(av);
+		_av_test_close(av);
 		return(HACKTV_OUT_OF_MEMORY);
 	}
 	
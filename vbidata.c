@@ -18,6 +18,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "vbidata.h"
 
@@ -245,3 +246,38 @@ void vbidata_render_nrz(const int16_t *lut, const uint8_t *src, int offset, size
 	}
 }
 
+int vbidata_line_init(vbidata_line_t *s, int width)
+{
+	s->line = calloc(width, sizeof(int16_t));
+	s->width = width;
+	s->left = 0;
+	s->right = 0;
+	
+	return(s->line ? 0 : -1);
+}
+
+void vbidata_line_free(vbidata_line_t *s)
+{
+	free(s->line);
+	memset(s, 0, sizeof(vbidata_line_t));
+}
+
+void vbidata_line_render_nrz(vbidata_line_t *s, const int16_t *lut, const uint8_t *src, int offset, size_t length, int order)
+{
+	memset(s->line, 0, sizeof(int16_t) * s->width);
+	vbidata_render_nrz(lut, src, offset, length, order, s->line, 1);
+	
+	/* Find the part of the line that has been rendered */
+	for(s->left = 0; s->left < s->width && s->line[s->left] == 0; s->left++);
+	for(s->right = s->width; s->right > s->left && s->line[s->right - 1] == 0; s->right--);
+}
+
+void vbidata_line_add(const vbidata_line_t *s, int16_t *dst, size_t step)
+{
+	int x;
+	
+	for(x = s->left; x < s->right; x++)
+	{
+		dst[x * step] += s->line[x];
+	}
+}
@@ -18,6 +18,9 @@
 #ifndef _VBIDATA_H
 #define _VBIDATA_H
 
+#include <stdint.h>
+#include <stddef.h>
+
 #define VBIDATA_FILTER_RC (0)
 
 #define VBIDATA_LSB_FIRST (0)
@@ -27,5 +30,19 @@ extern int16_t *vbidata_init(unsigned int swidth, unsigned int dwidth, int level
 extern int16_t *vbidata_init_step(unsigned int swidth, unsigned int dwidth, int level, double rise);
 extern void     vbidata_render_nrz(const int16_t *lut, const uint8_t *src, int offset, size_t length, int order, int16_t *dst, size_t step);
 
+/* A rendered VBI line, kept so it can be added to the output again
+ * without repeating the render while its data does not change */
+typedef struct {
+	int16_t *line;
+	int width;
+	int left;
+	int right;
+} vbidata_line_t;
+
+extern int  vbidata_line_init(vbidata_line_t *s, int width);
+extern void vbidata_line_free(vbidata_line_t *s);
+extern void vbidata_line_render_nrz(vbidata_line_t *s, const int16_t *lut, const uint8_t *src, int offset, size_t length, int order);
+extern void vbidata_line_add(const vbidata_line_t *s, int16_t *dst, size_t step);
+
 #endif
 
@@ -18,10 +18,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <zlib.h>
 #include "video.h"
 #include "nicam728.h"
 #include "dance.h"
 #include "hacktv.h"
+#include "hugepage.h"
 #include <sys/time.h>
 
 /* 
@@ -46,6 +48,13 @@
 #define SECAM_CB_FREQ 4250000
 #define SECAM_CR_FREQ 4406260
 
+/* Output stage flags */
+#define _OUTSTAGE_AUDIO    (1 << 0)
+#define _OUTSTAGE_BLOCKMOD (1 << 1)
+#define _OUTSTAGE_FMMOD    (1 << 2)
+#define _OUTSTAGE_OFFSET   (1 << 3)
+#define _OUTSTAGE_PASSTHRU (1 << 4)
+
 const vid_config_t vid_config_pal_i = {
 	
 	/* System I (PAL) */
@@ -1899,6 +1908,26 @@ typedef struct {
 	fir_int16_t fir;
 } _vid_filter_process_t;
 
+/* Rendered line cache, one line for each line of the colour sequence */
+typedef struct {
+	int lines;
+	uint64_t *hash;
+	uint8_t *valid;
+	int16_t *output;
+} _vid_raster_cache_t;
+
+/* Raster state. The sequence code and active line of each line
+ * of the frame are looked up once, when the raster is set up */
+typedef struct {
+	const char **seq;
+	int *vy;
+	_vid_raster_cache_t *cache;
+} _vid_raster_t;
+
+/* The raster renderers are instantiated for each colour system from
+ * a single body, with the colour mode as a constant */
+#define _VID_RASTER_INLINE static inline __attribute__((always_inline))
+
 /* Test taps for a CCIR-405 625 line video pre-emphasis filter at 28 MHz (5.0 MHz video) */
 const static double fm_625_28_taps[] = {
 	-0.000044,-0.000123,-0.000013, 0.000314, 0.000430,-0.000132,-0.000988,
@@ -2192,7 +2221,7 @@ static int _init_fm_modulator(_mod_fm_t *fm, int sample_rate, double frequency,
 	fm->counter = INT16_MAX;
 	fm->phase.i = INT32_MAX;
 	fm->phase.q = 0;
-	fm->lut     = malloc(sizeof(cint32_t) * (UINT16_MAX + 1));
+	fm->lut     = huge_alloc(sizeof(cint32_t) * (UINT16_MAX + 1));
 	
 	if(!fm->lut)
 	{
@@ -2271,7 +2300,7 @@ static void inline _fm_modulator(_mod_fm_t *fm, int16_t *dst, int16_t sample)
 
 static void _free_fm_modulator(_mod_fm_t *fm)
 {
-	free(fm->lut);
+	huge_free(fm->lut);
 }
 
 /* AM modulator */
@@ -2328,6 +2357,16 @@ static uint32_t *_av_read_video(vid_t *s, float *ratio)
 	return(NULL);
 }
 
+static const vid_yiq_frame_t *_av_read_yiq(vid_t *s, float *ratio)
+{
+	if(s->av_read_yiq)
+	{
+		return(s->av_read_yiq(s->av_private, ratio));
+	}
+	
+	return(NULL);
+}
+
 static int16_t *_av_read_audio(vid_t *s, size_t *samples)
 {
 	if(s->av_read_audio)
@@ -2348,6 +2387,16 @@ static int _av_eof(vid_t *s)
 	return(0);
 }
 
+void vid_av_attach(vid_t *s, const vid_av_source_t *src)
+{
+	s->av_private = src->private;
+	s->av_read_video = src->read_video;
+	s->av_read_yiq = src->read_yiq;
+	s->av_read_audio = src->read_audio;
+	s->av_eof = src->eof;
+	s->av_close = src->close;
+}
+
 int vid_av_close(vid_t *s)
 {
 	int r;
@@ -2356,10 +2405,17 @@ int vid_av_close(vid_t *s)
 	
 	s->av_private = NULL;
 	s->av_read_video = NULL;
+	s->av_read_yiq = NULL;
 	s->av_read_audio = NULL;
 	s->av_eof = NULL;
 	s->av_close = NULL;
 	
+	/* Drop any pointers into the closed source's buffers */
+	s->framebuffer = NULL;
+	s->yiq_framebuffer = NULL;
+	s->audiobuffer = NULL;
+	s->audiobuffer_samples = 0;
+	
 	return(r);
 }
 
@@ -2385,23 +2441,202 @@ void _test_sample_rate(const vid_config_t *conf, unsigned int sample_rate)
 	fprintf(stderr, "Next valid pixel rates: %u, %u\n", m * r, m * (r + 1));
 }
 
-static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+_VID_RASTER_INLINE void _vid_raster_render(vid_t *s, vid_line_t *l, const char *seq, int vy, int pal, int fsc, const int colour_mode)
 {
-	const char *seq;
 	int x;
-	int vy;
 	int w;
-	int pal = 0;
-	int fsc = 0;
-	vid_line_t *l = lines[0];
 	
-	l->width    = s->width;
-	l->frame    = s->bframe;
-	l->line     = s->bline;
-	l->vbialloc = 0;
-	l->lut_b    = NULL;
-	l->lut_i    = NULL;
-	l->lut_q    = NULL;
+	/* Render the left side sync pulse */
+	if(seq[0] == 'v') w = s->vsync_short_width;
+	else if(seq[0] == 'V') w = s->vsync_long_width;
+	else if(seq[0] == 'h') w = s->hsync_width;
+	else w = 0;
+	
+	for(x = 0; x < w && x < s->half_width; x++)
+	{
+		l->output[x * 2] = s->sync_level;
+	}
+	
+	/* Render the active video if required */
+	if(seq[2] == 'a' || seq[3] == 'a')
+	{
+		uint32_t rgb;
+		uint32_t *prgb;
+		int16_t *o;
+		
+		/* Calculate active video portion of this line */
+		int al = (seq[2] == 'a' ? s->active_left : (seq[3] == 'a' ? s->half_width : -1));
+		int ar = (seq[3] == 'a' ? s->active_left + s->active_width : (seq[2] == 'a' ? s->half_width : -1));
+		
+		/* Blank the line up until the start of active video */
+		for(; x < al; x++)
+		{
+			l->output[x * 2] = s->blanking_level;
+		}
+		
+		/* Render the active video */
+		if(s->yiq_framebuffer != NULL && vy != -1)
+		{
+			/* The planes are already at signal level,
+			 * only the colour needs to be modulated */
+			int k = vy * s->active_width + al - s->active_left - x;
+			const int16_t *py = &s->yiq_framebuffer->y[k];
+			const int16_t *pi = &s->yiq_framebuffer->i[k];
+			const int16_t *pq = &s->yiq_framebuffer->q[k];
+			
+			if(pal)
+			{
+				for(o = &l->output[x * 2]; x < ar; x++, o += 2)
+				{
+					*o = py[x] + ((pi[x] * l->lut_i[x] + pq[x] * l->lut_q[x]) >> 15);
+				}
+			}
+			else
+			{
+				for(o = &l->output[x * 2]; x < ar; x++, o += 2)
+				{
+					*o = py[x];
+				}
+			}
+		}
+		
+		/* Anything left is looked up from the RGB framebuffer, or black */
+		prgb = (s->framebuffer != NULL && vy != -1 ? &s->framebuffer[vy * s->active_width + al - s->active_left] : NULL);
+		rgb = 0x000000;
+		
+		for(o = &l->output[x * 2]; x < ar; x++, o += 2)
+		{
+			if(prgb)
+			{
+				rgb = *(prgb++) & 0xFFFFFF;
+			}
+			
+			if(colour_mode == VID_APOLLO_FSC ||
+			   colour_mode == VID_CBS_FSC)
+			{
+				rgb  = (rgb >> (8 * fsc)) & 0xFF;
+				rgb |= (rgb << 8) | (rgb << 16);
+			}
+			
+			*o = s->yiq_level_lookup[rgb].y;
+			
+			if(pal)
+			{
+				*o += (s->yiq_level_lookup[rgb].i * l->lut_i[x] +
+				       s->yiq_level_lookup[rgb].q * l->lut_q[x]) >> 15;
+			}
+		}
+	}
+	
+	/* Render the middle sync pulse if required */
+	if(seq[3] == 'v') w = s->vsync_short_width;
+	else if(seq[3] == 'V') w = s->vsync_long_width;
+	else w = 0;
+	
+	if(w)
+	{
+		/* Blank the line up until the start of the pulse */
+		for(; x < s->half_width; x++)
+		{
+			l->output[x * 2] = s->blanking_level;
+		}
+		
+		/* Render the pulse */
+		for(; x < s->half_width + w && x < s->width; x++)
+		{
+			l->output[x * 2] = s->sync_level;
+		}
+	}
+	
+	/* Blank the remainder of the line */
+	for(; x < s->width; x++)
+	{
+		l->output[x * 2] = s->blanking_level;
+	}
+	
+	/* Render the colour burst */
+	if(pal)
+	{
+		for(x = s->burst_left; x < s->burst_left + s->burst_width; x++)
+		{
+			l->output[x * 2] += (l->lut_b[x] * s->burst_win[x - s->burst_left]) >> 15;
+		}
+	}
+}
+
+static uint64_t _vid_raster_hash(const uint32_t *rgb, int n)
+{
+	uint64_t h = 0xCBF29CE484222325ULL;
+	
+	/* FNV-1a over the pixels, ignoring the unused top byte */
+	for(; n; n--)
+	{
+		h ^= *(rgb++) & 0xFFFFFF;
+		h *= 0x100000001B3ULL;
+	}
+	
+	return(h);
+}
+
+static uint64_t _vid_raster_hash_yiq(const vid_yiq_frame_t *f, int o, int n)
+{
+	uint64_t h = 0xCBF29CE484222325ULL;
+	
+	for(n += o; o < n; o++)
+	{
+		h ^= (uint16_t) f->y[o] | (uint32_t) (uint16_t) f->i[o] << 16 | (uint64_t) (uint16_t) f->q[o] << 32;
+		h *= 0x100000001B3ULL;
+	}
+	
+	return(h);
+}
+
+static void _vid_raster_cache_free(vid_t *s, _vid_raster_cache_t *c)
+{
+	free(c->hash);
+	free(c->valid);
+	free(c->output);
+	free(c);
+}
+
+static _vid_raster_cache_t *_vid_raster_cache_alloc(vid_t *s)
+{
+	_vid_raster_cache_t *c;
+	int n;
+	
+	c = calloc(1, sizeof(_vid_raster_cache_t));
+	if(!c)
+	{
+		return(NULL);
+	}
+	
+	/* The cache covers two frames for the burst blanking
+	 * sequence, extended to the colour subcarrier sequence */
+	c->lines = s->conf.lines * 2;
+	
+	if(s->conf.colour_lookup_lines > 0)
+	{
+		n = gcd(c->lines, s->conf.colour_lookup_lines);
+		c->lines = c->lines / n * s->conf.colour_lookup_lines;
+	}
+	
+	c->hash = malloc(sizeof(uint64_t) * c->lines);
+	c->valid = calloc(c->lines, sizeof(uint8_t));
+	c->output = malloc(sizeof(int16_t) * c->lines * s->width);
+	
+	if(!c->hash || !c->valid || !c->output)
+	{
+		_vid_raster_cache_free(s, c);
+		return(NULL);
+	}
+	
+	return(c);
+}
+
+static const char *_vid_raster_seq(vid_t *s, int line, int *pvy)
+{
+	const char *seq;
+	int vy;
 	
 	/* Sequence codes: abcd
 	 * 
@@ -2435,7 +2670,7 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 	
 	if(s->conf.type == VID_RASTER_625)
 	{
-		switch(l->line)
+		switch(line)
 		{
 		case 1:   seq = "V__V"; break;
 		case 2:   seq = "V__V"; break;
@@ -2497,11 +2732,11 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 		}
 		
 		/* Calculate the active line number */
-		vy = (l->line < 313 ? (l->line - 23) * 2 : (l->line - 336) * 2 + 1);
+		vy = (line < 313 ? (line - 23) * 2 : (line - 336) * 2 + 1);
 	}
 	else if(s->conf.type == VID_RASTER_525)
 	{
-		switch(l->line)
+		switch(line)
 		{
 		case 1:   seq = "v__v"; break;
 		case 2:   seq = "v__v"; break;
@@ -2557,11 +2792,11 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 		 * Practice RP-202. Lines 23-262 from the first field and
 		 * 286-525 from the second. */
 		
-		vy = (l->line < 265 ? (l->line - 23) * 2 : (l->line - 286) * 2 + 1);
+		vy = (line < 265 ? (line - 23) * 2 : (line - 286) * 2 + 1);
 	}
 	else if(s->conf.type == VID_RASTER_819)
 	{
-		switch(l->line)
+		switch(line)
 		{
 		case 817: seq = "h___"; break;
 		case 818: seq = "h___"; break;
@@ -2652,11 +2887,11 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 		}
 		
 		/* Calculate the active line number */
-		vy = (l->line < 406 ? (l->line - 48) * 2 : (l->line - 457) * 2 + 1);
+		vy = (line < 406 ? (line - 48) * 2 : (line - 457) * 2 + 1);
 	}
 	else if(s->conf.type == VID_RASTER_405)
 	{
-		switch(l->line)
+		switch(line)
 		{
 		case 1:   seq = "V__V"; break;
 		case 2:   seq = "V__V"; break;
@@ -2695,11 +2930,11 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 		}
 		
 		/* Calculate the active line number */
-		vy = (l->line < 210 ? (l->line - 16) * 2 : (l->line - 219) * 2 + 1);
+		vy = (line < 210 ? (line - 16) * 2 : (line - 219) * 2 + 1);
 	}
 	else if(s->conf.type == VID_CBS_405)
 	{
-		switch(l->line)
+		switch(line)
 		{
 		case 1:   seq = "v__v"; break;
 		case 2:   seq = "v__v"; break;
@@ -2736,19 +2971,19 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 		}
 		
 		/* Calculate the active line number */
-		vy = (l->line < 210 ? (l->line - 16) * 2 : (l->line - 219) * 2 + 1);
+		vy = (line < 210 ? (line - 16) * 2 : (line - 219) * 2 + 1);
 	}
 	else if(s->conf.type == VID_APOLLO_320)
 	{
-		if(l->line <= 8) seq = "V__v";
+		if(line <= 8) seq = "V__v";
 		else seq = "h_aa";
 		
-		vy = l->line - 9;
+		vy = line - 9;
 		if(vy < 0 || vy >= s->conf.active_lines) vy = -1;
 	}
 	else if(s->conf.type == VID_BAIRD_240)
 	{
-		switch(l->line)
+		switch(line)
 		{
 		case 1:   seq = "V__V"; break;
 		case 2:   seq = "V__V"; break;
@@ -2775,29 +3010,114 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 		}
 		
 		/* Calculate the active line number */
-		vy = l->line - 20;
+		vy = line - 20;
 	}
 	else if(s->conf.type == VID_BAIRD_30)
 	{
 		/* The original Baird 30 line standard has no sync pulses */
 		seq = "__aa";
-		vy = l->line - 1;
+		vy = line - 1;
 	}
 	else if(s->conf.type == VID_NBTV_32)
 	{
-		switch(l->line)
+		switch(line)
 		{
 		case 1:  seq = "__aa"; break;
 		default: seq = "h_aa"; break;
 		}
 		
-		vy = l->line - 1;
+		vy = line - 1;
 	}
 	
 	if(vy < 0 || vy >= s->conf.active_lines) vy = -1;
 	
-	if(s->conf.colour_mode == VID_PAL ||
-	   s->conf.colour_mode == VID_NTSC)
+	*pvy = vy;
+	
+	return(seq);
+}
+
+static void _vid_raster_free(vid_t *s, void *arg)
+{
+	_vid_raster_t *r = arg;
+	
+	if(r->cache)
+	{
+		_vid_raster_cache_free(s, r->cache);
+	}
+	
+	free(r->seq);
+	free(r->vy);
+	free(r);
+}
+
+static _vid_raster_t *_vid_raster_alloc(vid_t *s)
+{
+	_vid_raster_t *r;
+	int line;
+	
+	r = calloc(1, sizeof(_vid_raster_t));
+	if(!r)
+	{
+		return(NULL);
+	}
+	
+	r->seq = malloc(sizeof(const char *) * (s->conf.lines + 1));
+	r->vy = malloc(sizeof(int) * (s->conf.lines + 1));
+	
+	if(!r->seq || !r->vy)
+	{
+		_vid_raster_free(s, r);
+		return(NULL);
+	}
+	
+	/* Lines are numbered from 1 */
+	r->seq[0] = "____";
+	r->vy[0] = -1;
+	
+	for(line = 1; line <= s->conf.lines; line++)
+	{
+		r->seq[line] = _vid_raster_seq(s, line, &r->vy[line]);
+	}
+	
+	/* Field sequential colour changes with every field,
+	 * there's nothing to gain from caching those lines */
+	if(s->conf.colour_mode != VID_APOLLO_FSC &&
+	   s->conf.colour_mode != VID_CBS_FSC)
+	{
+		r->cache = _vid_raster_cache_alloc(s);
+		if(!r->cache)
+		{
+			_vid_raster_free(s, r);
+			return(NULL);
+		}
+	}
+	
+	return(r);
+}
+
+_VID_RASTER_INLINE int _vid_raster_line(vid_t *s, _vid_raster_t *r, vid_line_t *l, const int colour_mode)
+{
+	_vid_raster_cache_t *c = r->cache;
+	const char *seq;
+	int x;
+	int vy;
+	int w;
+	int pal = 0;
+	int fsc = 0;
+	
+	l->width    = s->width;
+	l->frame    = s->bframe;
+	l->line     = s->bline;
+	l->vbialloc = 0;
+	l->lut_b    = NULL;
+	l->lut_i    = NULL;
+	l->lut_q    = NULL;
+	
+	seq = r->seq[l->line];
+	vy = r->vy[l->line];
+	
+	if(colour_mode == VID_PAL ||
+	   colour_mode == VID_NTSC)
 	{
 		/* Does this line use colour? */
 		pal  = seq[1] == '0';
@@ -2807,114 +3127,57 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 		/* Calculate colour sub-carrier lookup-positions for the start of this line */
 		_get_colour_subcarrier(s, l->frame, l->line, &l->lut_b, &l->lut_i, &l->lut_q);
 	}
-	if(s->conf.colour_mode == VID_APOLLO_FSC)
+	if(colour_mode == VID_APOLLO_FSC)
 	{
 		/* Apollo Field Sequential Colour */
 		fsc = (l->frame * 2 + (l->line < 264 ? 0 : 1)) % 3;
 		pal = 0;
 	}
-	else if(s->conf.colour_mode == VID_CBS_FSC)
+	else if(colour_mode == VID_CBS_FSC)
 	{
 		/* CBS Field Sequential Colour */
 		fsc = (l->frame * 2 + (l->line < 202 ? 0 : 1)) % 3;
 		pal = 0;
 	}
 	
-	/* Render the left side sync pulse */
-	if(seq[0] == 'v') w = s->vsync_short_width;
-	else if(seq[0] == 'V') w = s->vsync_long_width;
-	else if(seq[0] == 'h') w = s->hsync_width;
-	else w = 0;
-	
-	for(x = 0; x < w && x < s->half_width; x++)
-	{
-		l->output[x * 2] = s->sync_level;
-	}
-	
-	/* Render the active video if required */
-	if(seq[2] == 'a' || seq[3] == 'a')
+	if(c != NULL && (s->framebuffer != NULL || s->yiq_framebuffer != NULL) && vy != -1)
 	{
-		uint32_t rgb;
-		uint32_t *prgb;
-		int16_t *o;
-		
-		/* Calculate active video portion of this line */
-		int al = (seq[2] == 'a' ? s->active_left : (seq[3] == 'a' ? s->half_width : -1));
-		int ar = (seq[3] == 'a' ? s->active_left + s->active_width : (seq[2] == 'a' ? s->half_width : -1));
+		/* Reuse the previously rendered line if the source row
+		 * hasn't changed since this point in the colour sequence
+		 * was last rendered */
+		int pl = ((int64_t) l->frame * s->conf.lines + l->line - 1) % c->lines;
+		int16_t *o = &c->output[pl * s->width];
+		uint64_t h = s->yiq_framebuffer != NULL
+			? _vid_raster_hash_yiq(s->yiq_framebuffer, vy * s->active_width, s->active_width)
+			: _vid_raster_hash(&s->framebuffer[vy * s->active_width], s->active_width);
 		
-		/* Blank the line up until the start of active video */
-		for(; x < al; x++)
+		if(c->valid[pl] && c->hash[pl] == h)
 		{
-			l->output[x * 2] = s->blanking_level;
+			for(x = 0; x < s->width; x++)
+			{
+				l->output[x * 2] = o[x];
+			}
 		}
-		
-		/* Render the active video */
-		prgb = (s->framebuffer != NULL && vy != -1 ? &s->framebuffer[vy * s->active_width + al - s->active_left] : NULL);
-		rgb = 0x000000;
-		
-		for(o = &l->output[x * 2]; x < ar; x++, o += 2)
+		else
 		{
-			if(prgb)
-			{
-				rgb = *(prgb++) & 0xFFFFFF;
-			}
+			_vid_raster_render(s, l, seq, vy, pal, fsc, colour_mode);
 			
-			if(s->conf.colour_mode == VID_APOLLO_FSC ||
-			   s->conf.colour_mode == VID_CBS_FSC)
+			for(x = 0; x < s->width; x++)
 			{
-				rgb  = (rgb >> (8 * fsc)) & 0xFF;
-				rgb |= (rgb << 8) | (rgb << 16);
+				o[x] = l->output[x * 2];
 			}
 			
-			*o = s->yiq_level_lookup[rgb].y;
-			
-			if(pal)
-			{
-				*o += (s->yiq_level_lookup[rgb].i * l->lut_i[x] +
-				       s->yiq_level_lookup[rgb].q * l->lut_q[x]) >> 15;
-			}
+			c->hash[pl] = h;
+			c->valid[pl] = 1;
 		}
 	}
-	
-	/* Render the middle sync pulse if required */
-	if(seq[3] == 'v') w = s->vsync_short_width;
-	else if(seq[3] == 'V') w = s->vsync_long_width;
-	else w = 0;
-	
-	if(w)
-	{
-		/* Blank the line up until the start of the pulse */
-		for(; x < s->half_width; x++)
-		{
-			l->output[x * 2] = s->blanking_level;
-		}
-		
-		/* Render the pulse */
-		for(; x < s->half_width + w && x < s->width; x++)
-		{
-			l->output[x * 2] = s->sync_level;
-		}
-	}
-	
-	/* Blank the remainder of the line */
-	for(; x < s->width; x++)
+	else
 	{
-		l->output[x * 2] = s->blanking_level;
-	}
-	
-	/* Render the colour burst */
-	if(pal)
-	{
-		for(x = s->burst_left; x < s->burst_left + s->burst_width; x++)
-		{
-			/* Nasty hack for Videocrypt-S */
-			int y = s->conf.videocrypts ? x + 2 : x;
-			l->output[x * 2] += (l->lut_b[x] * s->burst_win[x - s->burst_left]) >> 15;
-		}
+		_vid_raster_render(s, l, seq, vy, pal, fsc, colour_mode);
 	}
 	
 	/* Render the FSC flag */
-	if(s->conf.colour_mode == VID_APOLLO_FSC && fsc == 1 &&
+	if(colour_mode == VID_APOLLO_FSC && fsc == 1 &&
 	  (l->line == 18 || l->line == 281))
 	{
 		/* The Apollo colour standard transmits one colour per field
@@ -2929,7 +3192,7 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 	}
 	
 	/* Render the CBS FSC flag */
-	if(s->conf.colour_mode == VID_CBS_FSC && fsc == 2 &&
+	if(colour_mode == VID_CBS_FSC && fsc == 2 &&
 	  (l->line == 1 || l->line == 203))
 	{
 		w = (l->line == 1 ? s->fsc_flag_left : s->half_width + s->fsc_flag_left);
@@ -2940,41 +3203,23 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 	}
 	
 	/* Render the SECAM colour subcarrier */
-	if(s->conf.colour_mode == VID_SECAM)
+	if(colour_mode == VID_SECAM)
 	{
 		const cint16_t *g;
 		int16_t dmin, dmax;
 		int sl = 0, sr = 0;
+		int parity = ((l->frame * s->conf.lines) + l->line) & 1;
 		
 		if(s->conf.secam_field_id &&
 		   ((l->line >= 7 && l->line <= 15) ||
 		    (l->line >= 320 && l->line <= 328)))
 		{
-			int16_t level;
-			int16_t dev;
-			double rw;
-			
-			if(((l->frame * s->conf.lines) + l->line) & 1)
-			{
-				level = s->yiq_level_lookup[0x000000].q;
-				dev = -s->secam_fsync_level;
-				rw = 18e-6;
-			}
-			else
-			{
-				level = s->yiq_level_lookup[0x000000].i;
-				dev = s->secam_fsync_level;
-				rw = 15e-6;
-			}
+			/* Copy the pre-calculated field identification ramp */
+			const int16_t *ramp = s->secam_fid_ramp[parity];
 			
 			for(x = 0; x < s->width; x++)
 			{
-				double t = (double) (x - s->active_left) / s->pixel_rate / rw;
-				
-				if(t < 0) t = 0;
-				else if(t > 1) t = 1;
-				
-				l->output[x * 2 + 1] = level + dev * t;
+				l->output[x * 2 + 1] = ramp[x];
 			}
 			
 			sl = s->burst_left;
@@ -2984,27 +3229,62 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 		}
 		else if(seq[2] == 'a' || seq[3] == 'a')
 		{
-			uint32_t rgb;
+			const _yiq16_t *lut = s->yiq_level_lookup;
+			const uint32_t *fb = NULL;
+			const int16_t *plane = NULL;
+			int16_t blank = parity ? lut[0x000000].q : lut[0x000000].i;
+			int ar = s->active_left + s->active_width;
 			
-			for(x = 0; x < s->width; x++)
+			if(ar > s->width) ar = s->width;
+			
+			if(s->framebuffer != NULL && vy >= 0)
 			{
-				rgb = 0x000000;
-				
-				if(x >= s->active_left && x < s->active_left + s->active_width)
+				fb = &s->framebuffer[vy * s->active_width];
+			}
+			else if(s->yiq_framebuffer != NULL && vy >= 0)
+			{
+				plane = (parity ? s->yiq_framebuffer->q : s->yiq_framebuffer->i) + vy * s->active_width;
+			}
+			
+			for(x = 0; x < s->active_left; x++)
+			{
+				l->output[x * 2 + 1] = blank;
+			}
+			
+			if(plane != NULL)
+			{
+				for(; x < ar; x++)
 				{
-					rgb = s->framebuffer != NULL && vy >= 0 ? s->framebuffer[vy * s->active_width + x - s->active_left] & 0xFFFFFF : 0x000000;
+					l->output[x * 2 + 1] = plane[x - s->active_left];
 				}
-				
-				if(((l->frame * s->conf.lines) + l->line) & 1)
+			}
+			else if(fb == NULL)
+			{
+				for(; x < ar; x++)
 				{
-					l->output[x * 2 + 1] = s->yiq_level_lookup[rgb].q;
+					l->output[x * 2 + 1] = blank;
 				}
-				else
+			}
+			else if(parity)
+			{
+				for(; x < ar; x++)
+				{
+					l->output[x * 2 + 1] = lut[fb[x - s->active_left] & 0xFFFFFF].q;
+				}
+			}
+			else
+			{
+				for(; x < ar; x++)
 				{
-					l->output[x * 2 + 1] = s->yiq_level_lookup[rgb].i;
+					l->output[x * 2 + 1] = lut[fb[x - s->active_left] & 0xFFFFFF].i;
 				}
 			}
 			
+			for(; x < s->width; x++)
+			{
+				l->output[x * 2 + 1] = blank;
+			}
+			
 			sl = s->burst_left;
 			sr = seq[3] == 'a' ? sl + s->burst_width : s->half_width;
 		}
@@ -3016,17 +3296,27 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 			iir_int16_process(&s->fm_secam_iir, l->output + 1, l->output + 1, s->width, 2);
 			
 			/* Limit the FM deviation */
-			dmin = s->fm_secam_dmin[((l->frame * s->conf.lines) + l->line) & 1];
-			dmax = s->fm_secam_dmax[((l->frame * s->conf.lines) + l->line) & 1];
+			dmin = s->fm_secam_dmin[parity];
+			dmax = s->fm_secam_dmax[parity];
 			
 			for(x = sl; x < sr; x++)
 			{
-				if(l->output[x * 2 + 1] < dmin) l->output[x * 2 + 1] = dmin;
-				else if(l->output[x * 2 + 1] > dmax) l->output[x * 2 + 1] = dmax;
-				
+				int16_t v = l->output[x * 2 + 1];
+				l->output[x * 2 + 1] = v < dmin ? dmin : (v > dmax ? dmax : v);
+			}
+			
+			/* Modulate the subcarrier through the bell filter. The
+			 * phase recursion is serial, so this is kept apart from
+			 * the clamp and mix loops which the compiler can vectorise */
+			for(x = sl; x < sr; x++)
+			{
 				g = &s->fm_secam_bell[(uint16_t) l->output[x * 2 + 1]];
 				_fm_modulator_cgain(&s->fm_secam, &l->output[x * 2 + 1], l->output[x * 2 + 1], g);
-				
+			}
+			
+			/* Apply the envelope and mix with the luminance */
+			for(x = sl; x < sr; x++)
+			{
 				l->output[x * 2] += (l->output[x * 2 + 1] * s->burst_win[x - s->burst_left]) >> 15;
 			}
 		}
@@ -3041,6 +3331,33 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 	return(1);
 }
 
+#define _VID_RASTER(name, mode) \
+static int name(vid_t *s, void *arg, int nlines, vid_line_t **lines) \
+{ \
+	return(_vid_raster_line(s, arg, lines[0], mode)); \
+}
+
+_VID_RASTER(_vid_next_line_raster_mono,   VID_MONOCHROME)
+_VID_RASTER(_vid_next_line_raster_pal,    VID_PAL)
+_VID_RASTER(_vid_next_line_raster_secam,  VID_SECAM)
+_VID_RASTER(_vid_next_line_raster_apollo, VID_APOLLO_FSC)
+_VID_RASTER(_vid_next_line_raster_cbs,    VID_CBS_FSC)
+
+static vid_lineprocess_process_t _vid_raster_process(int colour_mode)
+{
+	switch(colour_mode)
+	{
+	/* NTSC only differs from PAL in its subcarrier tables */
+	case VID_PAL:
+	case VID_NTSC:       return(_vid_next_line_raster_pal);
+	case VID_SECAM:      return(_vid_next_line_raster_secam);
+	case VID_APOLLO_FSC: return(_vid_next_line_raster_apollo);
+	case VID_CBS_FSC:    return(_vid_next_line_raster_cbs);
+	}
+	
+	return(_vid_next_line_raster_mono);
+}
+
 static int _vid_filter_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 {
 	_vid_filter_process_t *p = arg;
@@ -3060,235 +3377,251 @@ static void _vid_filter_free(vid_t *s, void *arg)
 	free(p);
 }
 
-static int _vid_audio_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+static void inline _vid_audio_sample(vid_t *s, int16_t add[2])
 {
-	vid_line_t *l = lines[0];
 	int16_t audio[2] = { 0, 0 };
-	int x;
 	
-	for(x = 0; x < l->width; x++)
+	/* TODO: Replace this with a real FIR filter... */
+	s->interp += HACKTV_AUDIO_SAMPLE_RATE;
+	if(s->interp >= s->sample_rate)
 	{
-		int16_t add[2] = { 0, 0 };
+		s->interp -= s->sample_rate;
 		
-		/* TODO: Replace this with a real FIR filter... */
-		s->interp += HACKTV_AUDIO_SAMPLE_RATE;
-		if(s->interp >= s->sample_rate)
+		if(s->audiobuffer_samples == 0)
 		{
-			s->interp -= s->sample_rate;
+			s->audiobuffer = _av_read_audio(s, &s->audiobuffer_samples);
 			
-			if(s->audiobuffer_samples == 0)
+			if(s->conf.systeraudio == 1)
 			{
-				s->audiobuffer = _av_read_audio(s, &s->audiobuffer_samples);
-				
-				if(s->conf.systeraudio == 1)
-				{
-					ng_invert_audio(&s->ng, s->audiobuffer, s->audiobuffer_samples);
-				}
+				ng_invert_audio(&s->ng, s->audiobuffer, s->audiobuffer_samples);
 			}
-			
-			if(s->audiobuffer)
-			{
-				/* Fetch next sample */
-				audio[0] = s->audiobuffer[0];
-				audio[1] = s->audiobuffer[1];
-				s->audiobuffer += 2;
-				s->audiobuffer_samples--;
-			}
-			else
+		}
+		
+		if(s->audiobuffer)
+		{
+			/* Fetch next sample */
+			audio[0] = s->audiobuffer[0];
+			audio[1] = s->audiobuffer[1];
+			s->audiobuffer += 2;
+			s->audiobuffer_samples--;
+		}
+		else
+		{
+			/* No audio from the source */
+			audio[0] = 0;
+			audio[1] = 0;
+		}
+		
+		if(s->conf.am_audio_level > 0 && s->conf.am_mono_carrier != 0)
+		{
+			s->am_mono.sample = (audio[0] + audio[1]) / 2;
+		}
+		
+		if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0)
+		{
+			s->fm_mono.sample = (audio[0] + audio[1]) / 2;
+			if(s->fm_mono.limiter.width)
 			{
-				/* No audio from the source */
-				audio[0] = 0;
-				audio[1] = 0;
+				limiter_process(&s->fm_mono.limiter, &s->fm_mono.sample, &s->fm_mono.sample, &s->fm_mono.sample, 1, 1);
 			}
 			
-			if(s->conf.am_audio_level > 0 && s->conf.am_mono_carrier != 0)
+			/* Reduce volume of audio in A2 Stereo mode to
+			 * leave room for the pilot/mode signal */
+			if(s->conf.a2stereo) s->fm_mono.sample *= 0.95;
+		}
+		
+		if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0)
+		{
+			s->fm_left.sample = audio[0];
+			if(s->fm_left.limiter.width)
 			{
-				s->am_mono.sample = (audio[0] + audio[1]) / 2;
+				limiter_process(&s->fm_left.limiter, &s->fm_left.sample, &s->fm_left.sample, &s->fm_left.sample, 1, 1);
 			}
-			
-			if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0)
+		}
+		
+		if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0)
+		{
+			s->fm_right.sample = audio[1];
+			if(s->fm_right.limiter.width)
 			{
-				s->fm_mono.sample = (audio[0] + audio[1]) / 2;
-				if(s->fm_mono.limiter.width)
-				{
-					limiter_process(&s->fm_mono.limiter, &s->fm_mono.sample, &s->fm_mono.sample, &s->fm_mono.sample, 1, 1);
-				}
-				
-				/* Reduce volume of audio in A2 Stereo mode to
-				 * leave room for the pilot/mode signal */
-				if(s->conf.a2stereo) s->fm_mono.sample *= 0.95;
+				limiter_process(&s->fm_right.limiter, &s->fm_right.sample, &s->fm_right.sample, &s->fm_right.sample, 1, 1);
 			}
 			
-			if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0)
-			{
-				s->fm_left.sample = audio[0];
-				if(s->fm_left.limiter.width)
-				{
-					limiter_process(&s->fm_left.limiter, &s->fm_left.sample, &s->fm_left.sample, &s->fm_left.sample, 1, 1);
-				}
-			}
+			/* Reduce volume of audio in A2 Stereo mode to
+			 * leave room for the pilot/mode signal */
+			if(s->conf.a2stereo) s->fm_right.sample *= 0.95;
+		}
+		
+		if((s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0) ||
+		   s->conf.type == VID_MAC)
+		{
+			s->nicam_buf[s->nicam_buf_len++] = audio[0];
+			s->nicam_buf[s->nicam_buf_len++] = audio[1];
 			
-			if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0)
+			if(s->nicam_buf_len == NICAM_AUDIO_LEN * 2)
 			{
-				s->fm_right.sample = audio[1];
-				if(s->fm_right.limiter.width)
+				if(s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0)
 				{
-					limiter_process(&s->fm_right.limiter, &s->fm_right.sample, &s->fm_right.sample, &s->fm_right.sample, 1, 1);
+					nicam_mod_input(&s->nicam, s->nicam_buf);
 				}
 				
-				/* Reduce volume of audio in A2 Stereo mode to
-				 * leave room for the pilot/mode signal */
-				if(s->conf.a2stereo) s->fm_right.sample *= 0.95;
-			}
-			
-			if((s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0) ||
-			   s->conf.type == VID_MAC)
-			{
-				s->nicam_buf[s->nicam_buf_len++] = audio[0];
-				s->nicam_buf[s->nicam_buf_len++] = audio[1];
-				
-				if(s->nicam_buf_len == NICAM_AUDIO_LEN * 2)
+				if(s->conf.type == VID_MAC)
 				{
-					if(s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0)
-					{
-						nicam_mod_input(&s->nicam, s->nicam_buf);
-					}
-					
-					if(s->conf.type == VID_MAC)
-					{
-						mac_write_audio(s, &s->mac.audio, 0, s->nicam_buf, NICAM_AUDIO_LEN * 2);
-					}
-					
-					s->nicam_buf_len = 0;
+					mac_write_audio(s, &s->mac.audio, 0, s->nicam_buf, NICAM_AUDIO_LEN * 2);
 				}
-			}
-			
-			if(s->conf.dance_level > 0 && s->conf.dance_carrier != 0)
-			{
-				s->dance_buf[s->dance_buf_len++] = audio[0];
-				s->dance_buf[s->dance_buf_len++] = audio[1];
 				
-				if(s->dance_buf_len == DANCE_A_AUDIO_LEN * 2)
-				{
-					dance_mod_input(&s->dance, s->dance_buf);
-					s->dance_buf_len = 0;
-				}
+				s->nicam_buf_len = 0;
 			}
 		}
 		
-		if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0)
-		{
-			_fm_modulator_add(&s->fm_mono, add, s->fm_mono.sample);
-		}
-		
-		if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0)
+		if(s->conf.dance_level > 0 && s->conf.dance_carrier != 0)
 		{
-			_fm_modulator_add(&s->fm_left, add, s->fm_left.sample);
-		}
-		
-		if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0)
-		{
-			int16_t a2 = 0;
+			s->dance_buf[s->dance_buf_len++] = audio[0];
+			s->dance_buf[s->dance_buf_len++] = audio[1];
 			
-			if(s->conf.a2stereo)
+			if(s->dance_buf_len == DANCE_A_AUDIO_LEN * 2)
 			{
-				int16_t s1[2] = { 0, 0 };
-				int16_t s2[2] = { 0, 0 };
-				
-				_am_modulator_add(&s->a2stereo_signal, s1, 0);
-				_am_modulator_add(&s->a2stereo_pilot, s2, s1[0]);
-				a2 = s2[0];
+				dance_mod_input(&s->dance, s->dance_buf);
+				s->dance_buf_len = 0;
 			}
-			
-			_fm_modulator_add(&s->fm_right, add, s->fm_right.sample + a2);
-		}
-		
-		if(s->conf.am_audio_level > 0 && s->conf.am_mono_carrier != 0)
-		{
-			_am_modulator_add(&s->am_mono, add, s->am_mono.sample);
 		}
-		
-		l->output[x * 2 + 0] += add[0];
-		l->output[x * 2 + 1] += add[1];
 	}
 	
-	if(s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0)
+	if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0)
 	{
-		nicam_mod_output(&s->nicam, l->output, l->width);
+		_fm_modulator_add(&s->fm_mono, add, s->fm_mono.sample);
 	}
 	
-	if(s->conf.dance_level > 0 && s->conf.dance_carrier != 0)
+	if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0)
 	{
-		dance_mod_output(&s->dance, l->output, l->width);
+		_fm_modulator_add(&s->fm_left, add, s->fm_left.sample);
 	}
 	
-	return(1);
-}
-
-static int _vid_fmmod_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
-{
-	vid_line_t *l = lines[0];
-	int x;
-	
-	/* FM modulate the video and audio if requested */
-	for(x = 0; x < l->width; x++)
+	if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0)
 	{
-		_fm_modulator(&s->fm_video, &l->output[x * 2], l->output[x * 2]);
+		int16_t a2 = 0;
+		
+		if(s->conf.a2stereo)
+		{
+			int16_t s1[2] = { 0, 0 };
+			int16_t s2[2] = { 0, 0 };
+			
+			_am_modulator_add(&s->a2stereo_signal, s1, 0);
+			_am_modulator_add(&s->a2stereo_pilot, s2, s1[0]);
+			a2 = s2[0];
+		}
+		
+		_fm_modulator_add(&s->fm_right, add, s->fm_right.sample + a2);
 	}
 	
-	return(1);
+	if(s->conf.am_audio_level > 0 && s->conf.am_mono_carrier != 0)
+	{
+		_am_modulator_add(&s->am_mono, add, s->am_mono.sample);
+	}
 }
 
-static int _vid_offset_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+static void inline _vid_offset_sample(vid_t *s, int16_t *iq)
 {
-	vid_line_t *l = lines[0];
-	int x;
+	cint16_t a, b;
 	
-	for(x = 0; x < l->width; x++)
+	cint32_mul(&s->offset.phase, &s->offset.phase, &s->offset.delta);
+	
+	a.i = iq[0];
+	a.q = iq[1];
+	b.i = s->offset.phase.i >> 16;
+	b.q = s->offset.phase.q >> 16;
+	cint16_mul(&a, &a, &b);
+	
+	iq[0] = a.i;
+	iq[1] = a.q;
+	
+	/* Correct the amplitude after INT16_MAX samples */
+	if(--s->offset.counter == 0)
 	{
-		cint16_t a, b;
+		double ra = atan2(s->offset.phase.q, s->offset.phase.i);
 		
-		cint32_mul(&s->offset.phase, &s->offset.phase, &s->offset.delta);
+		s->offset.phase.i = lround(cos(ra) * INT32_MAX);
+		s->offset.phase.q = lround(sin(ra) * INT32_MAX);
 		
-		a.i = l->output[x * 2 + 0];
-		a.q = l->output[x * 2 + 1];
-		b.i = s->offset.phase.i >> 16;
-		b.q = s->offset.phase.q >> 16;
-		cint16_mul(&a, &a, &b);
-		
-		l->output[x * 2 + 0] = a.i;
-		l->output[x * 2 + 1] = a.q;
-		
-		/* Correct the amplitude after INT16_MAX samples */
-		if(--s->offset.counter == 0)
-		{
-			double ra = atan2(s->offset.phase.q, s->offset.phase.i);
-			
-			s->offset.phase.i = lround(cos(ra) * INT32_MAX);
-			s->offset.phase.q = lround(sin(ra) * INT32_MAX);
-			
-			s->offset.counter = INT16_MAX;
-		}
+		s->offset.counter = INT16_MAX;
 	}
-	
-	return(1);
 }
 
-static int _vid_passthru_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+static int _vid_outstage_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 {
 	vid_line_t *l = lines[0];
+	int f = s->outstage;
 	int x;
 	
-	if(feof(s->passthru))
+	if(f & _OUTSTAGE_PASSTHRU)
 	{
-		return(1);
+		if(feof(s->passthru))
+		{
+			f &= ~_OUTSTAGE_PASSTHRU;
+		}
+		else
+		{
+			fread(s->passline, sizeof(int16_t) * 2, l->width, s->passthru);
+		}
 	}
 	
-	fread(s->passline, sizeof(int16_t) * 2, l->width, s->passthru);
+	if(f & _OUTSTAGE_BLOCKMOD)
+	{
+		/* NICAM and DANCE are modulated a line at a time and need
+		 * the audio for the whole line first, so the audio carriers
+		 * get a pass of their own ahead of the rest */
+		for(x = 0; x < l->width; x++)
+		{
+			int16_t add[2] = { 0, 0 };
+			
+			_vid_audio_sample(s, add);
+			
+			l->output[x * 2 + 0] += add[0];
+			l->output[x * 2 + 1] += add[1];
+		}
+		
+		if(s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0)
+		{
+			nicam_mod_output(&s->nicam, l->output, l->width);
+		}
+		
+		if(s->conf.dance_level > 0 && s->conf.dance_carrier != 0)
+		{
+			dance_mod_output(&s->dance, l->output, l->width);
+		}
+	}
 	
-	for(x = 0; x < l->width * 2; x++)
+	/* The stage flags are constant for the line, the compiler
+	 * unswitches this loop into one variant per configuration */
+	for(x = 0; x < l->width; x++)
 	{
-		l->output[x] += s->passline[x];
+		int16_t *iq = &l->output[x * 2];
+		
+		if(f & _OUTSTAGE_AUDIO)
+		{
+			int16_t add[2] = { 0, 0 };
+			
+			_vid_audio_sample(s, add);
+			
+			iq[0] += add[0];
+			iq[1] += add[1];
+		}
+		
+		if(f & _OUTSTAGE_FMMOD)
+		{
+			_fm_modulator(&s->fm_video, iq, iq[0]);
+		}
+		
+		if(f & _OUTSTAGE_OFFSET)
+		{
+			_vid_offset_sample(s, iq);
+		}
+		
+		if(f & _OUTSTAGE_PASSTHRU)
+		{
+			iq[0] += s->passline[x * 2 + 0];
+			iq[1] += s->passline[x * 2 + 1];
+		}
 	}
 	
 	return(1);
@@ -3483,12 +3816,12 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	double level, slevel;
 	vid_line_t *l;
 	
-	/* Seed the system's PRNG, used by some of the video scramblers */
-	srand(time(NULL));
-	
 	memset(s, 0, sizeof(vid_t));
 	memcpy(&s->conf, conf, sizeof(vid_config_t));
 	
+	/* Seed the PRNG used by some of the video scramblers */
+	s->rand_seed = (unsigned int) wall_time();
+	
 	s->sample_rate = sample_rate;
 	s->pixel_rate = pixel_rate ? pixel_rate : sample_rate;
 	
@@ -3537,7 +3870,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	s->sync_level     = round(s->conf.sync_level     * level * INT16_MAX);
 	
 	/* Allocate memory for YUV lookup tables */
-	s->yiq_level_lookup = malloc(0x1000000 * sizeof(_yiq16_t));
+	s->yiq_level_lookup = huge_alloc(0x1000000 * sizeof(_yiq16_t));
 	if(s->yiq_level_lookup == NULL)
 	{
 		vid_free(s);
@@ -3597,6 +3930,35 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		s->yiq_level_lookup[c].q = round(_dlimit(q, -1, 1) * INT16_MAX);
 	}
 	
+	/* Generate the full range YCbCr > signal level lookup tables. With
+	 * a gamma of 1.0 these give the same levels as the RGB tables */
+	for(c = 0; c < 0x100; c++)
+	{
+		double y, u, v;
+		double g = (s->conf.white_level - s->conf.black_level) * level;
+		
+		y = (double) c / 255;
+		u = (c - 128.0) / 255 * 2 * (1.0 - s->conf.bw_co);
+		v = (c - 128.0) / 255 * 2 * (1.0 - s->conf.rw_co);
+		
+		s->yuv_level_lookup[0][c] = round(_dlimit(s->conf.black_level * level + y * g, -1, 1) * INT16_MAX);
+		
+		if(s->conf.colour_mode != VID_SECAM)
+		{
+			s->yuv_level_lookup[1][c] = round(s->conf.iu_co * u * g * INT16_MAX);
+			s->yuv_level_lookup[2][c] = round(s->conf.iv_co * v * g * INT16_MAX);
+			s->yuv_level_lookup[3][c] = round(s->conf.qu_co * u * g * INT16_MAX);
+			s->yuv_level_lookup[4][c] = round(s->conf.qv_co * v * g * INT16_MAX);
+		}
+		else
+		{
+			s->yuv_level_lookup[1][c] = round((s->conf.iu_co * u + SECAM_CR_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV * INT16_MAX);
+			s->yuv_level_lookup[2][c] = round(s->conf.iv_co * v / SECAM_FM_DEV * INT16_MAX);
+			s->yuv_level_lookup[3][c] = round((s->conf.qu_co * u + SECAM_CB_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV * INT16_MAX);
+			s->yuv_level_lookup[4][c] = round(s->conf.qv_co * v / SECAM_FM_DEV * INT16_MAX);
+		}
+	}
+	
 	if(s->conf.colour_lookup_lines > 0)
 	{
 		/* Generate the colour subcarrier lookup table */
@@ -3604,7 +3966,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		s->colour_lookup_width = s->width * s->conf.colour_lookup_lines;
 		d = 2.0 * M_PI * s->conf.colour_carrier / s->pixel_rate;
 		
-		s->colour_lookup = malloc((s->colour_lookup_width + s->width) * sizeof(int16_t));
+		s->colour_lookup = huge_alloc((s->colour_lookup_width + s->width) * sizeof(int16_t));
 		if(!s->colour_lookup)
 		{
 			vid_free(s);
@@ -3676,7 +4038,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		s->fm_secam_dmin[1] = lround((SECAM_CR_FREQ - SECAM_FM_FREQ - 506e3) / SECAM_FM_DEV * INT16_MAX);
 		s->fm_secam_dmax[1] = lround((SECAM_CR_FREQ - SECAM_FM_FREQ + 350e3) / SECAM_FM_DEV * INT16_MAX);
 		
-		s->fm_secam_bell = malloc(sizeof(cint16_t) * UINT16_MAX);
+		s->fm_secam_bell = huge_alloc(sizeof(cint16_t) * (UINT16_MAX + 1));
 		if(!s->fm_secam_bell)
 		{
 			vid_free(s);
@@ -3694,6 +4056,35 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		/* Field sync levels (optional) */
 		s->secam_fsync_level = round(350e3 / SECAM_FM_DEV * INT16_MAX);
 		
+		if(s->conf.secam_field_id)
+		{
+			/* Pre-calculate the field identification ramps. Index 0 is
+			 * used on even lines (Db), index 1 on odd lines (Dr) */
+			for(r = 0; r < 2; r++)
+			{
+				int16_t flevel = r ? s->yiq_level_lookup[0x000000].q : s->yiq_level_lookup[0x000000].i;
+				int16_t fdev = r ? -s->secam_fsync_level : s->secam_fsync_level;
+				double rw = r ? 18e-6 : 15e-6;
+				
+				s->secam_fid_ramp[r] = malloc(sizeof(int16_t) * s->width);
+				if(!s->secam_fid_ramp[r])
+				{
+					vid_free(s);
+					return(VID_OUT_OF_MEMORY);
+				}
+				
+				for(x = 0; x < s->width; x++)
+				{
+					double t = (double) (x - s->active_left) / s->pixel_rate / rw;
+					
+					if(t < 0) t = 0;
+					else if(t > 1) t = 1;
+					
+					s->secam_fid_ramp[r][x] = flevel + fdev * t;
+				}
+			}
+		}
+		
 		/* Generate the colour subcarrier envelope */
 		s->burst_left  = round(s->pixel_rate * (s->conf.burst_left - s->conf.burst_rise / 2));
 		s->burst_win   = _burstwin(
@@ -3716,6 +4107,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	s->bframe = 1;
 	
 	s->framebuffer = NULL;
+	s->yiq_framebuffer = NULL;
 	s->olines = 1;
 	s->audio = 0;
 	
@@ -3733,7 +4125,16 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	}
 	else
 	{
-		_add_lineprocess(s, "raster", 1, NULL, _vid_next_line_raster, NULL);
+		_vid_raster_t *raster = _vid_raster_alloc(s);
+		
+		if(!raster)
+		{
+			vid_free(s);
+			return(VID_OUT_OF_MEMORY);
+		}
+		
+		/* The renderer is chosen for the colour system once here */
+		_add_lineprocess(s, "raster", 1, raster, _vid_raster_process(s->conf.colour_mode), _vid_raster_free);
 	}
 	
 	/* Initialise VITS inserter */
@@ -4052,10 +4453,18 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		s->audio = 1;
 	}
 	
-	/* Add the audio process */
+	/* Audio carriers for the output stage */
 	if(s->audio == 1)
 	{
-		_add_lineprocess(s, "audio", 1, NULL, _vid_audio_process, NULL);
+		if((s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0) ||
+		   (s->conf.dance_level > 0 && s->conf.dance_carrier != 0))
+		{
+			s->outstage |= _OUTSTAGE_BLOCKMOD;
+		}
+		else
+		{
+			s->outstage |= _OUTSTAGE_AUDIO;
+		}
 	}
 	
 	/* FM video */
@@ -4068,7 +4477,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 			return(r);
 		}
 		
-		_add_lineprocess(s, "fmmod", 1, NULL, _vid_fmmod_process, NULL);
+		s->outstage |= _OUTSTAGE_FMMOD;
 	}
 	
 	if(s->conf.offset != 0)
@@ -4083,7 +4492,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		s->offset.delta.i = lround(cos(d) * INT32_MAX);
 		s->offset.delta.q = lround(sin(d) * INT32_MAX);
 		
-		_add_lineprocess(s, "offset", 1, NULL, _vid_offset_process, NULL);
+		s->outstage |= _OUTSTAGE_OFFSET;
 	}
 	
 	if(s->conf.passthru)
@@ -4113,14 +4522,21 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 			return(VID_OUT_OF_MEMORY);
 		}
 		
-		_add_lineprocess(s, "passthru", 1, NULL, _vid_passthru_process, NULL);
+		s->outstage |= _OUTSTAGE_PASSTHRU;
+	}
+	
+	/* Audio, FM, offset and passthru share a single pass over the line */
+	if(s->outstage)
+	{
+		_add_lineprocess(s, "outstage", 1, NULL, _vid_outstage_process, NULL);
 	}
 	
 	/* The final process is only for output */
 	_add_lineprocess(s, "output", 1, NULL, NULL, NULL);
 	s->output_process = &s->processes[s->nprocesses - 1];
 	
-	/* Output line buffer(s) */
+	/* Output line buffer(s). The ring is allocated as one block,
+	 * with each line starting on a cache line */
 	s->oline = calloc(sizeof(vid_line_t), s->olines);
 	if(!s->oline)
 	{
@@ -4128,14 +4544,17 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		return(VID_OUT_OF_MEMORY);
 	}
 	
+	s->oline_stride = (2 * s->max_width + 31) & ~31;
+	s->oline[0].output = huge_alloc(sizeof(int16_t) * s->oline_stride * s->olines);
+	if(!s->oline[0].output)
+	{
+		vid_free(s);
+		return(VID_OUT_OF_MEMORY);
+	}
+	
 	for(r = 0; r < s->olines; r++)
 	{
-		s->oline[r].output = malloc(sizeof(int16_t) * 2 * s->max_width);
-		if(!s->oline[r].output)
-		{
-			vid_free(s);
-			return(VID_OUT_OF_MEMORY);
-		}
+		s->oline[r].output = s->oline[0].output + r * s->oline_stride;
 		
 		/* Blank the lines */
 		for(x = 0; x < s->width; x++)
@@ -4238,11 +4657,14 @@ void vid_free(vid_t *s)
 	}
 	
 	/* Free allocated memory */
-	free(s->yiq_level_lookup);
-	free(s->colour_lookup);
+	huge_free(s->yiq_level_lookup);
+	huge_free(s->colour_lookup);
 	fir_int16_free(&s->secam_l_fir);
 	fir_int16_free(&s->fm_secam_fir);
 	iir_int16_free(&s->fm_secam_iir);
+	huge_free(s->fm_secam_bell);
+	free(s->secam_fid_ramp[0]);
+	free(s->secam_fid_ramp[1]);
 	_free_fm_modulator(&s->fm_secam);
 	_free_fm_modulator(&s->fm_video);
 	_free_fm_modulator(&s->fm_mono);
@@ -4259,10 +4681,7 @@ void vid_free(vid_t *s)
 	
 	if(s->oline)
 	{
-		for(i = 0; i < s->olines; i++)
-		{
-			free(s->oline[i].output);
-		}
+		huge_free(s->oline[0].output);
 		free(s->oline);
 	}
 	
@@ -4271,8 +4690,28 @@ void vid_free(vid_t *s)
 	memset(s, 0, sizeof(vid_t));
 }
 
+static size_t _vid_info_table(size_t pages[3], const void *ptr, size_t size)
+{
+	size_t page;
+	int type;
+	
+	if(ptr == NULL) return(0);
+	
+	/* Count the pages, and so the TLB entries, needed to cover the table */
+	type = huge_type(ptr);
+	page = type == HUGE_NONE ? SMALL_PAGE_SIZE : HUGE_PAGE_SIZE;
+	pages[type] += (size + page - 1) / page;
+	
+	return(size);
+}
+
 void vid_info(vid_t *s)
 {
+	const _mod_fm_t *fm[] = { &s->fm_video, &s->fm_secam, &s->fm_mono, &s->fm_left, &s->fm_right };
+	size_t pages[3] = { 0, 0, 0 };
+	size_t yiq, colour, fml, lines;
+	int i;
+	
 	fprintf(stderr, "Video: %dx%d %.2f fps (full frame %dx%d)\n",
 		s->active_width, s->conf.active_lines,
 		(double) s->conf.frame_rate_num / s->conf.frame_rate_den,
@@ -4285,6 +4724,26 @@ void vid_info(vid_t *s)
 	}
 	
 	fprintf(stderr, "Sample rate: %d\n", s->sample_rate);
+	
+	/* Sizes and backing of the tables read every line */
+	yiq = _vid_info_table(pages, s->yiq_level_lookup, 0x1000000 * sizeof(_yiq16_t));
+	colour = _vid_info_table(pages, s->colour_lookup, (s->colour_lookup_width + s->width) * sizeof(int16_t));
+	lines = _vid_info_table(pages, s->oline[0].output, sizeof(int16_t) * s->oline_stride * s->olines);
+	fml = _vid_info_table(pages, s->fm_secam_bell, sizeof(cint16_t) * (UINT16_MAX + 1));
+	
+	for(i = 0; i < sizeof(fm) / sizeof(fm[0]); i++)
+	{
+		fml += _vid_info_table(pages, fm[i]->lut, sizeof(cint32_t) * (UINT16_MAX + 1));
+	}
+	
+	fprintf(stderr, "Tables: YIQ %.1f MB, colour %.1f MB, FM %.1f MB, line ring %d x %.1f kB\n",
+		yiq / 1048576.0, colour / 1048576.0, fml / 1048576.0, s->olines, lines / 1024.0 / s->olines
+	);
+	
+	fprintf(stderr, "Table pages: %zu x %d kB", pages[HUGE_NONE], SMALL_PAGE_SIZE / 1024);
+	if(pages[HUGE_HUGETLB]) fprintf(stderr, ", %zu x %d MB hugetlb", pages[HUGE_HUGETLB], HUGE_PAGE_SIZE / 1048576);
+	if(pages[HUGE_TRANSPARENT]) fprintf(stderr, ", %zu x %d MB transparent", pages[HUGE_TRANSPARENT], HUGE_PAGE_SIZE / 1048576);
+	fprintf(stderr, "\n");
 }
 
 size_t vid_get_framebuffer_length(vid_t *s)
@@ -4292,6 +4751,34 @@ size_t vid_get_framebuffer_length(vid_t *s)
 	return(sizeof(uint32_t) * s->active_width * s->conf.active_lines);
 }
 
+int vid_yiq_frames(vid_t *s)
+{
+	/* YIQ frames skip the gamma correction, and the field
+	 * sequential colour modes need the separate RGB channels */
+	return(s->conf.gamma == 1.0 &&
+	       s->conf.type != VID_MAC &&
+	       s->conf.colour_mode != VID_APOLLO_FSC &&
+	       s->conf.colour_mode != VID_CBS_FSC);
+}
+
+static inline int16_t _limit16(int32_t v)
+{
+	return(v < -INT16_MAX ? -INT16_MAX : (v > INT16_MAX ? INT16_MAX : v));
+}
+
+void vid_yuv_to_yiq(vid_t *s, int16_t *y, int16_t *i, int16_t *q, const uint8_t *py, const uint8_t *pu, const uint8_t *pv, int n)
+{
+	const int32_t (*lut)[0x100] = (const int32_t (*)[0x100]) s->yuv_level_lookup;
+	int x;
+	
+	for(x = 0; x < n; x++)
+	{
+		y[x] = _limit16(lut[0][py[x]]);
+		i[x] = _limit16(lut[1][pu[x]] + lut[2][pv[x]]);
+		q[x] = _limit16(lut[3][pu[x]] + lut[4][pv[x]]);
+	}
+}
+
 static vid_line_t *_vid_next_line(vid_t *s, size_t *samples)
 {
 	vid_line_t *l = s->output_process->lines[0];
@@ -4305,7 +4792,16 @@ static vid_line_t *_vid_next_line(vid_t *s, size_t *samples)
 		{
 			return(NULL);
 		}
-		s->framebuffer = _av_read_video(s, &s->ratio);
+		if(s->av_read_yiq)
+		{
+			s->yiq_framebuffer = _av_read_yiq(s, &s->ratio);
+			s->framebuffer = NULL;
+		}
+		else
+		{
+			s->framebuffer = _av_read_video(s, &s->ratio);
+			s->yiq_framebuffer = NULL;
+		}
 	}
 	
 	for(i = 0; i < s->nprocesses; i++)
@@ -4317,6 +4813,11 @@ static vid_line_t *_vid_next_line(vid_t *s, size_t *samples)
 			p->process(p->vid, p->arg, p->nlines, p->lines);
 		}
 		
+		if(s->stage_crc)
+		{
+			p->crc = crc32(p->crc, (const Bytef *) p->lines[0]->output, sizeof(int16_t) * 2 * p->lines[0]->width);
+		}
+		
 		for(j = 0; j < p->nlines; j++)
 		{
 			p->lines[j] = p->lines[j]->next;
@@ -4339,6 +4840,61 @@ static vid_line_t *_vid_next_line(vid_t *s, size_t *samples)
 	return(l);
 }
 
+int vid_repeat_period(vid_t *s)
+{
+	const vid_config_t *c = &s->conf;
+	int64_t p, n, d;
+	
+	/* Returns the number of lines after which the output will repeat
+	 * for a looping source, or 0 if it contains elements that never
+	 * repeat such as clocks, teletext time or scrambling */
+	if(c->type == VID_MAC || c->teletext || c->timestamp || c->vitc ||
+	   c->videocrypt || c->videocrypt2 || c->videocrypts ||
+	   c->syster || c->systercnr || c->d11 || c->eurocrypt ||
+	   c->passthru || (c->dance_level > 0 && c->dance_carrier != 0))
+	{
+		return(0);
+	}
+	
+	p = c->lines;
+	
+	/* The colour subcarrier sequence */
+	if(c->colour_lookup_lines > 0)
+	{
+		p = p / gcd(p, c->colour_lookup_lines) * c->colour_lookup_lines;
+	}
+	
+	/* SECAM alternates Db/Dr on every line, including across frames */
+	if(c->colour_mode == VID_SECAM && (p & 1))
+	{
+		p *= 2;
+	}
+	
+	/* The ACP pulse level cycle is 428 frames long */
+	if(c->acp)
+	{
+		n = (int64_t) c->lines * 428;
+		p = p / gcd(p, n) * n;
+	}
+	
+	/* The NICAM frame flag repeats every 16 frames of 1ms */
+	if(c->nicam_level > 0 && c->nicam_carrier != 0)
+	{
+		n = (int64_t) c->lines * c->frame_rate_num * 16;
+		d = (int64_t) c->frame_rate_den * 1000;
+		
+		if(n % d != 0)
+		{
+			return(0);
+		}
+		
+		n /= d;
+		p = p / gcd(p, n) * n;
+	}
+	
+	return(p > INT32_MAX ? 0 : p);
+}
+
 int16_t *vid_next_line(vid_t *s, size_t *samples)
 {
 	vid_line_t *l;
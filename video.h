@@ -84,12 +84,31 @@ typedef struct vid_t vid_t;
 #define VID_75US 2
 #define VID_J17  3
 
+/* A frame of Y, I and Q planes already at signal level. Each plane
+ * is active_width x active_lines samples with no padding */
+typedef struct {
+	const int16_t *y;
+	const int16_t *i;
+	const int16_t *q;
+} vid_yiq_frame_t;
+
 /* AV source function prototypes */
 typedef uint32_t *(*vid_read_video_t)(void *private, float *ratio);
+typedef const vid_yiq_frame_t *(*vid_read_yiq_t)(void *private, float *ratio);
 typedef int16_t *(*vid_read_audio_t)(void *private, size_t *samples);
 typedef int (*vid_eof_t)(void *private);
 typedef int (*vid_close_t)(void *private);
 
+/* An AV source's callbacks, for opening a source before it is attached */
+typedef struct {
+	void *private;
+	vid_read_video_t read_video;
+	vid_read_yiq_t read_yiq;
+	vid_read_audio_t read_audio;
+	vid_eof_t eof;
+	vid_close_t close;
+} vid_av_source_t;
+
 
 
 /* RF modulation */
@@ -343,6 +362,9 @@ struct _lineprocess_t {
 	/* Callback parameters */
 	vid_t *vid;
 	void *arg;
+	
+	/* CRC of the lines leaving this process, if stage_crc is set */
+	uint32_t crc;
 };
 
 struct vid_t {
@@ -352,6 +374,7 @@ struct vid_t {
 	void *av_font;
 	void *av_sub;
 	vid_read_video_t av_read_video;
+	vid_read_yiq_t av_read_yiq;
 	vid_read_audio_t av_read_audio;
 	vid_eof_t av_eof;
 	vid_close_t av_close;
@@ -362,9 +385,10 @@ struct vid_t {
 	
 	/* Logo configuration */
 	image_t vid_logo;
-
-	/* Media icons */
-	image_t media_icons[4];
+	
+	/* PRNG state for the scramblers. Each channel has its
+	 * own, as the channels are rendered on separate threads */
+	unsigned int rand_seed;
 	
 	/* Video setup */
 	int pixel_rate;
@@ -385,6 +409,10 @@ struct vid_t {
 	
 	_yiq16_t *yiq_level_lookup;
 	
+	/* Full range YCbCr > signal level lookup tables: Y, I from Cb,
+	 * I from Cr, Q from Cb and Q from Cr */
+	int32_t yuv_level_lookup[5][0x100];
+	
 	int colour_lookup_width;
 	int16_t *colour_lookup;
 	
@@ -400,6 +428,7 @@ struct vid_t {
 	fir_int16_t secam_l_fir;
 	cint16_t *fm_secam_bell;
 	int16_t secam_fsync_level;
+	int16_t *secam_fid_ramp[2];
 	
 	int fsc_flag_left;
 	int fsc_flag_width;
@@ -407,6 +436,7 @@ struct vid_t {
 	
 	/* Video state */
 	uint32_t *framebuffer;
+	const vid_yiq_frame_t *yiq_framebuffer;
 	
 	/* The frame and line number being rendered next */
 	int bframe;
@@ -479,11 +509,15 @@ struct vid_t {
 	FILE *passthru;
 	int16_t *passline;
 	
+	/* Output stage flags (_OUTSTAGE_*) */
+	int outstage;
+	
 	/* D/D2-MAC specific data */
 	mac_t mac;
 	
 	/* Output line(s) buffer */
 	int olines;
+	int oline_stride;
 	vid_line_t *oline;
 	int max_width;
 	
@@ -491,15 +525,20 @@ struct vid_t {
 	int nprocesses;
 	_lineprocess_t *processes;
 	_lineprocess_t *output_process;
+	int stage_crc;
 };
 
 extern const vid_configs_t vid_configs[];
 
 extern int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const vid_config_t * const conf);
 extern void vid_free(vid_t *s);
+extern void vid_av_attach(vid_t *s, const vid_av_source_t *src);
 extern int vid_av_close(vid_t *s);
 extern void vid_info(vid_t *s);
 extern size_t vid_get_framebuffer_length(vid_t *s);
+extern int vid_yiq_frames(vid_t *s);
+extern void vid_yuv_to_yiq(vid_t *s, int16_t *y, int16_t *i, int16_t *q, const uint8_t *py, const uint8_t *pu, const uint8_t *pv, int n);
+extern int vid_repeat_period(vid_t *s);
 extern int16_t *vid_next_line(vid_t *s, size_t *samples);
 
 #endif
@@ -156,9 +156,9 @@ static inline uint8_t _rnibble(uint8_t a)
 	return((a >> 4) | (a << 4));
 }
 
-void _rand_vc_seed(uint8_t *message)
+void _rand_vc_seed(uint8_t *message, unsigned int *seed)
 {
-	for(int i = 13; i < 27; i++) message[i] = rand() + 0xFF;
+	for(int i = 13; i < 27; i++) message[i] = rand_r(seed) + 0xFF;
 }
 
 /* Reverse calculated control word */
@@ -301,12 +301,12 @@ void _vc_process_p07_msg(uint8_t *message, uint64_t *cw, int ca)
 	for (i = 0; i < 64; i++) _vc_kernel07(cw, &oi, message[31], offset, ca);
 }
 
-void vc_seed_p07(_vc_block_t *s, int ca)
+void vc_seed_p07(_vc_block_t *s, int ca, unsigned int *seed)
 {
 	uint64_t cw[8];
 
 	/* Random seed for bytes 12 to 26 */
-	_rand_vc_seed(s->messages[5]);
+	_rand_vc_seed(s->messages[5], seed);
 	
 	/* Process Videocrypt message */
 	_vc_process_p07_msg(s->messages[5], cw, ca);
@@ -333,12 +333,12 @@ void vc_emm_p07(_vc_block_t *s, int cmd, uint32_t cardserial)
 }
 
 
-void vc_seed_vc2(_vc2_block_t *s, int ca)
+void vc_seed_vc2(_vc2_block_t *s, int ca, unsigned int *seed)
 {
 	uint64_t cw[8];
 	
 	/* Random seed for bytes 12 to 26 */
-	_rand_vc_seed(s->messages[5]);
+	_rand_vc_seed(s->messages[5], seed);
 	
 	/* Process Videocrypt message */
 	_vc_process_p07_msg(s->messages[5], cw, ca);
@@ -396,7 +396,7 @@ void _vc_kernel09(const uint8_t in, uint64_t *out)
 	for(i = 0; i < 8; i++) out[i] = temp[i];
 }
 
-void _vc_process_p09_msg(uint8_t *message, uint64_t *cw, int nanos)
+void _vc_process_p09_msg(uint8_t *message, uint64_t *cw, int nanos, unsigned int *seed)
 {
 	int i;
 	uint8_t a, b, bb, xor[4];
@@ -428,11 +428,11 @@ void _vc_process_p09_msg(uint8_t *message, uint64_t *cw, int nanos)
 		/* Set EEPROM address */
 		nanobuffer[0] = 0x09;
 		nanobuffer[1] = 0x11;
-		nanobuffer[2] = rand() % (0x7F - 0x3F + 1);
+		nanobuffer[2] = rand_r(seed) % (0x7F - 0x3F + 1);
 		
 		/* Set EEPROM offset/number of bytes to read */
 		nanobuffer[3] = 0x30;
-		nanobuffer[4] = rand() % 0x3F;
+		nanobuffer[4] = rand_r(seed) % 0x3F;
 		
 		/* End session */
 		nanobuffer[5] = 0x03;
@@ -515,15 +515,15 @@ void _vc_process_p09_msg(uint8_t *message, uint64_t *cw, int nanos)
 	cw[7] &= 0x0F;
 }
 
-void vc_seed_p09(_vc_block_t *s, int nanos)
+void vc_seed_p09(_vc_block_t *s, int nanos, unsigned int *seed)
 {
 	uint64_t cw[8];
 	
 	/* Random seed for bytes 12 to 26 */
-	_rand_vc_seed(s->messages[5]);
+	_rand_vc_seed(s->messages[5], seed);
 	
 	/* Process Videocrypt message */
-	_vc_process_p09_msg(s->messages[5], cw, nanos);
+	_vc_process_p09_msg(s->messages[5], cw, nanos, seed);
 	
 	/* Reverse calculated control word */
 	s->codeword = _rev_cw(cw);
@@ -543,13 +543,13 @@ void vc_emm_p09(_vc_block_t *s, int cmd, uint32_t cardserial)
 	_xor_serial(s->messages[2], cmd, cardserial, 0xA9);
 	
 	/* Process Videocrypt message */
-	_vc_process_p09_msg(s->messages[2], cw, 0);
+	_vc_process_p09_msg(s->messages[2], cw, 0, NULL);
 }
 
-void vc_seed_xtea(_vc_block_t *s)
+void vc_seed_xtea(_vc_block_t *s, unsigned int *seed)
 {
 	/* Random seed for bytes 11 to 31 */
-	for(int i=11; i < 32; i++) s->messages[5][i] = rand() + 0xFF;
+	for(int i=11; i < 32; i++) s->messages[5][i] = rand_r(seed) + 0xFF;
 	
 	int i;
 	uint32_t v0, v1, sum = 0;
@@ -640,7 +640,7 @@ void _hash_ppv(uint64_t *answ, size_t len)
 	}
 }
 
-void vc_seed_ppv(_vc_block_t *s, uint8_t ppv_card_data[7])
+void vc_seed_ppv(_vc_block_t *s, uint8_t ppv_card_data[7], unsigned int *seed)
 {
 	int i;
 	
@@ -649,8 +649,8 @@ void vc_seed_ppv(_vc_block_t *s, uint8_t ppv_card_data[7])
 	uint64_t serial[5];
 	
 	/* Random bytes */
-	s->messages[0][21] = rand() + 0xFF;
-	s->messages[0][22] = rand() + 0xFF;
+	s->messages[0][21] = rand_r(seed) + 0xFF;
+	s->messages[0][22] = rand_r(seed) + 0xFF;
 	
 	/* Copy data into buffers */
 	for(i = 0; i < 31; i++)    msg[i] = s->messages[0][i];
@@ -670,7 +670,7 @@ void vc_seed_ppv(_vc_block_t *s, uint8_t ppv_card_data[7])
 	for(i = 0, s->codeword = 0; i < 8; i++)	s->codeword = msg[i + 1] << (i * 8) | s->codeword;
 }
 
-void vc_seed(_vc_block_t *s, int mode)
+void vc_seed(_vc_block_t *s, int mode, unsigned int *seed)
 {
 	switch(mode)
 	{
@@ -679,19 +679,19 @@ void vc_seed(_vc_block_t *s, int mode)
 		case(VC_SKY05):
 		case(VC_SKY07):
 		case(VC_JSTV):
-			vc_seed_p07(s, mode);
+			vc_seed_p07(s, mode, seed);
 			break;
 			
 		case(VC_SKY09):
-			vc_seed_p09(s, 0);
+			vc_seed_p09(s, 0, seed);
 			break;
 			
 		case(VC_SKY09_NANO):
-			vc_seed_p09(s, 1);
+			vc_seed_p09(s, 1, seed);
 			break;
 			
 		case(VC_XTEA):
-			vc_seed_xtea(s);
+			vc_seed_xtea(s, seed);
 			break;
 			
 		default:
@@ -58,20 +58,20 @@ enum {
 
 /* Videocrypt 1 */
 extern void vc_seed_p03(_vc_block_t *s);
-extern void vc_seed_p07(_vc_block_t *s, int ca);
-extern void vc_seed_p09(_vc_block_t *s, int nanos);
+extern void vc_seed_p07(_vc_block_t *s, int ca, unsigned int *seed);
+extern void vc_seed_p09(_vc_block_t *s, int nanos, unsigned int *seed);
 
 extern void vc_emm_p07(_vc_block_t *s, int cmd, uint32_t cardserial);
 extern void vc_emm_p09(_vc_block_t *s, int cmd, uint32_t cardserial);
 
-extern void vc_seed_xtea(_vc_block_t *s);
-extern void vc_seed_ppv(_vc_block_t *s, uint8_t _ppv_card_data[7]);
+extern void vc_seed_xtea(_vc_block_t *s, unsigned int *seed);
+extern void vc_seed_ppv(_vc_block_t *s, uint8_t _ppv_card_data[7], unsigned int *seed);
 
 /* Videocrypt 2 */
-extern void vc_seed_vc2(_vc2_block_t *s, int ca);
+extern void vc_seed_vc2(_vc2_block_t *s, int ca, unsigned int *seed);
 extern void vc2_emm(_vc2_block_t *s, int cmd, uint32_t cardserial, int ca);
 
 extern void vc_emm(_vc_block_t *s, int mode, uint32_t cardserial, int b, int i);
-extern void vc_seed(_vc_block_t *s, int mode);
+extern void vc_seed(_vc_block_t *s, int mode, unsigned int *seed);
 
 #endif
\ No newline at end of file
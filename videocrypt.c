@@ -208,8 +208,6 @@ int vc_init(vc_t *s, vid_t *vid, const char *mode, const char *mode2)
 {
 	double f, l;
 	int i, x;
-	time_t t;
-	srand((unsigned) time(&t));
 	
 	memset(s, 0, sizeof(vc_t));
 	
@@ -246,8 +244,8 @@ int vc_init(vc_t *s, vid_t *vid, const char *mode, const char *mode2)
 				s->ppv_card_data[6] = 0x00; /* Key b */
 			}
 			
-			vc_seed_ppv(&s->blocks[0], s->ppv_card_data);
-			vc_seed_ppv(&s->blocks[1], s->ppv_card_data);
+			vc_seed_ppv(&s->blocks[0], s->ppv_card_data, &vid->rand_seed);
+			vc_seed_ppv(&s->blocks[1], s->ppv_card_data, &vid->rand_seed);
 		}
 		else if(s->mode->cwtype == VC_CW_DYNAMIC)
 		{
@@ -263,8 +261,8 @@ int vc_init(vc_t *s, vid_t *vid, const char *mode, const char *mode2)
 			s->blocks[0].messages[5][6] = s->mode->channelid;
 			s->blocks[1].messages[5][6] = s->mode->channelid;
 
-			vc_seed(&s->blocks[0], s->mode->mode);
-			vc_seed(&s->blocks[1], s->mode->mode);
+			vc_seed(&s->blocks[0], s->mode->mode, &vid->rand_seed);
+			vc_seed(&s->blocks[1], s->mode->mode, &vid->rand_seed);
 		}
 		
 		/* Process EMM if enabled for the mode */
@@ -321,8 +319,8 @@ int vc_init(vc_t *s, vid_t *vid, const char *mode, const char *mode2)
 			s->blocks2[0].messages[5][2] = s->mode->channelid;
 			s->blocks2[1].messages[5][2] = s->mode->channelid;
 
-			vc_seed_vc2(&s->blocks2[0], s->mode->mode);
-			vc_seed_vc2(&s->blocks2[1], s->mode->mode);
+			vc_seed_vc2(&s->blocks2[0], s->mode->mode, &vid->rand_seed);
+			vc_seed_vc2(&s->blocks2[1], s->mode->mode, &vid->rand_seed);
 		
 			/* If in simulcrypt mode, do the initial CW sync here */
 			if(mode)
@@ -509,7 +507,7 @@ int vc_render_line(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 			{
 				if(v->mode->cwtype == VC_CW_DYNAMIC)
 				{
-					vc_seed(&v->blocks[v->block], v->mode->mode);
+					vc_seed(&v->blocks[v->block], v->mode->mode, &s->rand_seed);
 				}
 				
 				if(strcmp(mode,"ppv") == 0)
@@ -530,7 +528,7 @@ int vc_render_line(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 						
 					}
 					
-					vc_seed_ppv(&v->blocks[v->block], v->ppv_card_data);
+					vc_seed_ppv(&v->blocks[v->block], v->ppv_card_data, &s->rand_seed);
 				}
 				
 				if(s->conf.showserial) v->blocks[v->block].messages[strcmp(mode,"ppv") == 0 ? 1 : 0][0] = 0x24;
@@ -572,7 +570,7 @@ int vc_render_line(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 
 			if(mode2)
 			{
-				if(strcmp(mode2,"conditional") == 0 && (v->counter & 0x3F) == 0x20 ) vc_seed_vc2(&v->blocks2[v->block2], v->mode->mode);
+				if(strcmp(mode2,"conditional") == 0 && (v->counter & 0x3F) == 0x20 ) vc_seed_vc2(&v->blocks2[v->block2], v->mode->mode, &s->rand_seed);
 				
 				/* OSD bytes 17 - 24 in OSD message 0x21 are used in seed generation in Videocrypt II. */
 				/* XOR with VC1 seed for simulcrypt. */
@@ -99,8 +99,9 @@ int vitc_init(vitc_t *s, vid_t *vid)
 	i = round((vid->white_level - vid->black_level) * 0.785);
 	s->lut = vbidata_init_step(hr, vid->width, i, vid->pixel_rate * 200e-9);
 	
-	if(!s->lut)
+	if(!s->lut || vbidata_line_init(&s->line, vid->width) != 0)
 	{
+		vitc_free(s);
 		return(VID_OUT_OF_MEMORY);
 	}
 	
@@ -110,6 +111,7 @@ int vitc_init(vitc_t *s, vid_t *vid)
 void vitc_free(vitc_t *s)
 {
 	free(s->lut);
+	vbidata_line_free(&s->line);
 	memset(s, 0, sizeof(vitc_t));
 }
 
@@ -165,6 +167,15 @@ int vitc_render(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 		timecode |= (l->line >= v->lines[1] ? 1 : 0) << 31; /* Field flag, 0: first/odd field, 1: second/even field */
 	}
 	
+	if(v->line_valid && timecode == v->line_timecode)
+	{
+		/* Same data as the last line */
+		vbidata_line_add(&v->line, l->output, 2);
+		l->vbialloc = 1;
+		
+		return(1);
+	}
+	
 	/* User bits, not used here */
 	userdata = 0x00;
 	
@@ -190,7 +201,11 @@ int vitc_render(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 	x = _bits(data, x, crc, 8);
 	
 	/* Render the line */
-	vbidata_render_nrz(v->lut, data, -21, x, VBIDATA_LSB_FIRST, l->output, 2);
+	vbidata_line_render_nrz(&v->line, v->lut, data, -21, x, VBIDATA_LSB_FIRST);
+	v->line_timecode = timecode;
+	v->line_valid = 1;
+	
+	vbidata_line_add(&v->line, l->output, 2);
 	
 	l->vbialloc = 1;
 	
@@ -20,6 +20,7 @@
 
 #include <stdint.h>
 #include "video.h"
+#include "vbidata.h"
 
 typedef struct {
 	int lines[2];
@@ -27,6 +28,11 @@ typedef struct {
 	int fps;
 	int frame_drop;
 	int16_t *lut;
+	
+	/* The rendered line, repeated on both VITC lines of a field */
+	vbidata_line_t line;
+	uint32_t line_timecode;
+	int line_valid;
 } vitc_t;
 
 extern int vitc_init(vitc_t *s, vid_t *vid);
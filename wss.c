@@ -94,8 +94,9 @@ int wss_init(wss_t *s, vid_t *vid, char *mode)
 		VBIDATA_FILTER_RC, 0.7
 	);
 	
-	if(!s->lut)
+	if(!s->lut || vbidata_line_init(&s->line, s->vid->width) != 0)
 	{
+		wss_free(s);
 		return(VID_OUT_OF_MEMORY);
 	}
 	
@@ -131,6 +132,7 @@ void wss_free(wss_t *s)
 	if(s == NULL) return;
 	
 	free(s->lut);
+	vbidata_line_free(&s->line);
 	
 	memset(s, 0, sizeof(wss_t));
 }
@@ -139,6 +141,7 @@ int wss_render(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 {
 	wss_t *w = arg;
 	vid_line_t *l = lines[0];
+	uint8_t code;
 	int x;
 	
 	/* WSS is rendered on line 23 */
@@ -147,11 +150,21 @@ int wss_render(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 		return(1);
 	}
 	
-	if(w->code == 0xFF)
+	code = w->code;
+	
+	if(code == 0xFF)
 	{
 		/* Auto mode selects between 4:3 and 16:9 based on the
 		 * the ratio of the source frame. */
-		_group_bits(w->vbi, s->ratio <= (14.0 / 9.0) ? 0x08 : 0x07, 29 + 24, 4);
+		code = s->ratio <= (14.0 / 9.0) ? 0x08 : 0x07;
+	}
+	
+	/* Only render the bits again when they change */
+	if(code != w->line_code)
+	{
+		_group_bits(w->vbi, code, 29 + 24, 4);
+		vbidata_line_render_nrz(&w->line, w->lut, w->vbi, -55, 137, VBIDATA_MSB_FIRST);
+		w->line_code = code;
 	}
 	
 	/* 42.5μs of line 23 needs to be blanked otherwise the WSS bits may
@@ -161,7 +174,7 @@ int wss_render(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 		l->output[x * 2] = s->black_level;
 	}
 	
-	vbidata_render_nrz(w->lut, w->vbi, -55, 137, VBIDATA_MSB_FIRST, l->output, 2);
+	vbidata_line_add(&w->line, l->output, 2);
 	
 	l->vbialloc = 1;
 	
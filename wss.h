@@ -20,6 +20,7 @@
 
 #include <stdint.h>
 #include "video.h"
+#include "vbidata.h"
 
 typedef struct {
 	vid_t *vid;
@@ -27,6 +28,10 @@ typedef struct {
 	int16_t *lut;
 	uint8_t vbi[18];
 	int blank_width;
+	
+	/* The rendered line and the aspect ratio code it was rendered with */
+	vbidata_line_t line;
+	uint8_t line_code;
 } wss_t;
 
 extern int wss_init(wss_t *s, vid_t *vid, char *mode);